@@ -14,37 +14,80 @@ void Codegen::gen()
     builder = std::make_unique<IRBuilder<>>(*context);
 
     // Codegen begins
+    // Streaming: each function is lowered as soon as it is parsed, its
+    // nodes go away when the next one is taken. Pipelined, the next
+    // ones are lexed and parsed meanwhile.
+    if (parser->isStreaming())
+    {
+        while (auto func = parser->nextFunc())
+        {
+            funcGen(func);
+        }
+        return;
+    }
+
+    if (use_flat)
+    {
+        flat.build(*parser);
+        flat_vals.resize(flat.getNumExprs());
+
+        for (auto &func : flat.getFuncs())
+        {
+            flatFuncGen(func);
+        }
+        return;
+    }
+
     auto &program = parser->getProgram();
     auto &statements = program.getStatements();
 
-    for (auto &statement : statements)
+    for (auto statement : statements)
     {
         assert(statement->isStatementFunc());
-        funcGen(statement.get());
+        funcGen(static_cast<FuncStatement*>(statement));
     }
 }
 
-void Codegen::funcGen(Statement *_statement)
+void Codegen::funcGen(FuncStatement *func_statement)
 {
-    FuncStatement *func_statement = 
-        static_cast<FuncStatement*>(_statement);
-
-    // We need to extract the local variables reference
-    local_vars_ref.push_back(func_statement->getLocalVars());
-    local_vars_tracker.emplace_back();
-
-    auto& func_name = func_statement->getFuncName();
+    auto func_sym = func_statement->getFuncSym();
     auto& func_args = func_statement->getFuncArgs();
     auto& func_codes = func_statement->getFuncCodes();
 
+    std::vector<std::pair<SymbolId, ValueType::Type>> args;
+    for (auto &arg : func_args)
+    {
+        args.emplace_back(arg.getSym(), arg.getArgType());
+    }
+
+    Function *ir_gen_func = funcBeginGen(func_statement->getFuncName(),
+                                         func_statement->getRetType(),
+                                         args);
+
+    // (2) Rest of the codes
+    for (auto statement : func_codes)
+    {
+        statementGen(func_sym, statement);
+    }
+
+    funcEndGen(ir_gen_func, func_statement->getRetType());
+}
+
+Function* Codegen::funcBeginGen(
+    std::string_view func_name,
+    ValueType::Type ret_type,
+    const std::vector<std::pair<SymbolId, ValueType::Type>> &args)
+{
+    local_vars.enterScope();
+
     // IR Gen
     // Prepare argument types
     std::vector<Type *> ir_gen_func_args;
-    for (auto &arg : func_args)
+    for (auto [sym, arg_type] : args)
     {
-        if (arg.getArgType() == ValueType::Type::INT)
+        if (arg_type == ValueType::Type::INT)
             ir_gen_func_args.push_back(Type::getInt32Ty(*context));
-        else if (arg.getArgType() == ValueType::Type::FLOAT)
+        else if (arg_type == ValueType::Type::FLOAT)
             ir_gen_func_args.push_back(Type::getFloatTy(*context));
         else
             assert(false && 
@@ -53,11 +96,11 @@ void Codegen::funcGen(Statement *_statement)
 
     // Prepare return type
     Type *ir_gen_ret_type;
-    if (func_statement->getRetType() == ValueType::Type::VOID)
+    if (ret_type == ValueType::Type::VOID)
         ir_gen_ret_type = Type::getVoidTy(*context);
-    else if (func_statement->getRetType() == ValueType::Type::INT)
+    else if (ret_type == ValueType::Type::INT)
         ir_gen_ret_type = Type::getInt32Ty(*context);
-    else if (func_statement->getRetType() == ValueType::Type::FLOAT)
+    else if (ret_type == ValueType::Type::FLOAT)
         ir_gen_ret_type = Type::getFloatTy(*context);
     else
         assert(false && 
@@ -87,36 +130,33 @@ void Codegen::funcGen(Statement *_statement)
     // Generate the code section
     // (1) Allocate space for arguments
     auto i = 0;
-    std::vector<ValueType::Type> func_arg_types;
-    if (ir_gen_func->arg_size())
-        func_arg_types = parser->getFuncArgTypes(func_name);
     for (auto &arg : ir_gen_func->args())
     {
+        auto [sym, arg_type] = args[i];
         Value *val = &arg;
         Value *reg;
 
-        if (func_arg_types[i] == ValueType::Type::INT)
+        if (arg_type == ValueType::Type::INT)
         {
             reg = builder->CreateAlloca(Type::getInt32Ty(*context));
             builder->CreateStore(val, reg);
-	}
-        else if (func_arg_types[i] == ValueType::Type::FLOAT)
+        }
+        else if (arg_type == ValueType::Type::FLOAT)
         {
             reg = builder->CreateAlloca(Type::getFloatTy(*context));
             builder->CreateStore(val, reg);
-	}
+        }
 
-        recordLocalVar(func_args[i].getLiteral(), reg);
+        recordLocalVar(sym, arg_type, reg);
         i++;
     }
 
-    // (2) Rest of the codes
-    for (auto &statement : func_codes)
-    {
-        statementGen(func_name, statement.get());
-    }
+    return ir_gen_func;
+}
 
-    if (func_statement->getRetType() == ValueType::Type::VOID)
+void Codegen::funcEndGen(Function *ir_gen_func, ValueType::Type ret_type)
+{
+    if (ret_type == ValueType::Type::VOID)
     {
         Value *val = nullptr;
         builder->CreateRet(val);
@@ -125,101 +165,92 @@ void Codegen::funcGen(Statement *_statement)
     // Verify function
     verifyFunction(*ir_gen_func);
 
-    local_vars_tracker.pop_back();
-    local_vars_ref.pop_back();
+    local_vars.exitScope();
     num_loops_per_func = 0;
 }
 
-void Codegen::statementGen(std::string &func_name,
+void Codegen::statementGen(SymbolId func_name,
                            Statement* statement)
 {
-    if (statement->isStatementAssn())
-    {
-        assnGen(statement);
-    }
-    else if (statement->isStatementBuiltinCall())
-    {
-        builtinGen(statement);
-    }
-    else if (statement->isStatementRet())
-    {
-        retGen(func_name, statement);
-    }
-    else if (statement->isStatementNormalCall())
-    {
-        callGen(statement);
-    }
-    else if (statement->isStatementIf())
-    {
-        ifGen(func_name, statement);
-    }
-    else if (statement->isStatementFor())
-    {
-        forGen(func_name, statement);
-    }
-    else if (statement->isStatementWhile())
-    {
-        whileGen(func_name, statement);
-    }
+    visit(*statement, Overloaded {
+        [&](AssnStatement &assn) { assnGen(&assn); },
+        [&](CallStatement &call)
+        {
+            if (call.isStatementBuiltinCall())
+                builtinGen(&call);
+            else
+                callGen(&call);
+        },
+        [&](RetStatement &ret) { retGen(&ret); },
+        [&](IfStatement &if_s) { ifGen(func_name, &if_s); },
+        [&](ForStatement &for_s) { forGen(func_name, &for_s); },
+        [&](WhileStatement &while_s) { whileGen(func_name, &while_s); },
+        [&](FuncStatement &) { assert(false && "nested function"); }
+    });
 }
 
-void Codegen::assnGen(Statement *_statement)
+void Codegen::assnGen(AssnStatement *assn_statement)
 {
-    AssnStatement* assn_statement = 
-        static_cast<AssnStatement*>(_statement);
-
     auto iden = assn_statement->getIden();
     auto expr = assn_statement->getExpr();
 
     // Allocate for identifier
-    std::string var_name;
-    ValueType::Type var_type;
+    SymbolId var_name;
+    ValueType::Type var_type = assn_statement->getDeclType();
     Value *reg;
 
-    ArrayExpression* array_info =
-        (expr->isExprArray()) ?
-        static_cast<ArrayExpression*>(expr) :
-        nullptr;
+    // Number of elements of an array initializer
+    Expression *num_ele = visit(*expr, Overloaded {
+        [](ArrayExpression &array) { return array.getNumElements(); },
+        [](ConstArrayExpression &array) { return array.getNumElements(); },
+        [](auto &) -> Expression* { return nullptr; }
+    });
 
     reg = allocaForIden(var_name, var_type, 
-                        iden, array_info);
+                        iden, num_ele);
 
     // Extract assigned value    
     Value *val = nullptr;
-    if (array_info != nullptr)
+    if (expr->isExprArray())
+    {
+        arrayExprGen(reg, static_cast<ArrayExpression*>(expr));
+    }
+    else if (expr->isExprConstArray())
     {
-        arrayExprGen(var_type, reg, array_info);
+        constArrayExprGen(reg, static_cast<ConstArrayExpression*>(expr));
     }
     else
     {
-        val = exprGen(var_type, expr);
+        val = exprGen(expr);
         builder->CreateStore(val, reg);
     }
 }
 
-Value* Codegen::allocaForIden(std::string &var_name, 
+Value* Codegen::allocaForIden(SymbolId &var_name, 
                               ValueType::Type &var_type,
                               Expression* iden,
-                              ArrayExpression* array_info)
+                              Expression* num_ele_expr)
 {
     // We need to make sure the variable has not been allocated before
 
     // Determine identifier type
-    if (iden->isExprLiteral())
-    {
-        LiteralExpression *lit = 
-            static_cast<LiteralExpression*>(iden);
+    var_name = visit(*iden, Overloaded {
+        [](LiteralExpression &lit) { return lit.getSym(); },
+        [](IndexExpression &index) { return index.getIdenSym(); },
+        [](auto &) -> SymbolId
+        {
+            assert(false && "not an assignable expression");
+            return 0;
+        }
+    });
 
-        var_name = lit->getLiteral();
-        var_type = getValType(var_name);
-    }
-    else if (iden->isExprIndex())
+    // var_type is the declared one for a declaration, any other
+    // variable has been allocated already and its type is recorded
+    if (auto var = local_vars.lookup(var_name); var != nullptr)
     {
-        IndexExpression *index = static_cast<IndexExpression*>(iden);
-	
-        var_name = index->getIden();
-        var_type = getValType(var_name);
+        var_type = var->type;
     }
+    assert(var_type != ValueType::Type::MAX);
 
     Value *reg;
     if (auto [is_allocated, reg_base] = getReg(var_name);
@@ -227,8 +258,6 @@ Value* Codegen::allocaForIden(std::string &var_name,
     {
         // Allocating new variables, must be a literal iden
         assert(iden->isExprLiteral());
-        LiteralExpression *lit = 
-            static_cast<LiteralExpression*>(iden);
 
         if (var_type == ValueType::Type::INT)
         {
@@ -241,17 +270,15 @@ Value* Codegen::allocaForIden(std::string &var_name,
         else if (var_type == ValueType::Type::INT_ARRAY || 
                  var_type == ValueType::Type::FLOAT_ARRAY)
         {
-            assert(array_info != nullptr);
-
             // Extract number of elements
-            auto num_ele_expr = array_info->getNumElements();
+            assert(num_ele_expr != nullptr);
             assert(num_ele_expr->isExprLiteral());
 
             auto num_ele_lit = 
                 static_cast<LiteralExpression*>(num_ele_expr);
             assert(num_ele_lit->isLiteralInt());
     
-            auto num_ele_int = stoi(num_ele_lit->getLiteral());
+            auto num_ele_int = num_ele_lit->getIntVal();
 
             // Get array type
             Type *ele_type = (var_type == ValueType::Type::INT_ARRAY) ?
@@ -265,18 +292,18 @@ Value* Codegen::allocaForIden(std::string &var_name,
         else
         {
 	    std::cerr << "[Error] unsupported allocation type for "
-                      << var_name << "\n";
+                      << Interner::global().getName(var_name) << "\n";
             exit(0);
         }
 
-        recordLocalVar(var_name, reg);
+        recordLocalVar(var_name, var_type, reg);
     }
     else
     {
         if (iden->isExprIndex())
         {
             IndexExpression *index = static_cast<IndexExpression*>(iden);
-            Value *idx = exprGen(ValueType::Type::INT, index->getIndex());
+            Value *idx = exprGen(index->getIndex());
             std::vector<Value*> idxs;
             idxs.push_back(ConstantInt::get(*context, APInt(32, 0)));
             idxs.push_back(idx);
@@ -296,7 +323,7 @@ Value* Codegen::allocaForIden(std::string &var_name,
 // This one is bit different from our callGen implementation
 // since we are defining printVarInt/printVarFloat at current
 // compilation unit.
-void Codegen::builtinGen(Statement *_statement)
+void Codegen::builtinGen(CallStatement *built_in_statement)
 {
     static FunctionCallee printVarInt = 
         module->getOrInsertFunction("printVarInt",
@@ -308,21 +335,15 @@ void Codegen::builtinGen(Statement *_statement)
             Type::getVoidTy(*context), 
             Type::getFloatTy(*context));
     
-    CallStatement *built_in_statement = 
-        static_cast<CallStatement*>(_statement);
-
     auto call_expr = built_in_statement->getCallExpr();
     assert(call_expr->isExprCall());
 
-    auto &func_name = call_expr->getCallFunc();
+    auto func_name = call_expr->getCallFunc();
     auto &func_args = call_expr->getArgs();
     assert(func_args.size() == 1);
-    auto expr = func_args[0].get();
-
-    ValueType::Type var_type = (func_name == "printVarInt") ? 
-        ValueType::Type::INT : ValueType::Type::FLOAT;
+    auto expr = func_args[0];
 
-    Value *val = exprGen(var_type, expr);
+    Value *val = exprGen(expr);
     
     if (func_name == "printVarInt")
     {
@@ -334,27 +355,19 @@ void Codegen::builtinGen(Statement *_statement)
     }
 }
 
-void Codegen::callGen(Statement *_statement)
+void Codegen::callGen(CallStatement *call_statement)
 {
-     CallStatement *built_in_statement = 
-        static_cast<CallStatement*>(_statement);
-
-    auto call_expr = built_in_statement->getCallExpr();
+    auto call_expr = call_statement->getCallExpr();
     assert(call_expr->isExprCall());
 
     callExprGen(call_expr);
 }
 
-void Codegen::retGen(std::string &cur_func_name,
-                     Statement *_statement)
+void Codegen::retGen(RetStatement *ret)
 {
-    RetStatement* ret = static_cast<RetStatement*>(_statement);
-
     auto expr = ret->getRetVal();
 
-    ValueType::Type ret_type = parser->getFuncRetType(cur_func_name);
-
-    Value *val = exprGen(ret_type, expr);
+    Value *val = exprGen(expr);
     builder->CreateRet(val);
 }
 
@@ -362,8 +375,8 @@ Value* Codegen::condGen(Condition *cond)
 {
     auto var_type = cond->getType();
 
-    Value *left = exprGen(var_type, cond->getLeft());
-    Value *right = exprGen(var_type, cond->getRight());
+    Value *left = exprGen(cond->getLeft());
+    Value *right = exprGen(cond->getRight());
 
     Value* eval = nullptr;
     auto opr = cond->getOpr();
@@ -438,17 +451,15 @@ Value* Codegen::condGen(Condition *cond)
     return eval;
 }
 
-void Codegen::ifGen(std::string& parent_func_name, Statement *_statement)
+void Codegen::ifGen(SymbolId parent_func_name, IfStatement *if_s)
 {
-    IfStatement *if_s = 
-        static_cast<IfStatement*>(_statement);
-
     auto cond = condGen(if_s->getCond());
     auto &taken_block = if_s->getTakenBlock();
     auto &not_taken_block = if_s->getNotTakenBlock();
 
     // Build basic blocks for paths
     Function *func = builder->GetInsertBlock()->getParent();
+    std::string func_name(Interner::global().getName(parent_func_name));
     BasicBlock *taken_BB =
         BasicBlock::Create(*context, "", func);
 
@@ -469,56 +480,49 @@ void Codegen::ifGen(std::string& parent_func_name, Statement *_statement)
 
     // Build the taken path
     builder->SetInsertPoint(taken_BB);
-    local_vars_ref.push_back(if_s->getTakenBlockVars());
-    local_vars_tracker.emplace_back();
-    for (auto &statement : taken_block)
+    local_vars.enterScope();
+    for (auto statement : taken_block)
     {
-        statementGen(parent_func_name, statement.get());
+        statementGen(parent_func_name, statement);
     }
     builder->CreateBr(merge_BB);
-    local_vars_ref.pop_back();
-    local_vars_tracker.pop_back();
+    local_vars.exitScope();
 
     // Build the not
     if (not_taken_BB != nullptr)
     {
         builder->SetInsertPoint(not_taken_BB);
-        local_vars_ref.push_back(if_s->getNotTakenBlockVars());
-        local_vars_tracker.emplace_back();
-        for (auto &statement : not_taken_block)
+        local_vars.enterScope();
+        for (auto statement : not_taken_block)
         {
-            statementGen(parent_func_name, statement.get());
+            statementGen(parent_func_name, statement);
         }
         builder->CreateBr(merge_BB);
-        local_vars_ref.pop_back();
-        local_vars_tracker.pop_back();
+        local_vars.exitScope();
     }
 
     builder->SetInsertPoint(merge_BB);
 }
 
-void Codegen::forGen(std::string& parent_func_name, Statement *_statement)
+void Codegen::forGen(SymbolId parent_func_name, ForStatement *for_s)
 {
-    ForStatement *for_s = 
-        static_cast<ForStatement*>(_statement);
-
-    local_vars_ref.push_back(for_s->getBlockVars());
-    local_vars_tracker.emplace_back();
+    local_vars.enterScope();
 
     // Gen start
     assnGen(for_s->getStart());
 
     // Build basic blocks for paths
     Function *func = builder->GetInsertBlock()->getParent();
+    std::string func_name(Interner::global().getName(parent_func_name));
 
     BasicBlock *check_BB =
-        BasicBlock::Create(*context, parent_func_name + "_loop_header", func);
+        BasicBlock::Create(*context, func_name + "_loop_header", func);
 
     BasicBlock *body_BB =
-        BasicBlock::Create(*context, parent_func_name + "_loop_body", func);
+        BasicBlock::Create(*context, func_name + "_loop_body", func);
 
     BasicBlock *merge_BB =
-        BasicBlock::Create(*context, parent_func_name + "_after_loop", func);
+        BasicBlock::Create(*context, func_name + "_after_loop", func);
 
     // Gen end (condition)
     builder->CreateBr(check_BB);
@@ -529,10 +533,10 @@ void Codegen::forGen(std::string& parent_func_name, Statement *_statement)
     
     // Gen body
     builder->SetInsertPoint(body_BB);
-    auto block = for_s->getBlock();
+    auto &block = for_s->getBlock();
     for (auto code : block)
     {
-        statementGen(parent_func_name, code.get());
+        statementGen(parent_func_name, code);
     }
 
     // Gen step
@@ -542,29 +546,25 @@ void Codegen::forGen(std::string& parent_func_name, Statement *_statement)
     // Loop end
     builder->SetInsertPoint(merge_BB);
 
-    local_vars_ref.pop_back();
-    local_vars_tracker.pop_back();
+    local_vars.exitScope();
 }
 
-void Codegen::whileGen(std::string& parent_func_name, Statement *_statement)
+void Codegen::whileGen(SymbolId parent_func_name, WhileStatement *while_s)
 {
-    WhileStatement *while_s = 
-        static_cast<WhileStatement*>(_statement);
-
-    local_vars_ref.push_back(while_s->getWhileBlockVars());
-    local_vars_tracker.emplace_back();
+    local_vars.enterScope();
 
     // Build basic blocks for paths
     Function *func = builder->GetInsertBlock()->getParent();
+    std::string func_name(Interner::global().getName(parent_func_name));
 
     BasicBlock *check_BB =
-        BasicBlock::Create(*context, parent_func_name + "_loop_header", func);
+        BasicBlock::Create(*context, func_name + "_loop_header", func);
 
     BasicBlock *body_BB =
-        BasicBlock::Create(*context, parent_func_name + "_loop_body", func);
+        BasicBlock::Create(*context, func_name + "_loop_body", func);
 
     BasicBlock *merge_BB =
-        BasicBlock::Create(*context, parent_func_name + "_after_loop", func);
+        BasicBlock::Create(*context, func_name + "_after_loop", func);
 
     builder->CreateBr(check_BB);
     builder->SetInsertPoint(check_BB);
@@ -575,76 +575,53 @@ void Codegen::whileGen(std::string& parent_func_name, Statement *_statement)
 
     // Gen body
     builder->SetInsertPoint(body_BB);
-    auto block = while_s->getWhileBlock();
+    auto &block = while_s->getWhileBlock();
     for (auto code : block)
     {
-        statementGen(parent_func_name, code.get());
+        statementGen(parent_func_name, code);
     }
 
     builder->CreateBr(check_BB);
     builder->SetInsertPoint(merge_BB);
 
-    local_vars_ref.pop_back();
-    local_vars_tracker.pop_back();
+    local_vars.exitScope();
 }
 
-Value* Codegen::exprGen(ValueType::Type _var_type, Expression *expr)
+Value* Codegen::exprGen(Expression *expr)
 {
-    ValueType::Type var_type = _var_type;
-    if (_var_type == ValueType::Type::INT_ARRAY)
-        var_type = ValueType::Type::INT;
-    else if (_var_type == ValueType::Type::FLOAT_ARRAY)
-        var_type = ValueType::Type::FLOAT;
-
-    Value *val = nullptr;
-    if (expr->isExprLiteral())
-    {
-        LiteralExpression* lit = static_cast<LiteralExpression*>(expr);
-
-        val = literalExprGen(var_type, lit);
-    }
-    else if (expr->isExprArith())
-    {
-        ArithExpression *arith = static_cast<ArithExpression *>(expr);
-
-        val = arithExprGen(var_type, arith);        
-    }
-    else if (expr->isExprIndex())
-    {
-        IndexExpression *index = static_cast<IndexExpression*>(expr);
-
-        val = indexExprGen(var_type, index);
-    }
-    else if (expr->isExprCall())
-    {
-        CallExpression *call = static_cast<CallExpression*>(expr);
-
-        val = callExprGen(call);
-    }
+    Value *val = visit(*expr, Overloaded {
+        [&](LiteralExpression &lit) { return literalExprGen(&lit); },
+        [&](ArithExpression &arith) { return arithExprGen(&arith); },
+        [&](IndexExpression &index) { return indexExprGen(&index); },
+        [&](CallExpression &call) { return callExprGen(&call); },
+        // arrays only appear as initializers, see arrayExprGen
+        [&](ArrayExpression &) -> Value* { return nullptr; },
+        [&](ConstArrayExpression &) -> Value* { return nullptr; }
+    });
 
     assert(val != nullptr);
     return val;
 }
 
-Value* Codegen::literalExprGen(ValueType::Type type, 
-                               LiteralExpression* lit)
+Value* Codegen::literalExprGen(LiteralExpression* lit)
 {
+    auto type = lit->getValType();
     Value *val;
-    auto [is_allocated, reg_val] = getReg(lit->getLiteral());
+    auto [is_allocated, reg_val] = lit->isLiteralIden() ?
+        getReg(lit->getSym()) : std::make_pair(false, nullptr);
 
     if (!is_allocated)
     {
         assert((lit->isLiteralInt() || 
                 lit->isLiteralFloat()));
 
-        auto val_str = lit->getLiteral();
-        if (lit->isLiteralInt())
+        if (type == ValueType::Type::INT)
         {
-            val = ConstantInt::get(*context, APInt(32, stoi(val_str)));
+            val = ConstantInt::get(*context, APInt(32, lit->getIntVal()));
         }
-        else if (lit->isLiteralFloat())
+        else if (type == ValueType::Type::FLOAT)
         {
-            val = ConstantFP::get(*context, APFloat(stof(val_str)));
+            val = ConstantFP::get(*context, APFloat(lit->getFloatVal()));
         }
     }
     else
@@ -666,19 +643,9 @@ Value* Codegen::literalExprGen(ValueType::Type type,
     return val;
 }
 
-void Codegen::arrayExprGen(ValueType::Type array_type,
-                           Value *reg,
+void Codegen::arrayExprGen(Value *reg,
                            ArrayExpression* array_info)
 {
-    // Determine element type
-    ValueType::Type type;
-    if (array_type == ValueType::Type::INT_ARRAY)
-        type = ValueType::Type::INT;
-    else if (array_type == ValueType::Type::FLOAT_ARRAY)
-        type = ValueType::Type::FLOAT;
-    else
-        assert(false);
-
     // Get the 0th array element
     // This actually took me a long time to figure out, looks like
     // the first index will get you the pointer, then the second
@@ -693,7 +660,7 @@ void Codegen::arrayExprGen(ValueType::Type array_type,
     auto const_one = ConstantInt::get(*context, APInt(32, 1));
     for (auto ele : array_info->getElements())
     {
-        Value *val = exprGen(type, ele.get());
+        Value *val = exprGen(ele);
         builder->CreateStore(val, base);
         if (++cnt <= last_ele_idx)
         {
@@ -703,59 +670,77 @@ void Codegen::arrayExprGen(ValueType::Type array_type,
     }
 }
 
-Value* Codegen::arithExprGen(ValueType::Type type, 
-                             ArithExpression* arith)
+void Codegen::constArrayExprGen(Value *reg, ConstArrayExpression *array)
 {
+    Constant *init;
+    if (array->isIntArray())
+    {
+        auto &eles = array->getIntElements();
+        init = ConstantDataArray::get(*context,
+            ArrayRef<uint32_t>(reinterpret_cast<const uint32_t*>(eles.data()),
+                               eles.size()));
+    }
+    else
+    {
+        auto &eles = array->getFloatElements();
+        init = ConstantDataArray::get(*context,
+            ArrayRef<float>(eles.data(), eles.size()));
+    }
+    constInitGen(reg, init, array->size());
+}
+
+void Codegen::constInitGen(Value *reg, Constant *init, size_t num_eles)
+{
+    // The initializer is a private constant copied in with one memcpy,
+    // instead of a store per element
+    auto global = new GlobalVariable(*module, init->getType(), true,
+                                     GlobalValue::PrivateLinkage, init);
+    global->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    global->setAlignment(MaybeAlign(4));
+
+    // int32 and float elements are 4 bytes
+    builder->CreateMemCpy(reg, MaybeAlign(4), global, MaybeAlign(4),
+                          num_eles * 4);
+}
+
+Value* Codegen::arithExprGen(ArithExpression* arith)
+{
+    auto type = arith->getValType();
+
     Value *val_left = nullptr;
     Value *val_right = nullptr;
 
-    // Recursively generate the left arith expr
-    if (arith->getLeft() != nullptr)
+    Expression *left_expr = arith->getLeft();
+    Expression *right_expr = arith->getRight();
+
+    // Recursively generate the arith operands first
+    if (left_expr->isExprArith())
     {
-        Expression *next_expr = arith->getLeft();
-        if (next_expr->isExprArith())
-        {
-            ArithExpression* next_arith = 
-                static_cast<ArithExpression*>(next_expr);
-            val_left = arithExprGen(type, 
-                                    next_arith);
-        }
+        val_left = exprGen(left_expr);
     }
 
-    // Recursively generate the right arith expr
-    if (arith->getRight() != nullptr)
+    if (right_expr->isExprArith())
     {
-        Expression *next_expr = arith->getRight();
-        if (next_expr->isExprArith())
-        {
-            ArithExpression* next_arith = 
-                static_cast<ArithExpression*>(next_expr);
-            val_right = arithExprGen(type,
-                                     next_arith);
-        }
+        val_right = exprGen(right_expr);
     }
 
+    // Then literals, calls and indexing
     if (val_left == nullptr)
     {
-        Expression *left_expr = arith->getLeft();
-
         assert((left_expr->isExprLiteral() || 
                 left_expr->isExprCall() || 
                 left_expr->isExprIndex()));
 
-        val_left = exprGen(type, left_expr);
+        val_left = exprGen(left_expr);
     }
 
     if (val_right == nullptr)
     {
-        Expression *right_expr = arith->getRight();
-
-        // The right_expr must either be literal or call
-	assert((right_expr->isExprLiteral() || 
+        assert((right_expr->isExprLiteral() || 
                 right_expr->isExprCall() ||
                 right_expr->isExprIndex()));
 
-        val_right = exprGen(type, right_expr);
+        val_right = exprGen(right_expr);
     }
 
     assert(val_left != nullptr);
@@ -789,13 +774,13 @@ Value* Codegen::arithExprGen(ValueType::Type type,
     }
 }
 
-Value* Codegen::indexExprGen(ValueType::Type type, 
-                             IndexExpression* index)
+Value* Codegen::indexExprGen(IndexExpression* index)
 {
-    auto [is_allocated, reg_val] = getReg(index->getIden());
+    auto type = index->getValType();
+    auto [is_allocated, reg_val] = getReg(index->getIdenSym());
     assert(is_allocated);
 
-    Value *idx = exprGen(ValueType::Type::INT, index->getIndex());
+    Value *idx = exprGen(index->getIndex());
 
     std::vector<Value*> idxs;
     idxs.push_back(ConstantInt::get(*context, APInt(32, 0)));
@@ -813,7 +798,7 @@ Value* Codegen::indexExprGen(ValueType::Type type,
 
 Value* Codegen::callExprGen(CallExpression *call)
 {
-    auto &def = call->getCallFunc();
+    auto def = call->getCallFunc();
     Function *call_func = module->getFunction(def);
     if (!call_func)
     {
@@ -821,17 +806,15 @@ Value* Codegen::callExprGen(CallExpression *call)
         exit(0);
     }
 
-    auto args = call->getArgs();
-    auto arg_types = parser->getFuncArgTypes(def);
+    auto &args = call->getArgs();
     assert(args.size() == call_func->arg_size());
-    assert(arg_types.size() == call_func->arg_size());
 
     std::vector<Value*> call_func_args;
     for (auto i = 0; i < call_func->arg_size(); i++)
     {
-        auto expr = args[i].get();
+        auto expr = args[i];
 
-        Value *val = exprGen(arg_types[i], expr);
+        Value *val = exprGen(expr);
         call_func_args.push_back(val);
     }
 
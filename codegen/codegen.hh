@@ -1,6 +1,7 @@
 #ifndef __CODEGEN_HH__
 #define __CODEGEN_HH__
 
+#include "parser/flat_ast.hh"
 #include "parser/parser.hh"
 
 // LLVM IR codegen libraries
@@ -74,6 +75,9 @@ class Codegen
 
     size_t num_loops_per_func = 0;
 
+    // Walk the FlatAST instead of the pointer tree
+    bool use_flat = false;
+
   public:
 
     Codegen(const char* _mod_name,
@@ -87,85 +91,104 @@ class Codegen
         parser = _parser;
     }
 
+    void setFlat(bool _use_flat)
+    {
+        use_flat = _use_flat;
+    }
+
     void gen();
 
     void print();
 
   protected:
-    std::vector<std::unordered_map<std::string,
-                                   ValueType::Type>*> local_vars_ref;
-    std::vector<std::unordered_map<std::string,Value*>> local_vars_tracker;
-
-    void recordLocalVar(std::string& var_name, Value* reg)
+    // Type and register of every variable allocated so far, scoped
+    // like the Parser's table
+    struct LocalVar
     {
-        auto &tracker = local_vars_tracker.back();
-        tracker.insert({var_name, reg});
-    }
-
-    ValueType::Type getValType(std::string& _var_name)
+        ValueType::Type type;
+        Value *reg;
+    };
+    ScopedSymbolTable<LocalVar> local_vars;
+
+    void recordLocalVar(SymbolId var_name,
+                        ValueType::Type var_type,
+                        Value* reg)
     {
-        for (int i = local_vars_ref.size() - 1;
-                 i >= 0;
-                 i--)
-        {
-            auto &ref = local_vars_ref[i];
-
-            if (auto iter = ref->find(_var_name);
-                    iter != ref->end())
-            {
-                return iter->second;
-            }
-        }
+        local_vars.bind(var_name, {var_type, reg});
     }
     
-    std::pair<bool,Value*> getReg(std::string& _var_name)
+    std::pair<bool,Value*> getReg(SymbolId _var_name)
     {
-        for (int i = local_vars_tracker.size() - 1;
-                 i >= 0;
-                 i--)
+        if (auto var = local_vars.lookup(_var_name); var != nullptr)
         {
-            auto &tracker = local_vars_tracker[i];
-
-            if (auto iter = tracker.find(_var_name);
-                    iter != tracker.end())
-            {
-                return std::make_pair(true,iter->second);
-            }
+            return std::make_pair(true,var->reg);
         }
         return std::make_pair(false,nullptr);
     }
 
-    void statementGen(std::string&, Statement*);
-
-    void funcGen(Statement *);
-    void assnGen(Statement *);
-    void builtinGen(Statement *);
-    void callGen(Statement *);
-    void retGen(std::string &,Statement *);
+    void statementGen(SymbolId, Statement*);
+
+    void funcGen(FuncStatement *);
+    // Shared by both walks: declares the function, opens its entry
+    // block and stores the (symbol, type) arguments to allocas in a new
+    // scope. funcEndGen closes it again.
+    Function* funcBeginGen(
+        std::string_view,
+        ValueType::Type,
+        const std::vector<std::pair<SymbolId, ValueType::Type>>&);
+    void funcEndGen(Function*, ValueType::Type);
+    void assnGen(AssnStatement *);
+    void builtinGen(CallStatement *);
+    void callGen(CallStatement *);
+    void retGen(RetStatement *);
 
     Value* condGen(Condition*);
-    void ifGen(std::string&,Statement *);
-    void forGen(std::string&,Statement *);
-    void whileGen(std::string&,Statement *);
+    void ifGen(SymbolId,IfStatement *);
+    void forGen(SymbolId,ForStatement *);
+    void whileGen(SymbolId,WhileStatement *);
 
-    Value* allocaForIden(std::string&,
+    Value* allocaForIden(SymbolId&,
                          ValueType::Type&,
                          Expression*,
-                         ArrayExpression*);
+                         Expression*);
    
-    Value* exprGen(ValueType::Type,Expression*);
+    // Every expression is evaluated as the type the Parser annotated it
+    // with (see Expression::getValType)
+    Value* exprGen(Expression*);
 
-    void arrayExprGen(ValueType::Type,
-                      Value*,
-                      ArrayExpression*);
+    void arrayExprGen(Value*, ArrayExpression*);
+    // All-constant initializer, one memcpy from a private constant
+    void constArrayExprGen(Value*, ConstArrayExpression*);
+    void constInitGen(Value*, Constant*, size_t);
 
-    Value* arithExprGen(ValueType::Type,ArithExpression*);
+    Value* arithExprGen(ArithExpression*);
 
-    Value* literalExprGen(ValueType::Type, LiteralExpression*);
+    Value* literalExprGen(LiteralExpression*);
 
-    Value* indexExprGen(ValueType::Type, IndexExpression*);
+    Value* indexExprGen(IndexExpression*);
 
     Value* callExprGen(CallExpression*);
+
+    /*
+     * FlatAST walk (see parser/flat_ast.hh)
+     *
+     * Emits exactly the IR of the pointer walk above. Types are
+     * resolved during lowering, so only the registers are tracked here.
+     * */
+    FlatAST flat;
+    // Value of every expression node, indexed like the FlatAST exprs
+    std::vector<Value*> flat_vals;
+
+    void flatFuncGen(FlatAST::Func&);
+    void flatBlockGen(SymbolId, uint32_t);
+    void flatStatementGen(SymbolId, FlatAST::Stmt&);
+    void flatAssnGen(FlatAST::Stmt&);
+    void flatBuiltinGen(FlatAST::Stmt&);
+    Value* flatCondGen(FlatAST::Cond&);
+    void flatIfGen(SymbolId, FlatAST::Stmt&);
+    void flatForGen(SymbolId, FlatAST::Stmt&);
+    void flatWhileGen(SymbolId, FlatAST::Stmt&);
+    Value* flatRunGen(uint32_t);
 };
 }
 
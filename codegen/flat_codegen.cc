@@ -0,0 +1,459 @@
+#include "codegen/codegen.hh"
+
+namespace Frontend
+{
+void Codegen::flatFuncGen(FlatAST::Func &func)
+{
+    std::vector<std::pair<SymbolId, ValueType::Type>> args;
+    for (uint32_t i = 0; i < func.num_args; i++)
+    {
+        auto &arg = flat.getArg(func.first_arg + i);
+        args.emplace_back(arg.sym, arg.getType());
+    }
+
+    Function *ir_gen_func = funcBeginGen(Interner::global().getName(func.sym),
+                                         func.getRetType(),
+                                         args);
+
+    // (2) Rest of the codes
+    flatBlockGen(func.sym, func.block);
+
+    funcEndGen(ir_gen_func, func.getRetType());
+}
+
+void Codegen::flatBlockGen(SymbolId func_name, uint32_t block_idx)
+{
+    auto block = flat.getBlock(block_idx);
+    for (uint32_t i = block.first; i < block.first + block.count; i++)
+    {
+        flatStatementGen(func_name, flat.getStmt(i));
+    }
+}
+
+void Codegen::flatStatementGen(SymbolId func_name, FlatAST::Stmt &stmt)
+{
+    switch (stmt.kind)
+    {
+        case FlatAST::Stmt::Kind::ASSN:
+        case FlatAST::Stmt::Kind::ASSN_ARRAY:
+        case FlatAST::Stmt::Kind::ASSN_CONST_ARRAY:
+            flatAssnGen(stmt);
+            break;
+        case FlatAST::Stmt::Kind::BUILT_IN_CALL:
+            flatBuiltinGen(stmt);
+            break;
+        case FlatAST::Stmt::Kind::CALL:
+            flatRunGen(stmt.a);
+            break;
+        case FlatAST::Stmt::Kind::RET:
+            builder->CreateRet(flatRunGen(stmt.a));
+            break;
+        case FlatAST::Stmt::Kind::IF:
+            flatIfGen(func_name, stmt);
+            break;
+        case FlatAST::Stmt::Kind::FOR:
+            flatForGen(func_name, stmt);
+            break;
+        case FlatAST::Stmt::Kind::WHILE:
+            flatWhileGen(func_name, stmt);
+            break;
+    }
+}
+
+void Codegen::flatAssnGen(FlatAST::Stmt &stmt)
+{
+    auto var_type = stmt.getType();
+
+    Value *reg;
+    if (auto [is_allocated, reg_base] = getReg(stmt.sym);
+            !is_allocated)
+    {
+        // Allocating new variables, must be a plain variable
+        assert(stmt.kind != FlatAST::Stmt::Kind::ASSN ||
+               stmt.a == FlatAST::NONE);
+
+        if (var_type == ValueType::Type::INT)
+        {
+            reg = builder->CreateAlloca(Type::getInt32Ty(*context));
+        }
+        else if (var_type == ValueType::Type::FLOAT)
+        {
+            reg = builder->CreateAlloca(Type::getFloatTy(*context));
+        }
+        else if (var_type == ValueType::Type::INT_ARRAY ||
+                 var_type == ValueType::Type::FLOAT_ARRAY)
+        {
+            assert(stmt.kind != FlatAST::Stmt::Kind::ASSN);
+
+            Type *ele_type = (var_type == ValueType::Type::INT_ARRAY) ?
+                             Type::getInt32Ty(*context) :
+                             Type::getFloatTy(*context);
+
+            ArrayType* array_type = ArrayType::get(ele_type, stmt.a);
+
+            reg = builder->CreateAlloca(array_type);
+        }
+        else
+        {
+            std::cerr << "[Error] unsupported allocation type for "
+                      << Interner::global().getName(stmt.sym) << "\n";
+            exit(0);
+        }
+
+        recordLocalVar(stmt.sym, var_type, reg);
+    }
+    else if (stmt.kind == FlatAST::Stmt::Kind::ASSN &&
+             stmt.a != FlatAST::NONE)
+    {
+        Value *idx = flatRunGen(stmt.a);
+        std::vector<Value*> idxs;
+        idxs.push_back(ConstantInt::get(*context, APInt(32, 0)));
+        idxs.push_back(idx);
+        reg = builder->CreateInBoundsGEP(reg_base, idxs);
+    }
+    else
+    {
+        reg = reg_base;
+    }
+
+    if (stmt.kind == FlatAST::Stmt::Kind::ASSN)
+    {
+        Value *val = flatRunGen(stmt.b);
+        builder->CreateStore(val, reg);
+        return;
+    }
+
+    if (stmt.kind == FlatAST::Stmt::Kind::ASSN_CONST_ARRAY)
+    {
+        Constant *init;
+        if (var_type == ValueType::Type::INT_ARRAY)
+        {
+            auto eles = flat.getIntConsts(stmt.b);
+            init = ConstantDataArray::get(*context,
+                ArrayRef<uint32_t>(reinterpret_cast<const uint32_t*>(eles),
+                                   stmt.c));
+        }
+        else
+        {
+            init = ConstantDataArray::get(*context,
+                ArrayRef<float>(flat.getFloatConsts(stmt.b), stmt.c));
+        }
+        constInitGen(reg, init, stmt.c);
+        return;
+    }
+
+    // Array initializer, stored element by element from the 0th one
+    std::vector<Value *> index;
+    index.push_back(ConstantInt::get(*context, APInt(32, 0)));
+    index.push_back(ConstantInt::get(*context, APInt(32, 0)));
+    auto base = builder->CreateInBoundsGEP(reg, index);
+
+    auto const_one = ConstantInt::get(*context, APInt(32, 1));
+    for (uint32_t i = 0; i < stmt.c; i++)
+    {
+        Value *val = flatRunGen(flat.getListItem(stmt.b + i));
+        builder->CreateStore(val, base);
+        if (i + 1 < stmt.c)
+        {
+            base = builder->CreateInBoundsGEP(base, const_one);
+        }
+    }
+}
+
+void Codegen::flatBuiltinGen(FlatAST::Stmt &stmt)
+{
+    static FunctionCallee printVarInt =
+        module->getOrInsertFunction("printVarInt",
+            Type::getVoidTy(*context),
+            Type::getInt32Ty(*context));
+
+    static FunctionCallee printVarFloat =
+        module->getOrInsertFunction("printVarFloat",
+            Type::getVoidTy(*context),
+            Type::getFloatTy(*context));
+
+    auto func_name = Interner::global().getName(stmt.sym);
+
+    Value *val = flatRunGen(stmt.a);
+
+    if (func_name == "printVarInt")
+    {
+        builder->CreateCall(printVarInt, val);
+    }
+    else if (func_name == "printVarFloat")
+    {
+        builder->CreateCall(printVarFloat, val);
+    }
+}
+
+Value* Codegen::flatCondGen(FlatAST::Cond &cond)
+{
+    auto var_type = cond.getType();
+
+    Value *left = flatRunGen(cond.left);
+    Value *right = flatRunGen(cond.right);
+
+    bool is_int = (var_type == ValueType::Type::INT);
+    bool is_float = (var_type == ValueType::Type::FLOAT);
+
+    Value* eval = nullptr;
+    switch (cond.opr)
+    {
+        case FlatAST::Cond::Opr::EQ:
+            if (is_int) eval = builder->CreateICmpEQ(left, right);
+            else if (is_float) eval = builder->CreateFCmpOEQ(left, right);
+            break;
+        case FlatAST::Cond::Opr::NE:
+            if (is_int) eval = builder->CreateICmpNE(left, right);
+            else if (is_float) eval = builder->CreateFCmpONE(left, right);
+            break;
+        case FlatAST::Cond::Opr::GT:
+            if (is_int) eval = builder->CreateICmpSGT(left, right);
+            else if (is_float) eval = builder->CreateFCmpOGT(left, right);
+            break;
+        case FlatAST::Cond::Opr::GE:
+            if (is_int) eval = builder->CreateICmpSGE(left, right);
+            else if (is_float) eval = builder->CreateFCmpOGE(left, right);
+            break;
+        // "<=" is lowered like "<", as condGen does
+        case FlatAST::Cond::Opr::LT:
+        case FlatAST::Cond::Opr::LE:
+            if (is_int) eval = builder->CreateICmpSLT(left, right);
+            else if (is_float) eval = builder->CreateFCmpOLT(left, right);
+            break;
+    }
+
+    assert(eval != nullptr);
+    return eval;
+}
+
+void Codegen::flatIfGen(SymbolId parent_func_name, FlatAST::Stmt &stmt)
+{
+    auto cond = flatCondGen(flat.getCond(stmt.a));
+
+    Function *func = builder->GetInsertBlock()->getParent();
+    BasicBlock *taken_BB =
+        BasicBlock::Create(*context, "", func);
+
+    BasicBlock *not_taken_BB = (stmt.c != FlatAST::NONE) ?
+                               BasicBlock::Create(*context, "", func) :
+                               nullptr;
+
+    BasicBlock *merge_BB = BasicBlock::Create(*context, "", func);
+
+    if (not_taken_BB != nullptr)
+    {
+        builder->CreateCondBr(cond, taken_BB, not_taken_BB);
+    }
+    else
+    {
+        builder->CreateCondBr(cond, taken_BB, merge_BB);
+    }
+
+    // Build the taken path
+    builder->SetInsertPoint(taken_BB);
+    local_vars.enterScope();
+    flatBlockGen(parent_func_name, stmt.b);
+    builder->CreateBr(merge_BB);
+    local_vars.exitScope();
+
+    // Build the not
+    if (not_taken_BB != nullptr)
+    {
+        builder->SetInsertPoint(not_taken_BB);
+        local_vars.enterScope();
+        flatBlockGen(parent_func_name, stmt.c);
+        builder->CreateBr(merge_BB);
+        local_vars.exitScope();
+    }
+
+    builder->SetInsertPoint(merge_BB);
+}
+
+void Codegen::flatForGen(SymbolId parent_func_name, FlatAST::Stmt &stmt)
+{
+    local_vars.enterScope();
+
+    // Gen start
+    flatAssnGen(flat.getStmt(stmt.a));
+
+    Function *func = builder->GetInsertBlock()->getParent();
+    std::string func_name(Interner::global().getName(parent_func_name));
+
+    BasicBlock *check_BB =
+        BasicBlock::Create(*context, func_name + "_loop_header", func);
+
+    BasicBlock *body_BB =
+        BasicBlock::Create(*context, func_name + "_loop_body", func);
+
+    BasicBlock *merge_BB =
+        BasicBlock::Create(*context, func_name + "_after_loop", func);
+
+    // Gen end (condition)
+    builder->CreateBr(check_BB);
+    builder->SetInsertPoint(check_BB);
+
+    auto end_cond = flatCondGen(flat.getCond(stmt.b));
+    builder->CreateCondBr(end_cond, body_BB, merge_BB);
+
+    // Gen body
+    builder->SetInsertPoint(body_BB);
+    flatBlockGen(parent_func_name, stmt.d);
+
+    // Gen step
+    flatAssnGen(flat.getStmt(stmt.c));
+    builder->CreateBr(check_BB);
+
+    // Loop end
+    builder->SetInsertPoint(merge_BB);
+
+    local_vars.exitScope();
+}
+
+void Codegen::flatWhileGen(SymbolId parent_func_name, FlatAST::Stmt &stmt)
+{
+    local_vars.enterScope();
+
+    Function *func = builder->GetInsertBlock()->getParent();
+    std::string func_name(Interner::global().getName(parent_func_name));
+
+    BasicBlock *check_BB =
+        BasicBlock::Create(*context, func_name + "_loop_header", func);
+
+    BasicBlock *body_BB =
+        BasicBlock::Create(*context, func_name + "_loop_body", func);
+
+    BasicBlock *merge_BB =
+        BasicBlock::Create(*context, func_name + "_after_loop", func);
+
+    builder->CreateBr(check_BB);
+    builder->SetInsertPoint(check_BB);
+
+    // Gen while condition
+    auto cond = flatCondGen(flat.getCond(stmt.a));
+    builder->CreateCondBr(cond, body_BB, merge_BB);
+
+    // Gen body
+    builder->SetInsertPoint(body_BB);
+    flatBlockGen(parent_func_name, stmt.b);
+
+    builder->CreateBr(check_BB);
+    builder->SetInsertPoint(merge_BB);
+
+    local_vars.exitScope();
+}
+
+// One pass over the run, every operand is already in flat_vals
+Value* Codegen::flatRunGen(uint32_t run_idx)
+{
+    auto run = flat.getRun(run_idx);
+
+    for (uint32_t i = run.first; i <= run.root; i++)
+    {
+        auto &node = flat.getExpr(i);
+        auto type = node.getType();
+        bool is_int = (type == ValueType::Type::INT);
+        bool is_float = (type == ValueType::Type::FLOAT);
+
+        Value *val = nullptr;
+        switch (node.kind)
+        {
+            case FlatAST::Expr::Kind::INT:
+                val = ConstantInt::get(*context, APInt(32, node.int_val));
+                break;
+            case FlatAST::Expr::Kind::FLOAT:
+                val = ConstantFP::get(*context, APFloat(node.float_val));
+                break;
+            case FlatAST::Expr::Kind::VAR:
+            {
+                auto [is_allocated, reg_val] = getReg(node.sym);
+                assert(is_allocated);
+
+                if (is_int)
+                    val = builder->CreateLoad(Type::getInt32Ty(*context),
+                                              reg_val);
+                else if (is_float)
+                    val = builder->CreateLoad(Type::getFloatTy(*context),
+                                              reg_val);
+                break;
+            }
+            case FlatAST::Expr::Kind::INDEX:
+            {
+                auto [is_allocated, reg_val] = getReg(node.sym);
+                assert(is_allocated);
+
+                std::vector<Value*> idxs;
+                idxs.push_back(ConstantInt::get(*context, APInt(32, 0)));
+                idxs.push_back(flat_vals[node.lhs]);
+                auto base = builder->CreateInBoundsGEP(reg_val, idxs);
+
+                if (is_int)
+                    val = builder->CreateLoad(Type::getInt32Ty(*context),
+                                              base);
+                else if (is_float)
+                    val = builder->CreateLoad(Type::getFloatTy(*context),
+                                              base);
+                break;
+            }
+            case FlatAST::Expr::Kind::CALL:
+            {
+                auto def = Interner::global().getName(node.sym);
+                Function *call_func = module->getFunction(def);
+                if (!call_func)
+                {
+                    std::cerr << "[Error] Please define function before CALL\n";
+                    exit(0);
+                }
+                assert(node.rhs == call_func->arg_size());
+
+                std::vector<Value*> call_func_args;
+                for (uint32_t arg = 0; arg < node.rhs; arg++)
+                {
+                    auto arg_root = flat.getListItem(node.lhs + arg);
+                    call_func_args.push_back(flat_vals[arg_root]);
+                }
+
+                val = builder->CreateCall(call_func, call_func_args);
+                break;
+            }
+            case FlatAST::Expr::Kind::ADD:
+                if (is_int)
+                    val = builder->CreateAdd(flat_vals[node.lhs],
+                                             flat_vals[node.rhs]);
+                else if (is_float)
+                    val = builder->CreateFAdd(flat_vals[node.lhs],
+                                              flat_vals[node.rhs]);
+                break;
+            case FlatAST::Expr::Kind::SUB:
+                if (is_int)
+                    val = builder->CreateSub(flat_vals[node.lhs],
+                                             flat_vals[node.rhs]);
+                else if (is_float)
+                    val = builder->CreateFSub(flat_vals[node.lhs],
+                                              flat_vals[node.rhs]);
+                break;
+            case FlatAST::Expr::Kind::MUL:
+                if (is_int)
+                    val = builder->CreateMul(flat_vals[node.lhs],
+                                             flat_vals[node.rhs]);
+                else if (is_float)
+                    val = builder->CreateFMul(flat_vals[node.lhs],
+                                              flat_vals[node.rhs]);
+                break;
+            case FlatAST::Expr::Kind::DIV:
+                if (is_int)
+                    val = builder->CreateSDiv(flat_vals[node.lhs],
+                                              flat_vals[node.rhs]);
+                else if (is_float)
+                    val = builder->CreateFDiv(flat_vals[node.lhs],
+                                              flat_vals[node.rhs]);
+                break;
+        }
+
+        assert(val != nullptr);
+        flat_vals[i] = val;
+    }
+
+    return flat_vals[run.root];
+}
+}
@@ -1,6 +1,8 @@
 #include "parser/parser.hh"
 #include "codegen/codegen.hh"
 
+#include <algorithm>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
 
@@ -8,12 +10,75 @@ using namespace Frontend;
 
 int main(int argc, char* argv[])
 {
-    // Parser
-    Parser parser(argv[1]);
+    // codegen [--flat] [--threads N] [--ast-cache <cache>] [--no-fold]
+    //         [--stream] [--pipeline] <file> <out.bc>
+    int arg = 1;
+    bool use_flat = false;
+    unsigned threads = 1;
+    const char *ast_cache = nullptr;
+    bool fold_constants = true;
+    bool stream = false;
+    bool pipeline = false;
+    while (arg + 2 < argc)
+    {
+        std::string_view opt(argv[arg]);
+        if (opt == "--flat")
+        {
+            use_flat = true;
+            arg++;
+        }
+        else if (opt == "--threads" && arg + 3 < argc)
+        {
+            threads = std::max(1, atoi(argv[arg + 1]));
+            arg += 2;
+        }
+        else if (opt == "--ast-cache" && arg + 3 < argc)
+        {
+            ast_cache = argv[arg + 1];
+            arg += 2;
+        }
+        else if (opt == "--no-fold")
+        {
+            fold_constants = false;
+            arg++;
+        }
+        else if (opt == "--stream")
+        {
+            stream = true;
+            arg++;
+        }
+        else if (opt == "--pipeline")
+        {
+            pipeline = true;
+            arg++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // Parser, in streaming mode it only opens the input and the functions
+    // are parsed as Codegen asks for them. Pipelined, they are lexed and
+    // parsed on threads of their own, ahead of Codegen. The flat walk,
+    // the threads and the cache need the whole Program.
+    if ((stream || pipeline) &&
+        (use_flat || threads > 1 || ast_cache != nullptr))
+    {
+        std::cerr << "[Error] --stream and --pipeline do not go with "
+                  << "--flat, --threads or --ast-cache\n";
+        return 1;
+    }
+    std::unique_ptr<Parser> parser_ptr(
+        pipeline ? new Parser(Parser::Pipeline(), argv[arg], fold_constants) :
+        stream ? new Parser(Parser::Stream(), argv[arg], fold_constants) :
+        new Parser(argv[arg], threads, threads, ast_cache, fold_constants));
+    auto &parser = *parser_ptr;
 
     // LLVM IR generation
-    Codegen codegen(argv[1], argv[2]);
+    Codegen codegen(argv[arg], argv[arg + 1]);
     codegen.setParser(&parser);
+    codegen.setFlat(use_flat);
     codegen.gen();
     codegen.print();
 }
@@ -0,0 +1,65 @@
+#ifndef __DIAGNOSTIC_HH__
+#define __DIAGNOSTIC_HH__
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace Frontend
+{
+/*
+ * Diagnostic - an error that ends the compile
+ *
+ * The text goes to stderr and the process exits with 0. Only the thread
+ * that drives the compile may exit like that: exit() runs the static
+ * destructors (the Interner, the built-in pool, ...) under any other
+ * thread still at work. Worker and stage threads therefore run inside a
+ * Deferred scope, where fail() throws the Diagnostic instead. Whoever
+ * started them catches it, stops the other threads and report()s it
+ * on its own thread.
+ * */
+struct Diagnostic
+{
+    std::string text;
+
+    // fail() throws on this thread while one is alive
+    class Deferred
+    {
+      protected:
+        bool outer;
+
+      public:
+        Deferred() : outer(deferred()) { deferred() = true; }
+        ~Deferred() { deferred() = outer; }
+
+        Deferred(const Deferred&) = delete;
+        Deferred& operator=(const Deferred&) = delete;
+    };
+
+    static bool &deferred()
+    {
+        thread_local bool on = false;
+        return on;
+    }
+
+    // The arguments are streamed into the text, as into std::cerr
+    template<typename... Args>
+    [[noreturn]] static void fail(Args&&... args)
+    {
+        std::ostringstream text;
+        (text << ... << args);
+        report(Diagnostic{text.str()});
+    }
+
+    [[noreturn]] static void report(Diagnostic diag)
+    {
+        if (deferred()) throw diag;
+
+        std::cerr << diag.text << std::flush;
+        exit(0);
+    }
+};
+}
+
+#endif
@@ -0,0 +1,10 @@
+#include "lexer/intern.hh"
+
+namespace Frontend
+{
+Interner& Interner::global()
+{
+    static Interner interner;
+    return interner;
+}
+}
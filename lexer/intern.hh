@@ -0,0 +1,82 @@
+#ifndef __INTERN_HH__
+#define __INTERN_HH__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Frontend
+{
+// Dense id of an interned identifier
+using SymbolId = uint32_t;
+
+/*
+ * Interner - maps each distinct identifier to a dense SymbolId
+ *
+ * The Lexer interns every identifier as it is made, so the parser and
+ * codegen symbol tables can be keyed (or indexed) by integer instead
+ * of by string. Ids are handed out in order of first appearance,
+ * starting at 0, and are stable for the life of the program.
+ *
+ * The interner keeps its own copy of every name, so names outlive the
+ * Source they came from. Only one thread may intern at a time: the
+ * parallel lexer interns into one Interner per chunk and merges them in
+ * order. Other threads may look up the names of ids handed to them
+ * while it does, e.g., codegen while the lexing stage of a pipeline
+ * (see Lexer::Pipeline) goes on.
+ * */
+class Interner
+{
+  protected:
+    // Names live in blocks that never move or grow, block k holds
+    // FIRST_BLOCK << k of them. A name is found without touching
+    // anything intern() changes, and the views in ids stay valid.
+    static constexpr unsigned FIRST_BLOCK_BITS = 6;
+    static constexpr uint64_t FIRST_BLOCK = 1u << FIRST_BLOCK_BITS;
+    std::unique_ptr<std::string[]> blocks[32 - FIRST_BLOCK_BITS + 1];
+    size_t num_names = 0;
+
+    std::unordered_map<std::string_view, SymbolId> ids;
+
+    std::string& slot(SymbolId id)
+    {
+        uint64_t idx = id + FIRST_BLOCK;
+        unsigned k = 63 - __builtin_clzll(idx) - FIRST_BLOCK_BITS;
+        return blocks[k][idx - (FIRST_BLOCK << k)];
+    }
+
+  public:
+    static Interner& global();
+
+    SymbolId intern(std::string_view name)
+    {
+        if (auto iter = ids.find(name); iter != ids.end())
+        {
+            return iter->second;
+        }
+
+        SymbolId id = num_names++;
+        uint64_t idx = id + FIRST_BLOCK;
+        if ((idx & (idx - 1)) == 0)
+        {
+            // first id of a block
+            unsigned k = 63 - __builtin_clzll(idx) - FIRST_BLOCK_BITS;
+            blocks[k].reset(new std::string[FIRST_BLOCK << k]);
+        }
+
+        auto &stored = slot(id);
+        stored = name;
+        ids.emplace(stored, id);
+        return id;
+    }
+
+    std::string_view getName(SymbolId id) { return slot(id); }
+
+    // number of ids handed out, i.e., the size of a flat symbol table
+    size_t size() { return num_names; }
+};
+}
+
+#endif
@@ -1,253 +1,884 @@
 #include "lexer/lexer.hh"
+#include "lexer/scan.hh"
+#include "lexer/tokfile.hh"
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <ctype.h>
 
 namespace Frontend
 {
-std::string Token::prinTokenType()
-{
-    switch(type)
-    {
-        case TokenType::TOKEN_ILLEGAL:
-            return std::string("ILLEGAL");
-        case TokenType::TOKEN_EOF:
-            return std::string("EOF");
-        case TokenType::TOKEN_IDENTIFIER:
-            return std::string("IDENTIFIER");
-        case TokenType::TOKEN_INT:
-            return std::string("INT");
-        case TokenType::TOKEN_FLOAT:
-            return std::string("FLOAT");
-        case TokenType::TOKEN_ASSIGN:
-            return std::string("ASSIGN");
-        case TokenType::TOKEN_PLUS:
-            return std::string("PLUS");
-        case TokenType::TOKEN_MINUS:
-            return std::string("MINUS");
-        case TokenType::TOKEN_BANG:
-            return std::string("BANG");
-        case TokenType::TOKEN_ASTERISK:
-            return std::string("ASTERISK");
-        case TokenType::TOKEN_SLASH:
-            return std::string("SLASH");
-        case TokenType::TOKEN_LT:
-            return std::string("LT");
-        case TokenType::TOKEN_GT:
-            return std::string("GT");
-        case TokenType::TOKEN_COMMA:
-            return std::string("COMMA");
-        case TokenType::TOKEN_SEMICOLON:
-            return std::string("SEMICOLON");
-        case TokenType::TOKEN_LPAREN:
-            return std::string("LPAREN");
-        case TokenType::TOKEN_RPAREN:
-            return std::string("RPAREN");
-        case TokenType::TOKEN_LBRACE:
-            return std::string("LBRACE");
-        case TokenType::TOKEN_RBRACE:
-            return std::string("RBRACE");
-        case TokenType::TOKEN_LBRACKET:
-            return std::string("LBRACKET");
-        case TokenType::TOKEN_RBRACKET:
-            return std::string("RBRACKET");
-        case TokenType::TOKEN_RETURN:
-            return std::string("RETURN");
-        case TokenType::TOKEN_AMPERSAND:
-            return std::string("AMPERSAND");
-        case TokenType::TOKEN_DES_VOID:
-            return std::string("DES-VOID");
-        case TokenType::TOKEN_DES_INT:
-            return std::string("DES-INT");
-        case TokenType::TOKEN_DES_FLOAT:
-            return std::string("DES-FLOAT");
-        case TokenType::TOKEN_IF:
-            return std::string("IF");
-        case TokenType::TOKEN_ELSE:
-            return std::string("ELSE");
-        case TokenType::TOKEN_FOR:
-            return std::string("FOR");
-        case TokenType::TOKEN_WHILE:
-            return std::string("WHILE");
-        default:
-            std::cerr << "[Error] prinTokenType: "
-                      << "unsupported token type. \n";
-            exit(0);
-    }
-}
-
-Lexer::Lexer(const char* fn)
-{
-    code.open(fn);
-    assert(code.good());
-
-    // fill pre-defined seperators
-    seps.insert({'=', Token::TokenType::TOKEN_ASSIGN});
-    seps.insert({'+', Token::TokenType::TOKEN_PLUS});
-    seps.insert({'-', Token::TokenType::TOKEN_MINUS});
-    seps.insert({'!', Token::TokenType::TOKEN_BANG});
-    seps.insert({'*', Token::TokenType::TOKEN_ASTERISK});
-    seps.insert({'/', Token::TokenType::TOKEN_SLASH});
-    seps.insert({'<', Token::TokenType::TOKEN_LT});
-    seps.insert({'>', Token::TokenType::TOKEN_GT});
-    seps.insert({',', Token::TokenType::TOKEN_COMMA});
-    seps.insert({';', Token::TokenType::TOKEN_SEMICOLON});
-    seps.insert({'(', Token::TokenType::TOKEN_LPAREN});
-    seps.insert({')', Token::TokenType::TOKEN_RPAREN});
-    seps.insert({'{', Token::TokenType::TOKEN_LBRACE});
-    seps.insert({'}', Token::TokenType::TOKEN_RBRACE});
-    seps.insert({'[', Token::TokenType::TOKEN_LBRACKET});
-    seps.insert({']', Token::TokenType::TOKEN_RBRACKET});
-    seps.insert({'&', Token::TokenType::TOKEN_AMPERSAND});
-
-    // fill pre-defined keywords
-    keywords.insert({"return", Token::TokenType::TOKEN_RETURN});
-
-    keywords.insert({"void", Token::TokenType::TOKEN_DES_VOID});
-    keywords.insert({"int", Token::TokenType::TOKEN_DES_INT});
-    keywords.insert({"float", Token::TokenType::TOKEN_DES_FLOAT});
-
-    keywords.insert({"if", Token::TokenType::TOKEN_IF});
-    keywords.insert({"else", Token::TokenType::TOKEN_ELSE});
-    keywords.insert({"for", Token::TokenType::TOKEN_FOR});
-    keywords.insert({"while", Token::TokenType::TOKEN_WHILE});
-}
-
-bool Lexer::getToken(Token &tok)
-{
-    // Check if toks_per_line is empty or not
-    if (toks_per_line.size())
-    {
-        tok = toks_per_line.front();
-        toks_per_line.pop();
+namespace
+{
+using TokenType = Token::TokenType;
+
+/*
+ * Token type names, indexed by TokenType
+ * */
+struct TokenNames
+{
+    static constexpr unsigned NUM_TYPES =
+        static_cast<unsigned>(TokenType::TOKEN_WHILE) + 1;
+
+    std::string_view names[NUM_TYPES] = {};
+
+    constexpr void add(TokenType type, std::string_view name)
+    {
+        names[static_cast<unsigned>(type)] = name;
+    }
+
+    constexpr TokenNames()
+    {
+        add(TokenType::TOKEN_ILLEGAL, "ILLEGAL");
+        add(TokenType::TOKEN_EOF, "EOF");
+        add(TokenType::TOKEN_IDENTIFIER, "IDENTIFIER");
+        add(TokenType::TOKEN_INT, "INT");
+        add(TokenType::TOKEN_FLOAT, "FLOAT");
+        add(TokenType::TOKEN_ASSIGN, "ASSIGN");
+        add(TokenType::TOKEN_PLUS, "PLUS");
+        add(TokenType::TOKEN_MINUS, "MINUS");
+        add(TokenType::TOKEN_BANG, "BANG");
+        add(TokenType::TOKEN_ASTERISK, "ASTERISK");
+        add(TokenType::TOKEN_SLASH, "SLASH");
+        add(TokenType::TOKEN_LT, "LT");
+        add(TokenType::TOKEN_GT, "GT");
+        add(TokenType::TOKEN_COMMA, "COMMA");
+        add(TokenType::TOKEN_SEMICOLON, "SEMICOLON");
+        add(TokenType::TOKEN_LPAREN, "LPAREN");
+        add(TokenType::TOKEN_RPAREN, "RPAREN");
+        add(TokenType::TOKEN_LBRACE, "LBRACE");
+        add(TokenType::TOKEN_RBRACE, "RBRACE");
+        add(TokenType::TOKEN_LBRACKET, "LBRACKET");
+        add(TokenType::TOKEN_RBRACKET, "RBRACKET");
+        add(TokenType::TOKEN_RETURN, "RETURN");
+        add(TokenType::TOKEN_AMPERSAND, "AMPERSAND");
+        add(TokenType::TOKEN_DES_VOID, "DES-VOID");
+        add(TokenType::TOKEN_DES_INT, "DES-INT");
+        add(TokenType::TOKEN_DES_FLOAT, "DES-FLOAT");
+        add(TokenType::TOKEN_IF, "IF");
+        add(TokenType::TOKEN_ELSE, "ELSE");
+        add(TokenType::TOKEN_FOR, "FOR");
+        add(TokenType::TOKEN_WHILE, "WHILE");
+    }
+
+    constexpr bool complete() const
+    {
+        for (auto &name : names)
+            if (name.empty()) return false;
         return true;
     }
+};
+
+constexpr TokenNames token_names;
+static_assert(token_names.complete(), "every TokenType needs a name");
+
+/*
+ * Keyword recognition
+ *
+ * The keyword set is fixed, so a perfect hash over it is found at
+ * compile time: hash(word) = (len * seed + 3 * word[0] + word[1]) % 16,
+ * with the smallest seed that maps every keyword to its own slot.
+ * Classifying a word is one hash plus one compare, no allocation.
+ * */
+struct Keyword
+{
+    std::string_view text;
+    TokenType type = TokenType::TOKEN_IDENTIFIER;
+};
+
+constexpr Keyword keyword_list[] =
+{
+    {"return", TokenType::TOKEN_RETURN},
+
+    {"void", TokenType::TOKEN_DES_VOID},
+    {"int", TokenType::TOKEN_DES_INT},
+    {"float", TokenType::TOKEN_DES_FLOAT},
+
+    {"if", TokenType::TOKEN_IF},
+    {"else", TokenType::TOKEN_ELSE},
+    {"for", TokenType::TOKEN_FOR},
+    {"while", TokenType::TOKEN_WHILE}
+};
+
+struct KeywordTable
+{
+    static constexpr unsigned NUM_SLOTS = 16;
+
+    Keyword slots[NUM_SLOTS] = {};
+    unsigned seed = 0;
+
+    // all keywords have at least 2 characters
+    static constexpr unsigned hash(std::string_view word, unsigned seed)
+    {
+        return (word.size() * seed +
+                3 * static_cast<uint8_t>(word[0]) +
+                static_cast<uint8_t>(word[1])) % NUM_SLOTS;
+    }
+
+    constexpr bool tryFill(unsigned _seed)
+    {
+        for (auto &slot : slots) slot = Keyword();
 
-    // Read a line
-    std::string line;
-    getline(code, line);
+        for (auto &kw : keyword_list)
+        {
+            auto &slot = slots[hash(kw.text, _seed)];
+            if (!slot.text.empty()) return false;
+            slot = kw;
+        }
+        seed = _seed;
+        return true;
+    }
 
-    // Return if EOF
-    if (code.eof())
+    constexpr KeywordTable()
     {
-        tok = Token(Token::TokenType::TOKEN_EOF);
-        return false;
+        for (unsigned s = 1; s < 256; s++)
+            if (tryFill(s)) return;
     }
 
-    // Parse the line
-    parseLine(line);
+    constexpr TokenType lookup(std::string_view word) const
+    {
+        if (word.size() < 2) return TokenType::TOKEN_IDENTIFIER;
+
+        auto &slot = slots[hash(word, seed)];
+        return (slot.text == word) ? slot.type
+                                   : TokenType::TOKEN_IDENTIFIER;
+    }
+};
+
+constexpr KeywordTable keywords;
+static_assert(keywords.seed != 0, "no perfect hash for the keyword set");
+static_assert(keywords.lookup("while") == TokenType::TOKEN_WHILE &&
+              keywords.lookup("whale") == TokenType::TOKEN_IDENTIFIER,
+              "keyword table is broken");
+}
+
+std::string_view Token::prinTokenType()
+{
+    auto idx = static_cast<unsigned>(type);
+    if (idx >= TokenNames::NUM_TYPES)
+    {
+        std::cerr << "[Error] prinTokenType: "
+                  << "unsupported token type. \n";
+        exit(0);
+    }
+    return token_names.names[idx];
+}
+
+std::string_view Token::formatConstant(int32_t _val, char *buf)
+{
+    auto res = std::to_chars(buf, buf + CONSTANT_TEXT_SIZE, _val);
+    return std::string_view(buf, res.ptr - buf);
+}
+
+std::string_view Token::formatConstant(float _val, char *buf)
+{
+    // room for the ".0"
+    auto res = std::to_chars(buf, buf + CONSTANT_TEXT_SIZE - 2, _val);
+    if (std::isfinite(_val) &&
+        std::find_if(buf, res.ptr,
+                     [](char c) { return c == '.' || c == 'e'; }) == res.ptr)
+    {
+        *res.ptr++ = '.';
+        *res.ptr++ = '0';
+    }
+    return std::string_view(buf, res.ptr - buf);
+}
+
+std::string_view Token::getUnpinnedLiteral()
+{
+    if (isTokenIden()) return Interner::global().getName(sym);
+
+    // the view outlives the token, the text goes where constant()'s does
+    auto tok = isTokenInt() ? constant(int_val) : constant(float_val);
+    return tok.getLiteral();
+}
+
+Token Token::constant(int32_t _val)
+{
+    char buf[CONSTANT_TEXT_SIZE];
+    auto tok = builtin(TokenType::TOKEN_INT, formatConstant(_val, buf));
+    tok.int_val = _val;
+    return tok;
+}
+
+Token Token::constant(float _val)
+{
+    char buf[CONSTANT_TEXT_SIZE];
+    auto tok = builtin(TokenType::TOKEN_FLOAT, formatConstant(_val, buf));
+    tok.float_val = _val;
+    return tok;
+}
+
+/*
+ * Scanner tables
+ *
+ * Every byte is mapped to a character class once, and the scanner is a
+ * small DFA driven by (state, class). The states remember whether the
+ * previous byte closed a group - ")", "]" or "}" - which is all that is
+ * needed to tell a binary '-' from the sign of a negative literal
+ * without looking backwards.
+ * */
+namespace
+{
+enum CharClass : uint8_t
+{
+    CC_WORD,    // anything that continues an identifier/number
+    CC_DIGIT,   // 0-9
+    CC_SPACE,   // ' ', '\t'
+    CC_NEWLINE, // '\n'
+    CC_SEP,     // single-character separators
+    CC_CLOSE,   // ')', ']', '}'
+    CC_MINUS,   // '-'
+    CC_SLASH,   // '/'
+    CC_MAX
+};
+
+enum ScanState : uint8_t
+{
+    SS_START,       // between tokens
+    SS_AFTER_CLOSE, // between tokens, right after ')', ']' or '}'
+    SS_WORD,        // inside an identifier/number
+    SS_MAX
+};
+
+enum ScanAction : uint8_t
+{
+    SA_SKIP,        // drop the byte
+    SA_NEWLINE,     // end of the line
+    SA_SEP,         // emit a separator token
+    SA_WORD_BEGIN,  // start an identifier/number
+    SA_WORD_EXTEND, // keep going
+    SA_WORD_END,    // emit the identifier/number, re-scan the byte
+    SA_MINUS,       // '-' or the sign of a negative literal
+    SA_SLASH        // '/' or the start of a comment
+};
+
+struct Transition
+{
+    ScanState next;
+    ScanAction action;
+};
+
+struct ScanTables
+{
+    CharClass char_class[256] = {};
+    TokenType sep_type[256] = {};
+    Transition transitions[SS_MAX][CC_MAX] = {};
+
+    constexpr void addSep(char c, TokenType type, CharClass cls = CC_SEP)
+    {
+        char_class[static_cast<uint8_t>(c)] = cls;
+        sep_type[static_cast<uint8_t>(c)] = type;
+    }
 
-    // Skip empty lines
-    while (toks_per_line.size() == 0)
+    constexpr ScanTables()
     {
-        getline(code, line);
-        if (code.eof())
+        for (unsigned c = 0; c < 256; c++)
+        {
+            char_class[c] = CC_WORD;
+            sep_type[c] = TokenType::TOKEN_ILLEGAL;
+        }
+        for (char c = '0'; c <= '9'; c++)
+            char_class[static_cast<uint8_t>(c)] = CC_DIGIT;
+
+        char_class[static_cast<uint8_t>(' ')] = CC_SPACE;
+        char_class[static_cast<uint8_t>('\t')] = CC_SPACE;
+        char_class[static_cast<uint8_t>('\n')] = CC_NEWLINE;
+
+        // pre-defined seperators
+        addSep('=', TokenType::TOKEN_ASSIGN);
+        addSep('+', TokenType::TOKEN_PLUS);
+        addSep('-', TokenType::TOKEN_MINUS, CC_MINUS);
+        addSep('!', TokenType::TOKEN_BANG);
+        addSep('*', TokenType::TOKEN_ASTERISK);
+        addSep('/', TokenType::TOKEN_SLASH, CC_SLASH);
+        addSep('<', TokenType::TOKEN_LT);
+        addSep('>', TokenType::TOKEN_GT);
+        addSep(',', TokenType::TOKEN_COMMA);
+        addSep(';', TokenType::TOKEN_SEMICOLON);
+        addSep('(', TokenType::TOKEN_LPAREN);
+        addSep(')', TokenType::TOKEN_RPAREN, CC_CLOSE);
+        addSep('{', TokenType::TOKEN_LBRACE);
+        addSep('}', TokenType::TOKEN_RBRACE, CC_CLOSE);
+        addSep('[', TokenType::TOKEN_LBRACKET);
+        addSep(']', TokenType::TOKEN_RBRACKET, CC_CLOSE);
+        addSep('&', TokenType::TOKEN_AMPERSAND);
+
+        // between tokens
+        for (auto state : {SS_START, SS_AFTER_CLOSE})
         {
-            tok = Token(Token::TokenType::TOKEN_EOF);
-            return false;
+            auto &row = transitions[state];
+            row[CC_WORD]    = {SS_WORD, SA_WORD_BEGIN};
+            row[CC_DIGIT]   = {SS_WORD, SA_WORD_BEGIN};
+            row[CC_SPACE]   = {SS_START, SA_SKIP};
+            row[CC_NEWLINE] = {SS_START, SA_NEWLINE};
+            row[CC_SEP]     = {SS_START, SA_SEP};
+            row[CC_CLOSE]   = {SS_AFTER_CLOSE, SA_SEP};
+            row[CC_MINUS]   = {SS_START, SA_MINUS};
+            row[CC_SLASH]   = {SS_START, SA_SLASH};
         }
+        // "x)-1" is a subtraction, never a negative literal
+        transitions[SS_AFTER_CLOSE][CC_MINUS] = {SS_START, SA_SEP};
 
-        parseLine(line);
+        // inside a word, anything but a word/digit byte ends it
+        auto &word = transitions[SS_WORD];
+        word[CC_WORD]    = {SS_WORD, SA_WORD_EXTEND};
+        word[CC_DIGIT]   = {SS_WORD, SA_WORD_EXTEND};
+        word[CC_SPACE]   = {SS_START, SA_WORD_END};
+        word[CC_NEWLINE] = {SS_START, SA_WORD_END};
+        word[CC_SEP]     = {SS_START, SA_WORD_END};
+        word[CC_CLOSE]   = {SS_START, SA_WORD_END};
+        word[CC_MINUS]   = {SS_START, SA_WORD_END};
+        word[CC_SLASH]   = {SS_START, SA_WORD_END};
     }
+};
 
-    assert(toks_per_line.size() != 0);
-    // std::cout << "\n" << line << "\n";
-    tok = toks_per_line.front();
-    toks_per_line.pop();
+constexpr ScanTables tables;
+
+/*
+ * Numeric literals
+ *
+ * A word is a number if `std::istream >> int/float` would consume all
+ * of it: an optional '-', decimal digits and, for
+ * floats, a fraction and an exponent. No inf/nan, no hex. Out of range
+ * ints are not ints, overflowing floats are not floats, underflowing
+ * floats are (istream only rejects infinity).
+ * */
+bool toInt(std::string_view word, int32_t &val)
+{
+    auto end = word.data() + word.size();
+    auto [ptr, ec] = std::from_chars(word.data(), end, val);
+    return (ec == std::errc() && ptr == end);
+}
+
+bool toFloat(std::string_view word, float &val)
+{
+    auto digits = (!word.empty() && word[0] == '-') ? 1u : 0u;
+    if (digits >= word.size() ||
+        !(isdigit(word[digits]) || word[digits] == '.'))
+    {
+        return false;
+    }
+
+    auto end = word.data() + word.size();
+    auto [ptr, ec] = std::from_chars(word.data(), end, val);
+    if (ptr != end) return false;
+    if (ec == std::errc()) return true;
+
+    // underflow, take whatever strtof rounds to
+    std::string tmp(word);
+    val = strtof(tmp.c_str(), nullptr);
+    return std::isfinite(val);
+}
+
+// The scan kernels stop words exactly where the DFA leaves SS_WORD
+constexpr bool sameWordStops()
+{
+    bool stop[256] = {};
+    auto &list = ScanKernels::WORD_STOPS;
+    for (unsigned i = 0; i + 1 < sizeof(list); i++)
+        stop[static_cast<uint8_t>(list[i])] = true;
+
+    for (unsigned c = 0; c < 256; c++)
+    {
+        bool word = (tables.char_class[c] == CC_WORD ||
+                     tables.char_class[c] == CC_DIGIT);
+        if (word == stop[c]) return false;
+    }
     return true;
 }
+static_assert(sameWordStops(), "ScanKernels::WORD_STOPS is out of sync");
+}
 
-void Lexer::parseLine(std::string &line)
+Lexer::Lexer(const char* fn, unsigned threads)
+    : code(new Source(fn))
+    , kernels(&ScanKernels::get())
 {
-    std::shared_ptr<std::string> cur_line = 
-        std::make_shared<std::string>(line);
+    cursor = code->begin();
 
-    // Extract all the tokens from the current line
-    for (auto iter = line.begin(); iter != line.end(); iter++)
+    // Already lexed, just load the tokens
+    if (!code->isStream() && TokFile::isTokFile(code->getText()))
+    {
+        TokFile::load(*code, toks);
+        cursor = nullptr;
+    }
+    // A stream can only be read front to back
+    else if (threads > 1 && !code->isStream())
     {
-        // (1) skip space, tab, and comments
-        if (*iter == ' ' || *iter == '\t') continue;
-        if (*iter == '/'  && *(iter + 1) == '/') break;
+        lexParallel(threads);
+    }
+
+    refill();
+}
+
+Lexer::Lexer(int fd)
+    : code(new Source(fd))
+    , kernels(&ScanKernels::get())
+{
+    cursor = code->begin();
+    refill();
+}
+
+Lexer::Lexer(std::unique_ptr<Source> source)
+    : code(std::move(source))
+    , kernels(&ScanKernels::get())
+{
+
+}
 
-        // start to process token
-        std::string cur_token_str(1, *iter);
+Lexer::Lexer(Pipeline, const char* fn)
+    : code(new Source(fn))
+    , kernels(&ScanKernels::get())
+{
+    cursor = code->begin();
 
-        // (2) is it a sep?
-        if (auto sep_iter = seps.find(*iter); 
-            sep_iter != seps.end())
+    if (isRelexable())
+    {
+        batches.reset(new SpscQueue<TokenBatch*>(BATCH_QUEUE));
+        lex_stage = std::thread(&Lexer::lexStage, this);
+        cursor = nullptr;
+    }
+    else if (!code->isStream())
+    {
+        TokFile::load(*code, toks);
+        cursor = nullptr;
+    }
+
+    refill();
+}
+
+Lexer::~Lexer()
+{
+    if (!lex_stage.joinable()) return;
+
+    // A stage blocked on a full queue gives up once it is closed
+    batches->close();
+    lex_stage.join();
+
+    TokenBatch *batch;
+    while (batches->tryPop(batch)) delete batch;
+}
+
+void Lexer::lexStage()
+{
+    auto begin = code->begin();
+    auto end = code->end();
+    auto &names = Interner::global();
+
+    // line numbers as the consumer will register them
+    uint32_t line_idx = code->getNumLines();
+
+    std::unique_ptr<TokenBatch> batch(new TokenBatch);
+    // tokens of the lines before the one being lexed
+    size_t lexed = 0;
+    try
+    {
+        Diagnostic::Deferred deferred;
+        auto line = begin;
+        while (line < end)
         {
-            if (*iter == '-' \ 
-                && (*(iter + 1) != ' ' && *(iter + 1) != '\t' && *(iter + 1) != '-' \ 
-                && *(iter + 1) != '(' && (iter + 1) != line.end() && *(iter + 1) != '[' \
-                && *(iter + 1) != '{') && (*(iter - 1) != ')' && *(iter - 1) != ']' && *(iter - 1) != '}') && isdigit(*(iter + 1))) continue;
-            
-            std::string literal = cur_token_str;
-            Token::TokenType type = sep_iter->second;
-            Token _tok(type, literal, cur_line);
-            toks_per_line.push(_tok); 
+            lexed = batch->toks.size();
+            batch->lines.push_back(line - begin);
+            line = parseLine(line, line_idx++, batch->toks, names);
+
+            if (batch->toks.size() >= BATCH_TOKENS || line >= end)
+            {
+                if (!batches->push(batch.get())) break;
+                batch.release();
+                batch.reset(new TokenBatch);
+            }
+        }
+    }
+    catch (Diagnostic &diag)
+    {
+        // The lines before the one in error go out as usual, the
+        // consumer reports it once it has taken them
+        batch->toks.resize(lexed);
+        batch->lines.pop_back();
+
+        if (!batch->lines.empty() && batches->push(batch.get()))
+        {
+            batch.release();
+        }
+        stage_error.reset(new Diagnostic(std::move(diag)));
+    }
+
+    batches->close();
+}
+
+bool Lexer::isRelexable()
+{
+    return !code->isStream() && !TokFile::isTokFile(code->getText());
+}
+
+void Lexer::lexLines(uint32_t begin, uint32_t end)
+{
+    assert(begin <= end && end <= code->getText().size());
+
+    toks.clear();
+    next_tok = 0;
+
+    auto line = code->begin() + begin;
+    auto limit = code->begin() + end;
+    while (line < limit)
+    {
+        auto line_idx = code->addLine(line);
+        line = parseLine(line, line_idx, toks, Interner::global());
+    }
+
+    toks.insert(toks.end(), LOOKAHEAD, Token(Token::TokenType::TOKEN_EOF));
+    cursor = nullptr;
+}
+
+uint32_t Lexer::skipLines(uint32_t begin, uint32_t end)
+{
+    assert(begin <= end && end <= code->getText().size());
+
+    uint32_t first = code->getNumLines();
+
+    auto line = code->begin() + begin;
+    auto limit = code->begin() + end;
+    while (line < limit)
+    {
+        code->addLine(line);
+        line = kernels->findNewline(line, limit);
+        if (line < limit) line++;
+    }
+    return first;
+}
+
+void Lexer::refill()
+{
+    // Drop the consumed tokens, what is left is a part of the window
+    toks.erase(toks.begin(), toks.begin() + next_tok);
+    next_tok = 0;
+
+    // Parse lines until the window is full
+    while (toks.size() < LOOKAHEAD)
+    {
+        // or take the next batch of the lexing stage
+        TokenBatch *batch;
+        if (batches != nullptr && batches->pop(batch))
+        {
+            for (auto line : batch->lines) code->addLine(code->begin() + line);
+            toks.insert(toks.end(), batch->toks.begin(), batch->toks.end());
+            delete batch;
             continue;
         }
 
-        auto checkMinusSign = findPrevNonEmptyChar(iter, line.begin());
-        if (*checkMinusSign == '-' \
-            && (*(checkMinusSign - 1) != ']' &&  *(checkMinusSign - 1) != ')' && *(checkMinusSign - 1) != '}') \  
-            && (*(checkMinusSign + 1) != ' ' && *(checkMinusSign + 1) != '\t') && isdigit(*(checkMinusSign + 1)))
+        // The stage stopped at an error, it ends the compile here
+        if (stage_error != nullptr)
         {
-            cur_token_str.pop_back();
-            cur_token_str.push_back(*checkMinusSign);
-            cur_token_str.push_back(*iter);
-        } 
+            lex_stage.join();
+            std::unique_ptr<Diagnostic> diag(std::move(stage_error));
+            Diagnostic::report(std::move(*diag));
+        }
 
-        // (3) parse the token
-        auto next = iter + 1;
-        while (next != line.end())
+        // EOF, the window ends with EOF tokens from here on
+        if (!lexNext())
         {
-            auto next_sep_check = seps.find(*next);
+            toks.push_back(Token(Token::TokenType::TOKEN_EOF));
+        }
+    }
+}
+
+bool Lexer::lexNext()
+{
+    if (cursor != nullptr) cursor = code->nextLine(cursor);
+    if (cursor == nullptr) return false;
 
-            if ((*next == ' ') || (*next == '\t') || (next_sep_check != seps.end()))
+    // the rest of a cut line that ends in a comment
+    auto end = code->end();
+    if (in_comment)
+    {
+        auto eol = kernels->findNewline(cursor, end);
+        in_comment = line_open = (eol == end);
+        cursor = (eol == end) ? end : eol + 1;
+        return true;
+    }
+
+    auto limit = end;
+    if (code->isLineCut())
+    {
+        limit = cutLine(cursor, end);
+        if (limit == nullptr)
+        {
+            // the piece is one token so far, read on
+            cursor = code->growWindow();
+            return true;
+        }
+    }
+
+    auto line_idx = line_open ? uint32_t(code->getNumLines() - 1)
+                              : code->addLine(cursor);
+    line_open = code->isLineCut();
+    cursor = parseLine(cursor, line_idx, toks, Interner::global(), limit);
+    return true;
+}
+
+const char* Lexer::cutLine(const char *line, const char *end)
+{
+    std::string_view piece(line, end - line);
+    if (auto slash = piece.find("//"); slash != std::string_view::npos)
+    {
+        in_comment = true;
+        return line + slash;
+    }
+
+    for (auto p = end; p > line; p--)
+    {
+        auto cls = tables.char_class[static_cast<uint8_t>(p[-1])];
+        if (cls == CC_SPACE || cls == CC_SEP) return p;
+    }
+    return nullptr;
+}
+
+void Lexer::lexAll()
+{
+    while (lexNext()) {}
+
+    // Padding like a refill at the end of the input
+    toks.insert(toks.end(), LOOKAHEAD, Token(Token::TokenType::TOKEN_EOF));
+}
+
+void Lexer::lexParallel(unsigned threads)
+{
+    auto begin = code->begin();
+    auto end = code->end();
+
+    // (1) cut at the first line start after each even split point
+    std::vector<const char*> bounds{begin};
+    for (unsigned i = 1; i < threads; i++)
+    {
+        auto p = begin + (end - begin) * i / threads;
+        if (p < bounds.back()) p = bounds.back();
+        auto eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        bounds.push_back((eol == nullptr) ? end : eol + 1);
+    }
+    bounds.push_back(end);
+
+    // (2) lex every chunk with chunk-local line numbers and symbols
+    struct Chunk
+    {
+        std::vector<Token> toks;
+        std::vector<const char*> lines;
+        Interner names;
+    };
+    std::vector<Chunk> chunks(threads);
+
+    // an error stops its chunk, the first one in source order is
+    // reported from this thread once all are done
+    std::vector<std::unique_ptr<Diagnostic>> errors(threads);
+
+    auto lexChunk = [&](unsigned i)
+    {
+        Diagnostic::Deferred deferred;
+
+        auto &chunk = chunks[i];
+        auto p = bounds[i];
+        try
+        {
+            while (p < bounds[i + 1])
             {
-                break;
+                chunk.lines.push_back(p);
+                p = parseLine(p, chunk.lines.size() - 1, chunk.toks,
+                              chunk.names);
             }
-
-            cur_token_str.push_back(*next);
-            next++;
-            iter++;
         }
+        catch (Diagnostic &diag)
+        {
+            errors[i].reset(new Diagnostic(std::move(diag)));
+        }
+    };
 
-        if (isType<int>(cur_token_str))
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++)
+    {
+        workers.emplace_back(lexChunk, i);
+    }
+    lexChunk(0);
+    for (auto &worker : workers) worker.join();
+
+    for (auto &error : errors)
+    {
+        if (error != nullptr) Diagnostic::report(std::move(*error));
+    }
+
+    // (3) concatenate in order, rebasing line numbers. Chunk-local ids
+    // are in order of first appearance, so interning them chunk by
+    // chunk hands out the same global ids as sequential lexing.
+    size_t total = 0;
+    for (auto &chunk : chunks) total += chunk.toks.size();
+    toks.reserve(total);
+
+    auto &global_names = Interner::global();
+    std::vector<SymbolId> remap;
+    for (auto &chunk : chunks)
+    {
+        remap.clear();
+        for (SymbolId id = 0; id < chunk.names.size(); id++)
         {
-            Token::TokenType type = Token::TokenType::TOKEN_INT;
-            Token _tok(type, cur_token_str, cur_line);
-            toks_per_line.push(_tok);
-            continue;
+            remap.push_back(global_names.intern(chunk.names.getName(id)));
         }
-        else if (isType<float>(cur_token_str))
+
+        uint32_t line_base = code->getNumLines();
+        for (auto line : chunk.lines) code->addLine(line);
+        for (auto tok : chunk.toks)
         {
-            Token::TokenType type = Token::TokenType::TOKEN_FLOAT;
-            Token _tok(type, cur_token_str, cur_line);
-            toks_per_line.push(_tok);
-            continue;
+            tok.line += line_base;
+            if (tok.isTokenIden()) tok.sym = remap[tok.sym];
+            toks.push_back(tok);
         }
+    }
+
+    cursor = nullptr;
+}
+
+const char* Lexer::parseLine(const char *line, uint32_t line_idx,
+                             std::vector<Token> &out, Interner &names,
+                             const char *limit)
+{
+    if (limit == nullptr) limit = code->end();
+
+    // One byte of lookahead, '\0' past the end of the buffer
+    auto peek = [limit](const char *p)
+    {
+        return (p + 1 < limit) ? p[1] : '\0';
+    };
 
-        // is the token keywork?
-        if (auto k_iter = keywords.find(cur_token_str);
-            k_iter != keywords.end())
+    // Tokens only record where their text is. Streamed, an identifier
+    // or a number that prints back the same needs none of its own (see
+    // Token::getLiteral).
+    auto src = code->getId();
+    auto stream = code->isStream();
+    auto make = [&](Token::TokenType type, 
+                    const char *b, const char *e,
+                    bool unpinned = false) -> Token&
+    {
+        if (e - b > UINT16_MAX)
         {
-            std::string literal = cur_token_str;
-            Token::TokenType type = k_iter->second;
-            Token _tok(type, literal, cur_line);
+            // a streamed line may be cut, its start is kept (see addLine)
+            auto eol = kernels->findNewline(b, limit);
+            Diagnostic::fail("[Error] parseLine: token too long\n",
+                             "[Line] ", stream ? code->getLine(line_idx) :
+                                 std::string_view(line, eol - line),
+                             "\n");
+        }
+        auto offset = unpinned ? Source::UNPINNED : code->pin(b, e);
+        out.push_back(Token(type, src, offset, e - b, line_idx));
+        return out.back();
+    };
+
+    // Identifier, keyword or number
+    char printed[Token::CONSTANT_TEXT_SIZE];
+    auto makeWord = [&](const char *b, const char *e)
+    {
+        std::string_view cur_token_str(b, e - b);
 
-            toks_per_line.push(_tok);
+        int32_t int_val;
+        float float_val;
+        if (toInt(cur_token_str, int_val))
+        {
+            bool unpinned = stream &&
+                Token::formatConstant(int_val, printed) == cur_token_str;
+            make(Token::TokenType::TOKEN_INT, b, e, unpinned).int_val =
+                int_val;
+        }
+        else if (toFloat(cur_token_str, float_val))
+        {
+            bool unpinned = stream &&
+                Token::formatConstant(float_val, printed) == cur_token_str;
+            make(Token::TokenType::TOKEN_FLOAT, b, e, unpinned).float_val =
+                float_val;
         }
         else
         {
-	        std::string literal = cur_token_str;
-            Token::TokenType type = Token::TokenType::TOKEN_IDENTIFIER;
-            Token _tok(type, literal, cur_line);
+            // keyword or identifier
+            auto type = keywords.lookup(cur_token_str);
+            bool is_iden = (type == Token::TokenType::TOKEN_IDENTIFIER);
+            auto &tok = make(type, b, e, stream && is_iden);
+            if (is_iden)
+            {
+                tok.sym = names.intern(cur_token_str);
+            }
+        }
+    };
+
+    ScanState state = SS_START;
+    const char *word = nullptr;
+    auto iter = line;
+    while (iter < limit)
+    {
+        auto c = static_cast<uint8_t>(*iter);
+        auto &tr = tables.transitions[state][tables.char_class[c]];
+        state = tr.next;
 
-            toks_per_line.push(_tok);
+        switch (tr.action)
+        {
+            case SA_SKIP:
+                // jump over the whole whitespace run
+                iter = kernels->skipSpaces(iter + 1, limit);
+                break;
+
+            case SA_WORD_EXTEND:
+                iter++;
+                break;
+
+            case SA_NEWLINE:
+                return iter + 1;
+
+            case SA_SEP:
+                make(tables.sep_type[c], iter, iter + 1);
+                iter++;
+                break;
+
+            case SA_WORD_BEGIN:
+                // jump straight to the byte that ends the word
+                word = iter;
+                iter = kernels->findWordEnd(iter + 1, limit);
+                break;
+
+            case SA_WORD_END:
+                // the current byte is looked at again from SS_START
+                makeWord(word, iter);
+                break;
+
+            case SA_MINUS:
+                // '-' glued to a digit is the sign of a literal
+                if (tables.char_class[static_cast<uint8_t>(peek(iter))] ==
+                    CC_DIGIT)
+                {
+                    word = iter;
+                    state = SS_WORD;
+                    iter = kernels->findWordEnd(iter + 1, limit);
+                }
+                else
+                {
+                    make(Token::TokenType::TOKEN_MINUS, iter, iter + 1);
+                    iter++;
+                }
+                break;
+
+            case SA_SLASH:
+                // comment, skip the rest of the line
+                if (peek(iter) == '/')
+                {
+                    auto eol = kernels->findNewline(iter + 2, limit);
+                    return (eol == limit) ? limit : eol + 1;
+                }
+                make(Token::TokenType::TOKEN_SLASH, iter, iter + 1);
+                iter++;
+                break;
         }
     }
+
+    if (state == SS_WORD) makeWord(word, iter);
+    return iter;
 }
 }
@@ -1,24 +1,40 @@
 #ifndef __LEXER_HH__
 #define __LEXER_HH__
 
-#include <fstream>
+#include "lexer/diagnostic.hh"
+#include "lexer/intern.hh"
+#include "lexer/source.hh"
+#include "lexer/spsc_queue.hh"
+
+#include <cassert>
+#include <cstdint>
 #include <memory>
-#include <queue>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <unordered_map>
 
 namespace Frontend
 {
+struct ScanKernels;
+
 /*
  * Token struct definition
+ *
+ * A token is a 16-byte trivially copyable record. It does not own or
+ * point to its text; the literal and the line are looked up lazily
+ * through the Source registry from (src, offset, length) and the
+ * Source line table. Numbers are converted once by the Lexer and
+ * carry their binary value, identifiers carry their interned id.
  * */
 struct Token
 {
     /*
      * Define token types
      * */
-    enum class TokenType : int
+    enum class TokenType : uint8_t
     {
         // illegal - indicates any unsupported token types
         TOKEN_ILLEGAL,
@@ -91,8 +107,21 @@ struct Token
         TOKEN_WHILE
     } type = TokenType::TOKEN_ILLEGAL;
 
-    // literal - container of the token value
-    std::string literal = "";
+    // src - id of the Source the token text lives in
+    uint8_t src = 0;
+    // length - number of bytes of the token text
+    uint16_t length = 0;
+    // offset - byte offset of the token text inside the Source
+    uint32_t offset = 0;
+    // line - index into the Source line table
+    uint32_t line = 0;
+    // value of a TOKEN_INT/TOKEN_FLOAT, symbol of a TOKEN_IDENTIFIER
+    union
+    {
+        int32_t int_val = 0;
+        float float_val;
+        SymbolId sym;
+    };
 
     // default constructor
     Token() {}
@@ -105,39 +134,68 @@ struct Token
     }
 
     // alternative constructor
-    Token(TokenType _type, std::string &_val)
+    Token(TokenType _type,
+          uint8_t _src,
+          uint32_t _offset,
+          uint16_t _length,
+          uint32_t _line)
         : type(_type)
-        , literal(_val)
-    {
-    
-    }
-
-    // alternative constructor
-    Token(TokenType _type, 
-          std::string &_val, 
-          std::shared_ptr<std::string> &_line)
-        : type(_type)
-        , literal(_val)
+        , src(_src)
+        , length(_length)
+        , offset(_offset)
         , line(_line)
     {
     
     }
 
-    // copy constructor
-    Token(const Token &_tok)
-        : type(_tok.type)
-        , literal(_tok.literal)
-        , line(_tok.line)
+    // Token for a literal of the built-in pool (i.e., "0" or "0.0")
+    static Token builtin(TokenType _type, std::string_view _val)
     {
-    
+        auto offset = Source::getBuiltin().pinBuiltin(_val);
+
+        // both values are zero
+        return Token(_type, 0, offset, _val.size(), 0);
     }
 
-    // return token type string (implemented in lexer.cc)
-    std::string prinTokenType();
+    // Token for a constant the parser computed, its text is the value
+    // printed into the built-in pool (implemented in lexer.cc)
+    static Token constant(int32_t _val);
+    static Token constant(float _val);
+
+    // The text constant() gives a value: the shortest one that reads
+    // back as the same value, integral floats keep a ".0". buf holds at
+    // least CONSTANT_TEXT_SIZE bytes.
+    static constexpr size_t CONSTANT_TEXT_SIZE = 32;
+    static std::string_view formatConstant(int32_t _val, char *buf);
+    static std::string_view formatConstant(float _val, char *buf);
 
-    auto &getLiteral() { return literal; }
+    // return token type string (implemented in lexer.cc)
+    std::string_view prinTokenType();
+
+    // A streamed identifier or number may have no text in its Source
+    // (see Source::pin), it is then the interned name or the value
+    // printed like constant() does. Such a number's text is pinned into
+    // the built-in pool unless a buf of CONSTANT_TEXT_SIZE bytes is
+    // given to print it into.
+    std::string_view getLiteral() 
+    {
+        if (offset == Source::UNPINNED) return getUnpinnedLiteral();
+        return Source::get(src)->getText(offset, length);
+    }
+    std::string_view getLiteral(char *buf)
+    {
+        if (offset != Source::UNPINNED || isTokenIden()) return getLiteral();
+        return isTokenInt() ? formatConstant(int_val, buf)
+                            : formatConstant(float_val, buf);
+    }
+    // (implemented in lexer.cc)
+    std::string_view getUnpinnedLiteral();
     auto &getTokenType() { return type; }
 
+    int32_t getIntVal() { assert(isTokenInt()); return int_val; }
+    float getFloatVal() { assert(isTokenFloat()); return float_val; }
+    SymbolId getSym() { assert(isTokenIden()); return sym; }
+
     bool isTokenIden() { return type == TokenType::TOKEN_IDENTIFIER; }
 
     bool isTokenEOF() { return type == TokenType::TOKEN_EOF; }
@@ -178,62 +236,163 @@ struct Token
     bool isTokenFor() { return type == TokenType::TOKEN_FOR; }
     bool isTokenWhile() { return type == TokenType::TOKEN_WHILE; }
 
-    std::shared_ptr<std::string> line;
-    std::string& getLine() { return *line; }
+    // view of the whole source line the token comes from
+    std::string_view getLine() { return Source::get(src)->getLine(line); }
+    uint32_t getLineNo() { return line + 1; }
 };
+static_assert(sizeof(Token) == 16, "Token should stay compact");
+static_assert(std::is_trivially_copyable<Token>::value,
+              "Token should stay trivially copyable");
 
 class Lexer
 {
   protected:
-    // define seperators
-    std::unordered_map<char, Token::TokenType> seps;
-    // define keywords
-    std::unordered_map<std::string, Token::TokenType> keywords;
+    // The input, mapped once or streamed (see Source)
+    std::unique_ptr<Source> code;
+    // Next unread byte in code
+    const char *cursor = nullptr;
 
-  protected:
-    std::ifstream code;
+    // Bulk scanning routines (SIMD when available)
+    const ScanKernels *kernels = nullptr;
+
+    /*
+     * Lookahead window
+     *
+     * toks is the batch the lexer writes into, the window is
+     * toks[next_tok, next_tok + LOOKAHEAD). Consumers get references
+     * into the batch and never a copy. A refill only happens inside
+     * advance(): it drops the consumed tokens in front of the window
+     * and lexes lines until the window is full again, padding it with
+     * EOF tokens at the end of the input. Hence peek() never touches
+     * the batch and every reference stays valid until the next
+     * advance().
+     * */
+    std::vector<Token> toks;
+    size_t next_tok = 0;
 
-    std::queue<Token> toks_per_line;
+    /*
+     * Lexing stage (see Pipeline)
+     *
+     * The stage thread lexes the input front to back into batches of
+     * about BATCH_TOKENS tokens, each with the starts of the lines it
+     * covers, and hands them over through a bounded queue. It interns
+     * into the global Interner, nothing else does while it runs. The
+     * thread that calls advance() registers the lines as it takes the
+     * batches, so the line table is only ever touched by that thread.
+     * An error stops the stage, the thread that takes the batches
+     * reports it after the last one.
+     * */
+    struct TokenBatch
+    {
+        std::vector<Token> toks;
+        std::vector<uint32_t> lines;
+    };
+    static constexpr size_t BATCH_TOKENS = 4096;
+    static constexpr size_t BATCH_QUEUE = 16;
 
-  public:
-    Lexer(const char*);
-    ~Lexer() { code.close(); };
+    std::unique_ptr<SpscQueue<TokenBatch*>> batches;
+    std::thread lex_stage;
+    std::unique_ptr<Diagnostic> stage_error;
 
-    bool getToken(Token&);
-    
-  protected:
-    void parseLine(std::string &line);
+    void lexStage();
 
-    // helper function
-    std::string::iterator findPrevNonEmptyChar(std::string::iterator current, 
-                                               std::string::iterator begin) 
+  public:
+    // Lex the named file, "-" is stdin. With threads > 1 a mapped file
+    // is lexed up front by that many threads (see lexParallel). A .tok
+    // file (see TokFile) is loaded instead of lexed.
+    Lexer(const char*, unsigned threads = 1);
+    // Lex whatever comes out of the descriptor (pipes, sockets, ...)
+    Lexer(int);
+    // Lex nothing up front, the batch is filled by lexLines() only
+    Lexer(std::unique_ptr<Source>);
+
+    // Lex the named file on a thread of its own, ahead of whoever calls
+    // advance(), at most BATCH_QUEUE batches ahead. Only mapped source
+    // text is lexed that way, anything else as by Lexer(const char*).
+    struct Pipeline {};
+    Lexer(Pipeline, const char*);
+
+    ~Lexer();
+
+    // tokens visible at once, the parser looks at most two past the
+    // current one (a declaration "int a [")
+    static constexpr size_t LOOKAHEAD = 3;
+
+    // n-th token ahead, peek(0) is the current token
+    Token& peek(size_t n = 0)
     {
-        // Move backwards from the current position
-        auto iter = current;
-        while (iter != begin) 
-        {
-            --iter;
-            if (*iter != ' ' && *iter != '\t') 
-            {
-                // Found a non-empty character
-                return iter;
-            }
-        }
-
-        // If no non-empty character is found, return the beginning of the line
-        return begin;
+        assert(n < LOOKAHEAD);
+        return toks[next_tok + n];
     }
 
-
-    template<typename T>
-    bool isType(std::string &cur_token_str)
+    // Consume the current token, returns the new current token
+    Token& advance()
     {
-        std::istringstream iss(cur_token_str);
-        T float_check;
-        iss >> std::noskipws >> float_check;
-        if (iss.eof() && !iss.fail()) return true;
-        else return false;
+        if (++next_tok + LOOKAHEAD > toks.size()) refill();
+        return toks[next_tok];
     }
+
+    // Lex the rest of the input into the batch. Until the next
+    // advance(), the whole remaining token stream is then contiguous
+    // from peek(0) on and ends with LOOKAHEAD EOF tokens, so it can be
+    // walked (or split) in place.
+    void lexAll();
+
+    Source& getSource() { return *code; }
+
+    // True if the input is mapped source text, so the tokens' offsets
+    // are byte offsets into it and any line can be lexed again
+    bool isRelexable();
+
+    /*
+     * Lexing line ranges
+     *
+     * The line table is filled in the order lines are registered, so
+     * whoever walks a file this way registers every line exactly once,
+     * front to back, either lexing it or skipping it. Both take byte
+     * offsets of line starts (or the end of the input).
+     * */
+    // Replace the batch with the tokens of the lines in [begin, end),
+    // ending with LOOKAHEAD EOF tokens, to be walked in place as after
+    // lexAll()
+    void lexLines(uint32_t begin, uint32_t end);
+    // Register the lines in [begin, end) without lexing them, returns
+    // the index of the first one
+    uint32_t skipLines(uint32_t begin, uint32_t end);
+    
+  protected:
+    void refill();
+
+    /*
+     * Lines cut by the stream window
+     *
+     * A line longer than the window is lexed piece by piece, so that
+     * neither the window nor the batch grows with it. A piece ends
+     * after a space or a separator, where no token goes on, or at a
+     * comment, the rest of the line is then skipped. Every piece is on
+     * the line the first one registered.
+     * */
+    bool line_open = false;
+    bool in_comment = false;
+    // End of the piece of the cut line at the given byte, nullptr if
+    // it cannot be cut before end
+    const char* cutLine(const char *line, const char *end);
+
+    // Lex the next line (or piece of one) at cursor into the batch,
+    // false at the end of the input
+    bool lexNext();
+
+    // Lex one line starting at the given byte into out, returns the
+    // start of the next line. A piece of a line ends at limit instead
+    // of the end of the input.
+    const char* parseLine(const char *line, uint32_t line_idx,
+                          std::vector<Token> &out, Interner &names,
+                          const char *limit = nullptr);
+
+    // Split the whole input into line-aligned chunks, lex each on its
+    // own thread and stitch the results together in order. The token
+    // stream is identical to lexing line by line.
+    void lexParallel(unsigned threads);
 };
 
 }
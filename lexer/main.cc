@@ -1,21 +1,53 @@
 #include "lexer/lexer.hh"
+#include "lexer/scan.hh"
+#include "lexer/tokfile.hh"
 
-#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 
 using namespace Frontend;
 
 int main(int argc, char* argv[])
 {
-    Lexer lexer(argv[1]);
+    // lexer [--scalar] [--threads N] [--tok out.tok] <file>
+    int arg = 1;
+    unsigned threads = 1;
+    const char *tok_out = nullptr;
+    while (arg + 1 < argc)
+    {
+        std::string_view opt(argv[arg]);
+        if (opt == "--scalar")
+        {
+            ScanKernels::forceScalar(true);
+            arg++;
+        }
+        else if (opt == "--threads" && arg + 2 < argc)
+        {
+            threads = std::max(1, atoi(argv[arg + 1]));
+            arg += 2;
+        }
+        else if (opt == "--tok" && arg + 2 < argc)
+        {
+            tok_out = argv[arg + 1];
+            arg += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    Lexer lexer(argv[arg], threads);
 
-    Token tok;
-    while (lexer.getToken(tok))
+    // Binary token stream, or the text dump
+    if (tok_out != nullptr)
+    {
+        TokFile::write(lexer, tok_out);
+    }
+    else
     {
-        
-        std::cout << std::setw(12)
-                  << tok.prinTokenType() << " | "
-                  << tok.getLiteral() << "\n";
-        
+        TokFile::dump(lexer, stdout);
     }
 }
@@ -0,0 +1,277 @@
+#include "lexer/scan.hh"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAS_X86 1
+#endif
+
+namespace Frontend
+{
+namespace
+{
+struct WordStops
+{
+    bool stop[256] = {};
+
+    constexpr WordStops()
+    {
+        auto &list = ScanKernels::WORD_STOPS;
+        for (unsigned i = 0; i + 1 < sizeof(list); i++)
+            stop[static_cast<uint8_t>(list[i])] = true;
+    }
+};
+constexpr WordStops word_stops;
+
+/*
+ * Scalar reference kernels
+ * */
+const char* skipSpacesScalar(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+const char* findWordEndScalar(const char *p, const char *end)
+{
+    while (p < end && !word_stops.stop[static_cast<uint8_t>(*p)]) p++;
+    return p;
+}
+
+const char* findNewlineScalar(const char *p, const char *end)
+{
+    auto eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    return (eol == nullptr) ? end : eol;
+}
+
+#ifdef SCAN_HAS_X86
+/*
+ * SSE2 kernels, 16 bytes per step
+ *
+ * A word stop is one of
+ *   [9,10] [32,33] 38 [40,45] 47 [59,62] 91 93 123 125
+ * ranges are checked with an unsigned (x - lo) <= (hi - lo) compare.
+ * */
+inline __m128i inRange128(__m128i x, uint8_t lo, uint8_t hi)
+{
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(hi - lo)), t);
+}
+
+inline __m128i isWordStop128(__m128i x)
+{
+    __m128i m = inRange128(x, 9, 10);
+    m = _mm_or_si128(m, inRange128(x, 32, 33));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(38)));
+    m = _mm_or_si128(m, inRange128(x, 40, 45));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(47)));
+    m = _mm_or_si128(m, inRange128(x, 59, 62));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(91)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(93)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(123)));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(125)));
+    return m;
+}
+
+const char* skipSpacesSSE2(const char *p, const char *end)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (end - p >= 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(x, space),
+                                        _mm_cmpeq_epi8(x, tab));
+        unsigned mask = ~_mm_movemask_epi8(is_space) & 0xFFFF;
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return skipSpacesScalar(p, end);
+}
+
+const char* findWordEndSSE2(const char *p, const char *end)
+{
+    while (end - p >= 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = _mm_movemask_epi8(isWordStop128(x));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return findWordEndScalar(p, end);
+}
+
+const char* findNewlineSSE2(const char *p, const char *end)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (end - p >= 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, nl));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return findNewlineScalar(p, end);
+}
+
+/*
+ * AVX2 kernels, 32 bytes per step, same logic as SSE2
+ * */
+#define SCAN_AVX2 __attribute__((target("avx2")))
+
+SCAN_AVX2 inline __m256i inRange256(__m256i x, uint8_t lo, uint8_t hi)
+{
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(hi - lo)), t);
+}
+
+SCAN_AVX2 inline __m256i isWordStop256(__m256i x)
+{
+    __m256i m = inRange256(x, 9, 10);
+    m = _mm256_or_si256(m, inRange256(x, 32, 33));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(38)));
+    m = _mm256_or_si256(m, inRange256(x, 40, 45));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(47)));
+    m = _mm256_or_si256(m, inRange256(x, 59, 62));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(91)));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(93)));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(123)));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(125)));
+    return m;
+}
+
+SCAN_AVX2 const char* skipSpacesAVX2(const char *p, const char *end)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    while (end - p >= 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i is_space = _mm256_or_si256(_mm256_cmpeq_epi8(x, space),
+                                           _mm256_cmpeq_epi8(x, tab));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(is_space));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return skipSpacesSSE2(p, end);
+}
+
+SCAN_AVX2 const char* findWordEndAVX2(const char *p, const char *end)
+{
+    while (end - p >= 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = _mm256_movemask_epi8(isWordStop256(x));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return findWordEndSSE2(p, end);
+}
+
+SCAN_AVX2 const char* findNewlineAVX2(const char *p, const char *end)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    while (end - p >= 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, nl));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return findNewlineSSE2(p, end);
+}
+#endif
+
+const ScanKernels scalar_kernels =
+{
+    skipSpacesScalar, findWordEndScalar, findNewlineScalar, "scalar"
+};
+
+#ifdef SCAN_HAS_X86
+const ScanKernels sse2_kernels =
+{
+    skipSpacesSSE2, findWordEndSSE2, findNewlineSSE2, "sse2"
+};
+
+const ScanKernels avx2_kernels =
+{
+    skipSpacesAVX2, findWordEndAVX2, findNewlineAVX2, "avx2"
+};
+#endif
+
+bool force_scalar = false;
+
+// Every kernel must agree with the scalar one on every byte value,
+// whatever its position inside a vector.
+[[maybe_unused]] bool agreesWithScalar(const ScanKernels &k)
+{
+    const unsigned positions[] = { 0, 15, 16, 31, 47, 70 };
+    char buf[80];
+    for (unsigned c = 0; c < 256; c++)
+    {
+        for (unsigned pos : positions)
+        {
+            memset(buf, 'a', sizeof(buf));
+            buf[pos] = static_cast<char>(c);
+            auto b = buf, e = buf + sizeof(buf);
+            if (k.findWordEnd(b, e) != scalar_kernels.findWordEnd(b, e))
+                return false;
+            if (k.findNewline(b, e) != scalar_kernels.findNewline(b, e))
+                return false;
+
+            memset(buf, ' ', sizeof(buf));
+            buf[pos] = static_cast<char>(c);
+            if (k.skipSpaces(b, e) != scalar_kernels.skipSpaces(b, e))
+                return false;
+        }
+    }
+    return true;
+}
+
+const ScanKernels& select()
+{
+    if (force_scalar) return scalar_kernels;
+
+    if (auto env = getenv("FRONTEND_SCALAR_SCAN");
+        env != nullptr && env[0] == '1')
+    {
+        return scalar_kernels;
+    }
+
+#ifdef SCAN_HAS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        assert(agreesWithScalar(avx2_kernels));
+        return avx2_kernels;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        assert(agreesWithScalar(sse2_kernels));
+        return sse2_kernels;
+    }
+#endif
+    return scalar_kernels;
+}
+}
+
+const ScanKernels& ScanKernels::get()
+{
+    static const ScanKernels &kernels = select();
+    return force_scalar ? scalar_kernels : kernels;
+}
+
+void ScanKernels::forceScalar(bool on)
+{
+    force_scalar = on;
+}
+
+const ScanKernels& ScanKernels::scalar()
+{
+    return scalar_kernels;
+}
+}
@@ -0,0 +1,45 @@
+#ifndef __SCAN_HH__
+#define __SCAN_HH__
+
+namespace Frontend
+{
+/*
+ * Scan kernels - bulk byte scanning used by Lexer::parseLine
+ *
+ * Machine-generated inputs are mostly whitespace runs, identifier or
+ * number bodies and comment text. These kernels walk such runs 16
+ * (SSE2) or 32 (AVX2) bytes at a time. All of them take [p, end) and
+ * return the first byte that stops the run, or end.
+ *
+ *   skipSpaces  - first byte that is not ' ' or '\t'
+ *   findWordEnd - first byte that cannot continue an identifier/number
+ *                 (space, tab, newline or a separator)
+ *   findNewline - first '\n'
+ *
+ * The implementation is picked once at run time from what the CPU
+ * supports. The scalar version is the reference: the vector ones must
+ * return exactly the same pointers. Setting FRONTEND_SCALAR_SCAN=1 in
+ * the environment, or calling forceScalar(true), pins the scalar path.
+ * */
+struct ScanKernels
+{
+    // Bytes that end an identifier/number
+    static constexpr char WORD_STOPS[] = " \t\n=+-!*/<>,;(){}[]&";
+
+    const char* (*skipSpaces)(const char*, const char*);
+    const char* (*findWordEnd)(const char*, const char*);
+    const char* (*findNewline)(const char*, const char*);
+
+    // "scalar", "sse2" or "avx2"
+    const char *name;
+
+    // Kernels for this machine (honours forceScalar)
+    static const ScanKernels& get();
+
+    static void forceScalar(bool);
+
+    static const ScanKernels& scalar();
+};
+}
+
+#endif
@@ -0,0 +1,314 @@
+#include "lexer/source.hh"
+#include "lexer/diagnostic.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Frontend
+{
+namespace
+{
+// Protects registry slot allocation
+std::mutex registry_lock;
+
+// Protects the built-in literal pool, the body parsers pin concurrently
+std::mutex builtin_lock;
+
+// Blocks the built-in pool holds at most. Tokens are read while other
+// threads pin, so its block table is reserved once and never moves: a
+// full pool ends the compile instead.
+constexpr size_t BUILTIN_BLOCKS = 256;
+
+// What getLine() returns for a line that already left the stream window
+const char forgotten_line[] = "<line no longer buffered>";
+
+// ... and for tokens loaded from a .tok file, which has no lines
+const char missing_line[] = "<source line not available>";
+}
+
+Source* Source::registry[MAX_SOURCES] = { &Source::builtin };
+Source Source::builtin;
+
+Source::Source()
+    : is_stream(true)
+    , at_eof(true)
+    , num_lines(1)
+    , id(0)
+{
+    // a single empty line, every built-in token is on it
+    pool_blocks.reserve(BUILTIN_BLOCKS);
+}
+
+void Source::registerSource()
+{
+    // Grab a registry slot, 0 is the built-in pool
+    std::lock_guard<std::mutex> guard(registry_lock);
+    unsigned slot = 1;
+    while (slot < MAX_SOURCES && registry[slot] != nullptr) slot++;
+    if (slot == MAX_SOURCES)
+    {
+        std::cerr << "[Error] Source: too many open sources\n";
+        exit(0);
+    }
+    registry[slot] = this;
+    id = slot;
+}
+
+Source::Source(int _fd)
+{
+    registerSource();
+    initStream(_fd, false);
+}
+
+Source::Source(const char* fn)
+{
+    registerSource();
+
+    int fd = (std::string_view(fn) == "-") ? STDIN_FILENO : open(fn, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "[Error] Source: cannot open " << fn << "\n";
+        exit(0);
+    }
+
+    // (1) stream anything that is not a regular file (pipes, stdin, ...)
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        initStream(fd, fd != STDIN_FILENO);
+        return;
+    }
+
+    // (2) map regular files
+    size = st.st_size;
+
+    // mmap does not accept zero-length mappings
+    if (size == 0)
+    {
+        data = owned.data();
+        close(fd);
+        return;
+    }
+
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED)
+    {
+        // We walk the file front to back exactly once
+        madvise(addr, size, MADV_SEQUENTIAL);
+
+        data = static_cast<const char*>(addr);
+        is_mapped = true;
+    }
+    close(fd);
+
+    // (3) fallback - read the whole file into memory
+    if (!is_mapped)
+    {
+        std::ifstream code(fn);
+        assert(code.good());
+
+        std::ostringstream oss;
+        oss << code.rdbuf();
+        owned = oss.str();
+
+        data = owned.data();
+        size = owned.size();
+    }
+
+    // Tokens address the buffer with 32-bit offsets
+    if (size > UINT32_MAX)
+    {
+        std::cerr << "[Error] Source: " << fn << " is larger than 4GB\n";
+        exit(0);
+    }
+}
+
+Source::~Source()
+{
+    if (is_mapped)
+    {
+        munmap(const_cast<char*>(data), size);
+    }
+
+    if (owns_fd)
+    {
+        close(fd);
+    }
+
+    if (id != 0)
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        registry[id] = nullptr;
+    }
+}
+
+void Source::initStream(int _fd, bool _owns_fd)
+{
+    is_stream = true;
+    fd = _fd;
+    owns_fd = _owns_fd;
+
+    capacity = STREAM_WINDOW;
+    window.reset(new char[capacity]);
+    data = window.get();
+    size = 0;
+}
+
+// Read more input behind data[0, size), false at the end of the input
+bool Source::fill()
+{
+    if (at_eof) return false;
+
+    auto buf = window.get();
+    auto tail = buf + (data - buf) + size;
+    while (true)
+    {
+        auto n = read(fd, tail, buf + capacity - tail);
+        if (n > 0)
+        {
+            size += n;
+            return true;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0)
+        {
+            Diagnostic::fail("[Error] Source: read failed: ",
+                             strerror(errno), "\n");
+        }
+        at_eof = true;
+        return false;
+    }
+}
+
+const char* Source::nextStreamLine(const char *cursor)
+{
+    // (1) the bytes before cursor are lexed already
+    size = end() - cursor;
+    data = cursor;
+
+    // (2) most lines end in what was read already
+    line_cut = false;
+    if (memchr(data, '\n', size) != nullptr) return data;
+
+    // (3) otherwise the line moves to the front of the window, which
+    // is read into until it holds a '\n', is full or the input ends
+    auto buf = window.get();
+    if (data != buf)
+    {
+        memmove(buf, data, size);
+        data = buf;
+    }
+
+    while (true)
+    {
+        size_t scanned = size;
+        if (size == capacity)
+        {
+            line_cut = true;
+            break;
+        }
+        if (!fill()) break;
+        if (memchr(buf + scanned, '\n', size - scanned) != nullptr) break;
+    }
+
+    return (size == 0) ? nullptr : data;
+}
+
+const char* Source::growWindow()
+{
+    assert(is_stream && data == window.get());
+
+    std::unique_ptr<char[]> bigger(new char[capacity * 2]);
+    memcpy(bigger.get(), data, size);
+    window = std::move(bigger);
+    capacity *= 2;
+
+    return nextStreamLine(window.get());
+}
+
+uint32_t Source::pinStream(const char *b, const char *e)
+{
+    std::string_view text(b, e - b);
+    if (auto iter = pool_index.find(text); iter != pool_index.end())
+    {
+        return iter->second;
+    }
+
+    // Token text is at most 64KB - 1, so it always fits in one block
+    constexpr uint32_t block_size = 1u << POOL_BLOCK_BITS;
+    if (pool_blocks.empty() || pool_pos + text.size() > block_size)
+    {
+        // the built-in pool's table is read while other threads pin,
+        // it must never move
+        size_t max_blocks = (id == 0) ? BUILTIN_BLOCKS
+                                      : (1u << (32 - POOL_BLOCK_BITS)) - 1;
+        if (pool_blocks.size() == max_blocks)
+        {
+            Diagnostic::fail("[Error] Source: literal pool is full\n");
+        }
+        pool_blocks.emplace_back(new char[block_size]);
+        pool_pos = 0;
+    }
+
+    uint32_t offset = (pool_blocks.size() - 1) << POOL_BLOCK_BITS | pool_pos;
+    auto dst = pool_blocks.back().get() + pool_pos;
+    memcpy(dst, text.data(), text.size());
+    pool_pos += text.size();
+
+    pool_index.emplace(std::string_view(dst, text.size()), offset);
+    return offset;
+}
+
+uint32_t Source::pinBuiltin(std::string_view text)
+{
+    assert(id == 0);
+    std::lock_guard<std::mutex> guard(builtin_lock);
+    return pinStream(text.data(), text.data() + text.size());
+}
+
+uint32_t Source::addLine(const char *line)
+{
+    if (!is_stream)
+    {
+        line_starts.push_back(line - data);
+        return line_starts.size() - 1;
+    }
+
+    // a cut line is known by its first piece
+    auto eol = static_cast<const char*>(memchr(line, '\n', end() - line));
+    if (eol == nullptr) eol = end();
+    auto length = std::min<size_t>(eol - line, STREAM_WINDOW);
+    recent_lines[num_lines % RECENT_LINES].assign(line, length);
+    return num_lines++;
+}
+
+std::string_view Source::getLine(uint32_t line)
+{
+    if (is_stream)
+    {
+        assert(line < num_lines);
+        if (num_lines - line > RECENT_LINES) return forgotten_line;
+        return recent_lines[line % RECENT_LINES];
+    }
+
+    // not a lexed line, e.g. the Source is a loaded .tok file
+    if (line >= line_starts.size()) return missing_line;
+
+    auto start = data + line_starts[line];
+    auto eol = static_cast<const char*>(memchr(start, '\n', end() - start));
+    if (eol == nullptr) eol = end();
+
+    return std::string_view(start, eol - start);
+}
+}
@@ -0,0 +1,183 @@
+#ifndef __SOURCE_HH__
+#define __SOURCE_HH__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * Source - read-only buffer holding the whole input file
+ *
+ * A regular file is mapped into memory once, so tokens and line
+ * references handed out by the Lexer can be std::string_view slices
+ * pointing straight into the mapping (no per-line copies).
+ *
+ * Anything that cannot be mapped (pipes, stdin, character devices, ...)
+ * is streamed instead: the input is read through a fixed-size window
+ * that holds the line being lexed plus whatever was read past it, or
+ * only a piece of a line that does not fit. Since that text is gone
+ * once the window slides, the Lexer pins the text of the tokens that
+ * need it into a deduplicated literal pool: identifiers and numbers
+ * are only pinned if their text cannot be had from the Interner or
+ * from their value (see Token::getLiteral). The last few lines are
+ * kept around for diagnostics. Memory then depends on the window and
+ * on the distinct operators and keywords, not on the size of the
+ * input.
+ *
+ * Every Source registers itself under a small id so that a Token only
+ * needs to carry (id, offset, length) to find its text again. Id 0 is
+ * reserved for the built-in literals the parser synthesizes (the "0" of
+ * a unary minus, folded constants). It is a pool like the one of a
+ * stream that never reads anything, literals are pinned into it.
+ * */
+class Source
+{
+  public:
+    static constexpr unsigned MAX_SOURCES = 256;
+
+    // initial window size in stream mode
+    static constexpr size_t STREAM_WINDOW = 64 * 1024;
+    // number of lines getLine() still knows in stream mode, each with
+    // at most STREAM_WINDOW bytes
+    static constexpr unsigned RECENT_LINES = 16;
+
+    // offset of a token whose text is not in its Source
+    static constexpr uint32_t UNPINNED = UINT32_MAX;
+
+  protected:
+    const char *data = nullptr;
+    size_t size = 0;
+
+    // true if data points to an mmap region
+    bool is_mapped = false;
+
+    // fallback storage if mmap fails
+    std::string owned;
+
+    /*
+     * Stream mode
+     *
+     * data[0, size) is the unread part of the window. nextLine() moves
+     * data on to the line. Only a line that does not end in the window
+     * is moved to its front, then the window is read into until the
+     * line ends in it or it is full. It only grows past STREAM_WINDOW
+     * when the Lexer finds no place to cut a line (see growWindow()).
+     * */
+    bool is_stream = false;
+    int fd = -1;
+    bool owns_fd = false;
+    bool at_eof = false;
+    std::unique_ptr<char[]> window;
+    size_t capacity = 0;
+    // the line at data goes on past the window
+    bool line_cut = false;
+
+    // Pinned token text, in 64KB blocks so views never move.
+    // offset = block << 16 | position inside the block, short of
+    // UNPINNED
+    static constexpr unsigned POOL_BLOCK_BITS = 16;
+    std::vector<std::unique_ptr<char[]>> pool_blocks;
+    // bytes used in the last block
+    uint32_t pool_pos = 0;
+    std::unordered_map<std::string_view, uint32_t> pool_index;
+
+    // Text of the last RECENT_LINES lines, indexed by line % RECENT_LINES
+    std::string recent_lines[RECENT_LINES];
+    uint32_t num_lines = 0;
+
+    // registry id, see Source::get()
+    uint8_t id = 0;
+
+    // Byte offset of the first character of each line. Filled in by the
+    // Lexer as it walks the buffer, so line N is known once it is lexed.
+    std::vector<uint32_t> line_starts;
+
+    static Source* registry[MAX_SOURCES];
+    static Source builtin;
+
+    // built-in literal pool (id 0)
+    Source();
+
+    void registerSource();
+    void initStream(int _fd, bool _owns_fd);
+    bool fill();
+    uint32_t pinStream(const char *b, const char *e);
+
+  public:
+    // Map (or stream) the named file, "-" is stdin
+    Source(const char*);
+    // Stream from an already open descriptor (not closed by Source)
+    Source(int);
+    ~Source();
+
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    static Source* get(uint8_t _id) { return registry[_id]; }
+    static Source& getBuiltin() { return builtin; }
+
+    uint8_t getId() { return id; }
+
+    std::string_view getText() { return std::string_view(data, size); }
+    std::string_view getText(uint32_t offset, uint32_t length)
+    {
+        if (is_stream)
+        {
+            auto block = pool_blocks[offset >> POOL_BLOCK_BITS].get();
+            auto pos = offset & ((1u << POOL_BLOCK_BITS) - 1);
+            return std::string_view(block + pos, length);
+        }
+        return std::string_view(data + offset, length);
+    }
+
+    const char *begin() { return data; }
+    const char *end() { return data + size; }
+
+    bool isMapped() { return is_mapped; }
+    bool isStream() { return is_stream; }
+
+    // Make sure the line starting at cursor is in [begin(), end()), as
+    // far as the window holds it (see isLineCut()). Returns where that
+    // line now starts, nullptr at the end of the input. In stream mode
+    // this slides the window, so pointers into the window taken before
+    // the call are invalid after it.
+    const char* nextLine(const char *cursor)
+    {
+        if (!is_stream) return (cursor == end()) ? nullptr : cursor;
+        return nextStreamLine(cursor);
+    }
+    const char* nextStreamLine(const char *cursor);
+
+    // True if the line nextLine() returned goes on past end(). Only a
+    // stream cuts lines, the rest comes with the next nextLine().
+    bool isLineCut() { return line_cut; }
+    // Double the window for a cut line the Lexer cannot lex a piece of.
+    // Returns where the line now starts, as nextLine().
+    const char* growWindow();
+
+    // Offset a Token records for the text [b, e) of the current line
+    uint32_t pin(const char *b, const char *e)
+    {
+        if (!is_stream) return b - data;
+        return pinStream(b, e);
+    }
+
+    // Offset of the text in the built-in pool, safe to call from several
+    // parsing threads at once
+    uint32_t pinBuiltin(std::string_view text);
+
+    // line table
+    uint32_t addLine(const char *line);
+    size_t getNumLines() { return is_stream ? num_lines : line_starts.size(); }
+    // byte offset of a lexed line, mapped input only
+    uint32_t getLineStart(uint32_t line) { return line_starts[line]; }
+    std::string_view getLine(uint32_t line);
+};
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef __SPSC_QUEUE_HH__
+#define __SPSC_QUEUE_HH__
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+namespace Frontend
+{
+/*
+ * SpscQueue - bounded lock-free queue between two pipeline stages
+ *
+ * Exactly one thread pushes and exactly one thread pops. The ring has
+ * a fixed number of slots: a producer that runs ahead waits in push()
+ * until the consumer frees one, so a fast stage never buffers more
+ * than the capacity in front of a slow one.
+ *
+ * Either side may close() the queue. After the producer closes it,
+ * pop() drains what is left and then fails; after the consumer closes
+ * it, push() fails, so a producer blocked on a full queue gives up.
+ *
+ * A waiting side spins for a while, the other one is usually about to
+ * catch up. Then it parks on a condition variable until the other side
+ * pushes, pops or closes. Those only take the lock while a side is
+ * parked.
+ * */
+template<typename T>
+class SpscQueue
+{
+  protected:
+    // spins before a waiting side parks
+    static constexpr unsigned SPINS = 64;
+
+    std::unique_ptr<T[]> slots;
+    size_t mask;
+
+    // next slot to pop, written by the consumer only
+    alignas(64) std::atomic<size_t> head{0};
+    // next slot to push, written by the producer only
+    alignas(64) std::atomic<size_t> tail{0};
+
+    alignas(64) std::atomic<bool> closed{false};
+
+    std::atomic<unsigned> parked{0};
+    std::mutex park_lock;
+    std::condition_variable unparked;
+
+    bool full() const
+    {
+        return tail.load(std::memory_order_acquire) -
+               head.load(std::memory_order_acquire) > mask;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) ==
+               tail.load(std::memory_order_acquire);
+    }
+
+    // Spins, then sleeps until ready() holds
+    template<typename Ready>
+    void wait(unsigned &spins, Ready ready)
+    {
+        if (++spins <= SPINS) return;
+
+        std::unique_lock<std::mutex> guard(park_lock);
+        parked.fetch_add(1);
+        // pairs with the fence in unpark(): either ready() sees the
+        // change or unpark() sees this side parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        unparked.wait(guard, ready);
+        parked.fetch_sub(1);
+    }
+
+    void unpark()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed) == 0) return;
+
+        std::lock_guard<std::mutex> guard(park_lock);
+        unparked.notify_all();
+    }
+
+  public:
+    // capacity is rounded up to a power of two
+    SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size *= 2;
+        slots.reset(new T[size]);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool tryPush(const T &val)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) return false;
+
+        slots[t & mask] = val;
+        tail.store(t + 1, std::memory_order_release);
+        unpark();
+        return true;
+    }
+
+    bool tryPop(T &val)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+
+        val = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        unpark();
+        return true;
+    }
+
+    // Waits while the queue is full, false if the consumer closed it
+    bool push(const T &val)
+    {
+        unsigned spins = 0;
+        while (!tryPush(val))
+        {
+            if (closed.load(std::memory_order_acquire)) return false;
+            wait(spins, [this]
+            {
+                return !full() || closed.load(std::memory_order_acquire);
+            });
+        }
+        return true;
+    }
+
+    // Waits while the queue is empty, false once it is closed and empty
+    bool pop(T &val)
+    {
+        unsigned spins = 0;
+        while (!tryPop(val))
+        {
+            // everything pushed before the close is visible by now
+            if (closed.load(std::memory_order_acquire)) return tryPop(val);
+            wait(spins, [this]
+            {
+                return !empty() || closed.load(std::memory_order_acquire);
+            });
+        }
+        return true;
+    }
+
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+        unpark();
+    }
+};
+}
+
+#endif
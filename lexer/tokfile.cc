@@ -0,0 +1,304 @@
+#include "lexer/tokfile.hh"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace Frontend
+{
+bool TokFile::isTokFile(std::string_view text)
+{
+    return text.size() >= sizeof(Header) &&
+           memcmp(text.data(), MAGIC, sizeof(MAGIC)) == 0;
+}
+
+void TokFile::load(Source &tok_file, std::vector<Token> &toks)
+{
+    auto text = tok_file.getText();
+    assert(isTokFile(text));
+
+    Header header;
+    memcpy(&header, text.data(), sizeof(header));
+    if (header.version != VERSION ||
+        sizeof(Header) + uint64_t(header.body_size) != text.size())
+    {
+        std::cerr << "[Error] TokFile: corrupt or unsupported token file\n";
+        exit(0);
+    }
+
+    size_t pos = sizeof(Header);
+    auto corrupt = [&]()
+    {
+        std::cerr << "[Error] TokFile: bad record at byte " << pos << "\n";
+        exit(0);
+    };
+    auto getVarint = [&]()
+    {
+        uint32_t val = 0;
+        for (unsigned shift = 0; ; shift += 7)
+        {
+            if (pos == text.size() || shift > 28) corrupt();
+            uint8_t byte = text[pos++];
+            val |= uint32_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return val;
+        }
+    };
+    // text follows its length, the token points at it
+    auto getText = [&](Token &tok)
+    {
+        auto length = getVarint();
+        if (length > UINT16_MAX || length > text.size() - pos) corrupt();
+        tok.offset = pos;
+        tok.length = length;
+        pos += length;
+    };
+
+    // file-local symbols, interned at their first use
+    std::vector<Token> syms;
+    syms.reserve(header.num_syms);
+    // the first token of every fixed kind, later ones share its text
+    Token kinds[LINE];
+    bool kind_seen[LINE] = {};
+
+    toks.reserve(toks.size() + header.num_tokens);
+    auto num_toks = toks.size();
+    auto src = tok_file.getId();
+    auto &names = Interner::global();
+    uint32_t line = 0;
+    while (pos < text.size())
+    {
+        uint8_t kind = text[pos++];
+        if (kind == LINE)
+        {
+            line += getVarint();
+            continue;
+        }
+
+        auto type = static_cast<Token::TokenType>(kind);
+        if (kind > uint8_t(Token::TokenType::TOKEN_WHILE) ||
+            type == Token::TokenType::TOKEN_EOF)
+        {
+            corrupt();
+        }
+
+        Token tok(type, src, 0, 0, line);
+        switch (type)
+        {
+          case Token::TokenType::TOKEN_IDENTIFIER:
+          {
+            auto index = getVarint();
+            if (index == syms.size())
+            {
+                getText(tok);
+                tok.sym = names.intern(text.substr(tok.offset, tok.length));
+                syms.push_back(tok);
+            }
+            else if (index > syms.size())
+            {
+                corrupt();
+            }
+            tok.offset = syms[index].offset;
+            tok.length = syms[index].length;
+            tok.sym = syms[index].sym;
+            break;
+          }
+          case Token::TokenType::TOKEN_INT:
+          case Token::TokenType::TOKEN_FLOAT:
+            if (text.size() - pos < sizeof(tok.int_val)) corrupt();
+            memcpy(&tok.int_val, text.data() + pos, sizeof(tok.int_val));
+            pos += sizeof(tok.int_val);
+            getText(tok);
+            break;
+          case Token::TokenType::TOKEN_ILLEGAL:
+            getText(tok);
+            break;
+          default:
+            if (!kind_seen[kind])
+            {
+                getText(tok);
+                kinds[kind] = tok;
+                kind_seen[kind] = true;
+            }
+            tok.offset = kinds[kind].offset;
+            tok.length = kinds[kind].length;
+            break;
+        }
+        toks.push_back(tok);
+    }
+
+    if (toks.size() - num_toks != header.num_tokens ||
+        syms.size() != header.num_syms)
+    {
+        std::cerr << "[Error] TokFile: corrupt or unsupported token file\n";
+        exit(0);
+    }
+}
+
+void TokFile::write(Lexer &lexer, const char *fn)
+{
+    FILE *out = fopen(fn, "wb");
+    if (out == nullptr)
+    {
+        std::cerr << "[Error] TokFile: cannot open " << fn << "\n";
+        exit(0);
+    }
+    // buf below is the buffer, a failed write shows at its fwrite
+    setvbuf(out, nullptr, _IONBF, 0);
+
+    constexpr size_t flush_size = 64 * 1024;
+    std::string buf;
+    buf.reserve(flush_size + 1024);
+    uint64_t written = 0;
+
+    auto put = [&](const void *data, size_t size)
+    {
+        if (fwrite(data, 1, size, out) != size)
+        {
+            std::cerr << "[Error] TokFile: failed to write " << fn << "\n";
+            exit(0);
+        }
+        written += size;
+    };
+    auto flush = [&]()
+    {
+        put(buf.data(), buf.size());
+        buf.clear();
+        // loaded tokens point into the file with 32-bit offsets
+        if (written > UINT32_MAX)
+        {
+            std::cerr << "[Error] TokFile: token stream larger than 4GB\n";
+            exit(0);
+        }
+    };
+    auto putVarint = [&](uint32_t val)
+    {
+        for (; val >= 0x80; val >>= 7) buf += char(val | 0x80);
+        buf += char(val);
+    };
+    auto putText = [&](std::string_view literal)
+    {
+        putVarint(literal.size());
+        buf += literal;
+    };
+
+    // A zeroed header until the end, a file cut short has no magic
+    Header header{};
+    put(&header, sizeof(header));
+
+    // global symbol -> file-local index, in order of first appearance
+    std::vector<uint32_t> local_sym;
+    uint32_t num_syms = 0;
+    bool kind_seen[LINE] = {};
+
+    uint32_t num_tokens = 0;
+    uint32_t line = 0;
+    char literal[Token::CONSTANT_TEXT_SIZE];
+    for (; !lexer.peek().isTokenEOF(); lexer.advance(), num_tokens++)
+    {
+        auto &tok = lexer.peek();
+        if (tok.line != line)
+        {
+            assert(tok.line > line);
+            buf += char(LINE);
+            putVarint(tok.line - line);
+            line = tok.line;
+        }
+
+        auto kind = uint8_t(tok.type);
+        buf += char(kind);
+        switch (tok.type)
+        {
+          case Token::TokenType::TOKEN_IDENTIFIER:
+            if (tok.sym >= local_sym.size())
+            {
+                local_sym.resize(tok.sym + 1, UINT32_MAX);
+            }
+            if (local_sym[tok.sym] == UINT32_MAX)
+            {
+                local_sym[tok.sym] = num_syms++;
+                putVarint(local_sym[tok.sym]);
+                putText(tok.getLiteral(literal));
+            }
+            else
+            {
+                putVarint(local_sym[tok.sym]);
+            }
+            break;
+          case Token::TokenType::TOKEN_INT:
+          case Token::TokenType::TOKEN_FLOAT:
+            buf.append(reinterpret_cast<const char *>(&tok.int_val),
+                       sizeof(tok.int_val));
+            putText(tok.getLiteral(literal));
+            break;
+          case Token::TokenType::TOKEN_ILLEGAL:
+            putText(tok.getLiteral(literal));
+            break;
+          default:
+            if (!kind_seen[kind])
+            {
+                kind_seen[kind] = true;
+                putText(tok.getLiteral(literal));
+            }
+            break;
+        }
+
+        if (buf.size() >= flush_size) flush();
+    }
+    flush();
+
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.num_tokens = num_tokens;
+    header.num_syms = num_syms;
+    header.body_size = written - sizeof(Header);
+    if (fseek(out, 0, SEEK_SET) != 0)
+    {
+        std::cerr << "[Error] TokFile: cannot seek in " << fn << "\n";
+        exit(0);
+    }
+    put(&header, sizeof(header));
+    if (fclose(out) != 0)
+    {
+        std::cerr << "[Error] TokFile: failed to write " << fn << "\n";
+        exit(0);
+    }
+}
+
+void TokFile::dump(Lexer &lexer, FILE *out)
+{
+    constexpr size_t flush_size = 64 * 1024;
+    constexpr size_t type_width = 12;
+
+    std::string buf;
+    buf.reserve(flush_size + 1024);
+    char literal[Token::CONSTANT_TEXT_SIZE];
+
+    auto flush = [&]()
+    {
+        if (fwrite(buf.data(), 1, buf.size(), out) != buf.size())
+        {
+            std::cerr << "[Error] TokFile: failed to write the tokens\n";
+            exit(0);
+        }
+        buf.clear();
+    };
+
+    for (; !lexer.peek().isTokenEOF(); lexer.advance())
+    {
+        auto &tok = lexer.peek();
+        auto type = tok.prinTokenType();
+        if (type.size() < type_width)
+        {
+            buf.append(type_width - type.size(), ' ');
+        }
+        buf += type;
+        buf += " | ";
+        buf += tok.getLiteral(literal);
+        buf += '\n';
+
+        if (buf.size() >= flush_size) flush();
+    }
+    flush();
+    fflush(out);
+}
+}
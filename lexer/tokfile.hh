@@ -0,0 +1,79 @@
+#ifndef __TOKFILE_HH__
+#define __TOKFILE_HH__
+
+#include "lexer/lexer.hh"
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * TokFile - reading and writing whole token streams
+ *
+ * A .tok file holds a lexed token stream so it can be parsed again
+ * without lexing. Everything is little-endian:
+ *
+ *   Header                       (32 bytes)
+ *   records                      (body_size bytes)
+ *
+ * A record is a kind byte (a TokenType, or LINE) and what that kind
+ * needs, lengths and indices are LEB128 varints:
+ *
+ *   LINE          n: the tokens after it are n lines further on
+ *   IDENTIFIER    file-local symbol index, its first use is followed
+ *                 by the length and the name
+ *   INT, FLOAT    4 bytes of value, the length and the text
+ *   ILLEGAL       the length and the text
+ *   anything else the first one of a kind is followed by the length
+ *                 and the text, the others are the kind byte alone
+ *
+ * A loaded Token points at its text inside the file itself (a symbol
+ * or a fixed kind at its first appearance), so a mapped .tok file is
+ * directly a Source. Symbols are re-interned once on load. The source
+ * lines are not kept, diagnostics on a loaded stream show a
+ * placeholder instead of the line.
+ *
+ * write() emits records as the lexer produces them and patches the
+ * header at the end, nothing but the symbol map is held in memory.
+ *
+ * The Lexer recognizes a .tok file by its magic and loads it instead
+ * of lexing, so the Parser accepts both kinds of input.
+ * */
+class TokFile
+{
+  public:
+    static constexpr char MAGIC[8] = {'F', 'E', 'T', 'O', 'K', 0, 0, 0};
+    static constexpr uint32_t VERSION = 2;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_tokens;
+        uint32_t num_syms;
+        uint32_t body_size;
+        uint32_t reserved[2];
+    };
+    static_assert(sizeof(Header) == 32, "Header layout is part of the format");
+
+    // kind byte of a line record, past every TokenType
+    static constexpr uint8_t LINE = 0xff;
+
+    static bool isTokFile(std::string_view text);
+
+    // Rebuild the token stream of a mapped .tok file
+    static void load(Source &tok_file, std::vector<Token> &toks);
+
+    // Drain the lexer into a .tok file
+    static void write(Lexer &lexer, const char *fn);
+
+    // Drain the lexer as "<type> | <literal>" lines, the type
+    // right-aligned to 12 columns (the historical lexer output)
+    static void dump(Lexer &lexer, FILE *out);
+};
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include "parser/arena.hh"
+
+namespace Frontend
+{
+void* Arena::allocateSlow(size_t size, size_t align)
+{
+    // Oversized requests get a block of their own, the current block
+    // keeps serving small nodes.
+    size_t block_size = size + align;
+    bool dedicated = (block_size > BLOCK_SIZE / 4);
+    if (!dedicated) block_size = BLOCK_SIZE;
+
+    std::unique_ptr<char[]> block(new char[block_size]);
+    auto addr = reinterpret_cast<uintptr_t>(block.get());
+    auto aligned = (addr + align - 1) & ~(uintptr_t(align) - 1);
+
+    if (!dedicated)
+    {
+        cur = reinterpret_cast<char*>(aligned + size);
+        limit = block.get() + block_size;
+    }
+    blocks.push_back(std::move(block));
+
+    used += size;
+    return reinterpret_cast<void*>(aligned);
+}
+
+Arena::~Arena()
+{
+    for (auto iter = finalizers.rbegin(); iter != finalizers.rend(); iter++)
+    {
+        iter->destroy(iter->obj);
+    }
+}
+
+void Arena::reset()
+{
+    for (auto iter = finalizers.rbegin(); iter != finalizers.rend(); iter++)
+    {
+        iter->destroy(iter->obj);
+    }
+    finalizers.clear();
+
+    blocks.clear();
+    cur = nullptr;
+    limit = nullptr;
+    used = 0;
+}
+}
@@ -0,0 +1,102 @@
+#ifndef __ARENA_HH__
+#define __ARENA_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * Arena - bump allocator for AST nodes
+ *
+ * Nodes are carved out of large blocks one after another, so building
+ * a tree costs a pointer bump per node instead of a malloc (plus a
+ * shared_ptr control block). Nothing is freed individually: the
+ * blocks go away together with the arena.
+ *
+ * Nodes with non-trivial members (vectors of children, ...) still need
+ * their destructors to run. create() remembers
+ * those and the arena runs them, newest first, before releasing the
+ * blocks.
+ * */
+class Arena
+{
+  protected:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *cur = nullptr;
+    char *limit = nullptr;
+
+    struct Finalizer
+    {
+        void (*destroy)(void*);
+        void *obj;
+    };
+    std::vector<Finalizer> finalizers;
+
+    // bytes handed out so far (statistics only)
+    size_t used = 0;
+
+    void* allocateSlow(size_t size, size_t align);
+
+  public:
+    Arena() {}
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align)
+    {
+        auto addr = reinterpret_cast<uintptr_t>(cur);
+        auto aligned = (addr + align - 1) & ~(uintptr_t(align) - 1);
+        if (cur == nullptr ||
+            aligned + size > reinterpret_cast<uintptr_t>(limit))
+        {
+            return allocateSlow(size, align);
+        }
+
+        cur = reinterpret_cast<char*>(aligned + size);
+        used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    template<typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        void *mem = allocate(sizeof(T), alignof(T));
+        T *obj = new (mem) T(std::forward<Args>(args)...);
+
+        if constexpr (!std::is_trivially_destructible<T>::value)
+        {
+            finalizers.push_back({[](void *p) { static_cast<T*>(p)->~T(); },
+                                  obj});
+        }
+        return obj;
+    }
+
+    // Destroy every node and release the blocks, the arena can be used
+    // again afterwards
+    void reset();
+
+    // Trade all the nodes with another arena
+    void swap(Arena &other)
+    {
+        blocks.swap(other.blocks);
+        std::swap(cur, other.cur);
+        std::swap(limit, other.limit);
+        finalizers.swap(other.finalizers);
+        std::swap(used, other.used);
+    }
+
+    size_t getBytesUsed() { return used; }
+};
+}
+
+#endif
@@ -0,0 +1,928 @@
+#include "parser/ast_cache.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Frontend
+{
+namespace
+{
+using Node = AstCache::Node;
+using Kind = AstCache::Node::Kind;
+
+// Condition operators by Node::a
+const char *const oprs[] = {"==", "!=", ">", ">=", "<", "<="};
+constexpr uint32_t NUM_OPRS = sizeof(oprs) / sizeof(oprs[0]);
+
+bool isExprKind(Kind kind)
+{
+    return kind >= Kind::LITERAL && kind <= Kind::CONST_ARRAY;
+}
+
+// What a block may hold, functions only appear at the top level
+bool isBlockStatementKind(Kind kind)
+{
+    return kind >= Kind::ASSN && kind <= Kind::WHILE && kind != Kind::FUNC;
+}
+
+// Flattens a Program into the sections of a cache file
+class Writer
+{
+  public:
+    std::vector<Node> nodes;
+    // annotated ValueType of every node, MAX for no expression
+    std::vector<uint8_t> val_types;
+    std::vector<AstCache::SymName> syms;
+    std::vector<uint8_t> arg_types;
+    // symbol names and packed array values, offsets are relative to the
+    // text section until the end
+    std::string text;
+
+  protected:
+    // id of the Source the tokens point into
+    uint8_t src;
+
+    // global symbol -> file-local index, in order of first appearance
+    std::vector<uint32_t> local_sym;
+
+  public:
+    Writer(uint8_t _src) : src(_src) {}
+
+    uint32_t addSym(SymbolId sym)
+    {
+        if (sym >= local_sym.size())
+        {
+            local_sym.resize(sym + 1, UINT32_MAX);
+        }
+        if (local_sym[sym] == UINT32_MAX)
+        {
+            auto name = Interner::global().getName(sym);
+            local_sym[sym] = syms.size();
+            syms.push_back({uint32_t(text.size()), uint32_t(name.size())});
+            text += name;
+        }
+        return local_sym[sym];
+    }
+
+    void push(const Node &node,
+              ValueType::Type val_type = ValueType::Type::MAX)
+    {
+        nodes.push_back(node);
+        val_types.push_back(uint8_t(val_type));
+    }
+
+    void addToken(Kind kind, Token &tok,
+                  ValueType::Type val_type = ValueType::Type::MAX)
+    {
+        Node node{};
+        node.kind = kind;
+        node.type = uint8_t(tok.type);
+        node.length = tok.length;
+        node.a = tok.offset;
+        node.b = tok.line;
+        if (tok.isTokenIden())
+            node.c = addSym(tok.sym);
+        else
+            memcpy(&node.c, &tok.int_val, sizeof(node.c));
+
+        if (tok.src == 0)
+        {
+            assert(kind == Kind::LITERAL && "built-in token is no literal");
+            node.kind = Kind::BUILTIN_LITERAL;
+        }
+        assert((tok.src == 0 || tok.src == src) && "token of another source");
+
+        push(node, val_type);
+    }
+
+    void addIden(Identifier *iden)
+    {
+        addToken(Kind::IDEN, iden->getToken());
+    }
+
+    void addExpr(Expression *expr)
+    {
+        Node node{};
+        visit(*expr, Overloaded {
+            [&](LiteralExpression &lit)
+            {
+                addToken(Kind::LITERAL, lit.getToken(), lit.getValType());
+                node.kind = Kind::MAX;
+            },
+            [&](ArithExpression &arith)
+            {
+                addExpr(arith.getLeft());
+                addExpr(arith.getRight());
+                node.kind = Kind::ARITH;
+                node.type = uint8_t(arith.getType());
+            },
+            [&](ArrayExpression &array)
+            {
+                addExpr(array.getNumElements());
+                for (auto ele : array.getElements()) addExpr(ele);
+                node.kind = Kind::ARRAY;
+                node.a = array.getElements().size();
+            },
+            [&](ConstArrayExpression &array)
+            {
+                addExpr(array.getNumElements());
+                node.kind = Kind::CONST_ARRAY;
+                node.type = uint8_t(array.getEleType());
+                node.a = array.size();
+                node.b = text.size();
+                if (array.isIntArray())
+                {
+                    auto &eles = array.getIntElements();
+                    text.append(reinterpret_cast<const char*>(eles.data()),
+                                eles.size() * sizeof(eles[0]));
+                }
+                else
+                {
+                    auto &eles = array.getFloatElements();
+                    text.append(reinterpret_cast<const char*>(eles.data()),
+                                eles.size() * sizeof(eles[0]));
+                }
+            },
+            [&](IndexExpression &index)
+            {
+                addIden(index.getIdentifier());
+                addExpr(index.getIndex());
+                node.kind = Kind::INDEX;
+            },
+            [&](CallExpression &call)
+            {
+                addIden(call.getIdentifier());
+                for (auto arg : call.getArgs()) addExpr(arg);
+                node.kind = Kind::CALL;
+                node.a = call.getArgs().size();
+            }
+        });
+
+        // a literal is its token
+        if (node.kind != Kind::MAX) push(node, expr->getValType());
+    }
+
+    void addCond(Condition *cond)
+    {
+        addExpr(cond->getLeft());
+        addExpr(cond->getRight());
+
+        Node node{};
+        node.kind = Kind::COND;
+        node.type = uint8_t(cond->getType());
+        while (node.a < NUM_OPRS && cond->getOpr() != oprs[node.a]) node.a++;
+        assert(node.a < NUM_OPRS);
+
+        push(node);
+    }
+
+    void addBlock(const std::vector<Statement*> &block)
+    {
+        for (auto statement : block) addStatement(statement);
+    }
+
+    void addStatement(Statement *statement)
+    {
+        Node node{};
+        visit(*statement, Overloaded {
+            [&](AssnStatement &assn)
+            {
+                addExpr(assn.getIden());
+                addExpr(assn.getExpr());
+                node.kind = Kind::ASSN;
+                node.type = uint8_t(assn.getDeclType());
+            },
+            [&](FuncStatement &func)
+            {
+                addIden(func.getIdentifier());
+                for (auto &arg : func.getFuncArgs())
+                {
+                    addIden(arg.getIdentifier());
+
+                    Node arg_node{};
+                    arg_node.kind = Kind::ARG;
+                    arg_node.type = uint8_t(arg.getArgType());
+                    push(arg_node);
+                }
+                addBlock(func.getFuncCodes());
+                node.kind = Kind::FUNC;
+                node.type = uint8_t(func.getRetType());
+                node.a = func.getFuncArgs().size();
+                node.b = func.getFuncCodes().size();
+            },
+            [&](CallStatement &call)
+            {
+                addExpr(call.getCallExpr());
+                node.kind = Kind::CALL_STMT;
+                node.type = uint8_t(call.getType());
+            },
+            [&](RetStatement &ret)
+            {
+                addExpr(ret.getRetVal());
+                node.kind = Kind::RET;
+            },
+            [&](IfStatement &if_s)
+            {
+                addCond(if_s.getCond());
+                addBlock(if_s.getTakenBlock());
+                addBlock(if_s.getNotTakenBlock());
+                node.kind = Kind::IF;
+                node.a = if_s.getTakenBlock().size();
+                node.b = if_s.getNotTakenBlock().size();
+            },
+            [&](ForStatement &for_s)
+            {
+                addStatement(for_s.getStart());
+                addCond(for_s.getEnd());
+                addStatement(for_s.getStep());
+                addBlock(for_s.getBlock());
+                node.kind = Kind::FOR;
+                node.a = for_s.getBlock().size();
+            },
+            [&](WhileStatement &while_s)
+            {
+                addCond(while_s.getWhileCond());
+                addBlock(while_s.getWhileBlock());
+                node.kind = Kind::WHILE;
+                node.a = while_s.getWhileBlock().size();
+            }
+        });
+        push(node);
+    }
+};
+
+/*
+ * Rebuilds the nodes of a mapped cache file into a Program
+ *
+ * Nothing in the file is trusted: a node has to find its children on
+ * the stack, each of the right kind, and every token has to lie inside
+ * its Source. Any failure makes the whole load a miss.
+ * */
+class Reader
+{
+  protected:
+    Source &source;
+    Program &program;
+    // the text section of the cache
+    std::string_view text;
+
+    // file-local symbol -> global one
+    std::vector<SymbolId> remap;
+
+    // Rebuilt nodes still waiting for their parent. node is an
+    // Expression*, Statement*, Identifier* or Condition* depending on
+    // the kind, an ARG is its Identifier* with the argument type.
+    struct Entry
+    {
+        void *node;
+        Kind kind;
+        uint8_t type;
+    };
+    std::vector<Entry> stack;
+
+    // children of the node being built, on top of the stack
+    Entry *kids = nullptr;
+
+  public:
+    Reader(Source &_source, Program &_program, std::string_view _text)
+        : source(_source)
+        , program(_program)
+        , text(_text)
+    {}
+
+    void addSym(std::string_view name)
+    {
+        remap.push_back(Interner::global().intern(name));
+    }
+
+    bool symbol(uint32_t local, SymbolId &sym)
+    {
+        if (local >= remap.size()) return false;
+        sym = remap[local];
+        return true;
+    }
+
+    bool token(const Node &node, Token &tok)
+    {
+        auto type = static_cast<Token::TokenType>(node.type);
+        if (node.kind == Kind::BUILTIN_LITERAL)
+        {
+            if (type == Token::TokenType::TOKEN_INT)
+            {
+                int32_t val;
+                memcpy(&val, &node.c, sizeof(val));
+                tok = Token::constant(val);
+                return true;
+            }
+            if (type == Token::TokenType::TOKEN_FLOAT)
+            {
+                float val;
+                memcpy(&val, &node.c, sizeof(val));
+                tok = Token::constant(val);
+                return true;
+            }
+            return false;
+        }
+
+        if (node.type > uint8_t(Token::TokenType::TOKEN_WHILE) ||
+            uint64_t(node.a) + node.length > source.getText().size())
+        {
+            return false;
+        }
+
+        tok = Token(type, source.getId(), node.a, node.length, node.b);
+        if (tok.isTokenIden())
+            return symbol(node.c, tok.sym);
+
+        memcpy(&tok.int_val, &node.c, sizeof(node.c));
+        return true;
+    }
+
+    // The i-th child if it is of the given kinds, nullptr otherwise
+    template<typename T, typename Pred>
+    T* kid(uint64_t i, Pred is_kind)
+    {
+        if (!is_kind(kids[i].kind)) return nullptr;
+        return static_cast<T*>(kids[i].node);
+    }
+
+    Identifier* iden(uint64_t i)
+    {
+        return kid<Identifier>(i, [](Kind k) { return k == Kind::IDEN; });
+    }
+    Expression* expr(uint64_t i)
+    {
+        return kid<Expression>(i, isExprKind);
+    }
+    Condition* cond(uint64_t i)
+    {
+        return kid<Condition>(i, [](Kind k) { return k == Kind::COND; });
+    }
+    AssnStatement* assn(uint64_t i)
+    {
+        return static_cast<AssnStatement*>(
+            kid<Statement>(i, [](Kind k) { return k == Kind::ASSN; }));
+    }
+
+    bool exprs(uint64_t first, uint64_t count, std::vector<Expression*> &out)
+    {
+        out.reserve(count);
+        for (auto i = first; i < first + count; i++)
+        {
+            auto child = expr(i);
+            if (child == nullptr) return false;
+            out.push_back(child);
+        }
+        return true;
+    }
+
+    bool block(uint64_t first, uint64_t count, std::vector<Statement*> &out)
+    {
+        out.reserve(count);
+        for (auto i = first; i < first + count; i++)
+        {
+            auto child = kid<Statement>(i, isBlockStatementKind);
+            if (child == nullptr) return false;
+            out.push_back(child);
+        }
+        return true;
+    }
+
+    static uint64_t numChildren(const Node &node)
+    {
+        switch (node.kind)
+        {
+            case Kind::ARITH:
+            case Kind::INDEX:
+            case Kind::COND:
+            case Kind::ASSN:
+                return 2;
+            case Kind::ARRAY:
+            case Kind::CALL:
+            case Kind::WHILE:
+                return 1 + uint64_t(node.a);
+            case Kind::CONST_ARRAY:
+            case Kind::ARG:
+            case Kind::CALL_STMT:
+            case Kind::RET:
+                return 1;
+            case Kind::FUNC:
+            case Kind::IF:
+                return 1 + uint64_t(node.a) + node.b;
+            case Kind::FOR:
+                return 3 + uint64_t(node.a);
+            default:
+                return 0;
+        }
+    }
+
+    // The node itself, upcast to what its kind is stored as
+    void* build(const Node &node)
+    {
+        using ExprType = Expression::ExpressionType;
+        using StatementType = Statement::StatementType;
+        auto value_type = static_cast<ValueType::Type>(node.type);
+
+        switch (node.kind)
+        {
+            case Kind::IDEN:
+            {
+                Token tok;
+                if (!token(node, tok)) return nullptr;
+                return program.create<Identifier>(tok);
+            }
+            case Kind::LITERAL:
+            case Kind::BUILTIN_LITERAL:
+            {
+                Token tok;
+                if (!token(node, tok)) return nullptr;
+                return static_cast<Expression*>(
+                    program.create<LiteralExpression>(tok));
+            }
+            case Kind::ARITH:
+            {
+                auto left = expr(0);
+                auto right = expr(1);
+                if (left == nullptr || right == nullptr ||
+                    node.type < uint8_t(ExprType::PLUS) ||
+                    node.type > uint8_t(ExprType::SLASH))
+                {
+                    return nullptr;
+                }
+                return static_cast<Expression*>(
+                    program.create<ArithExpression>(
+                        left, right, static_cast<ExprType>(node.type)));
+            }
+            case Kind::ARRAY:
+            {
+                auto num_ele = expr(0);
+                std::vector<Expression*> eles;
+                if (num_ele == nullptr || !exprs(1, node.a, eles))
+                {
+                    return nullptr;
+                }
+                return static_cast<Expression*>(
+                    program.create<ArrayExpression>(num_ele, eles));
+            }
+            case Kind::CONST_ARRAY:
+            {
+                auto num_ele = expr(0);
+                if (num_ele == nullptr ||
+                    uint64_t(node.b) + uint64_t(node.a) * 4 > text.size())
+                {
+                    return nullptr;
+                }
+                auto bits = text.data() + node.b;
+                if (value_type == ValueType::Type::INT)
+                {
+                    std::vector<int32_t> eles(node.a);
+                    memcpy(eles.data(), bits, eles.size() * sizeof(eles[0]));
+                    return static_cast<Expression*>(
+                        program.create<ConstArrayExpression>(num_ele, eles));
+                }
+                if (value_type == ValueType::Type::FLOAT)
+                {
+                    std::vector<float> eles(node.a);
+                    memcpy(eles.data(), bits, eles.size() * sizeof(eles[0]));
+                    return static_cast<Expression*>(
+                        program.create<ConstArrayExpression>(num_ele, eles));
+                }
+                return nullptr;
+            }
+            case Kind::INDEX:
+            {
+                auto array = iden(0);
+                auto idx = expr(1);
+                if (array == nullptr || idx == nullptr) return nullptr;
+                return static_cast<Expression*>(
+                    program.create<IndexExpression>(array, idx));
+            }
+            case Kind::CALL:
+            {
+                auto def = iden(0);
+                std::vector<Expression*> args;
+                if (def == nullptr || !exprs(1, node.a, args))
+                {
+                    return nullptr;
+                }
+                return static_cast<Expression*>(
+                    program.create<CallExpression>(def, args));
+            }
+            case Kind::COND:
+            {
+                auto left = expr(0);
+                auto right = expr(1);
+                if (left == nullptr || right == nullptr ||
+                    node.a >= NUM_OPRS || value_type >= ValueType::Type::MAX)
+                {
+                    return nullptr;
+                }
+                std::string opr(oprs[node.a]);
+                return program.create<Condition>(left, right, opr, value_type);
+            }
+            case Kind::ARG:
+            {
+                if (value_type >= ValueType::Type::MAX) return nullptr;
+                return iden(0);
+            }
+            case Kind::ASSN:
+            {
+                auto iden = expr(0);
+                auto value = expr(1);
+                if (iden == nullptr || value == nullptr ||
+                    value_type > ValueType::Type::MAX)
+                {
+                    return nullptr;
+                }
+                return static_cast<Statement*>(
+                    program.create<AssnStatement>(iden, value, value_type));
+            }
+            case Kind::FUNC:
+            {
+                auto name = iden(0);
+                if (name == nullptr || value_type >= ValueType::Type::MAX)
+                {
+                    return nullptr;
+                }
+
+                std::vector<FuncStatement::Argument> args;
+                args.reserve(node.a);
+                for (uint64_t i = 1; i <= node.a; i++)
+                {
+                    if (kids[i].kind != Kind::ARG) return nullptr;
+                    args.emplace_back(
+                        static_cast<ValueType::Type>(kids[i].type),
+                        static_cast<Identifier*>(kids[i].node));
+                }
+
+                std::vector<Statement*> codes;
+                if (!block(1 + uint64_t(node.a), node.b, codes))
+                {
+                    return nullptr;
+                }
+
+                return static_cast<Statement*>(
+                    program.create<FuncStatement>(value_type, name,
+                                                  args, codes));
+            }
+            case Kind::CALL_STMT:
+            {
+                auto call = kid<Expression>(0,
+                    [](Kind k) { return k == Kind::CALL; });
+                if (call == nullptr ||
+                    (node.type != uint8_t(StatementType::BUILT_IN_CALL_STATEMENT) &&
+                     node.type != uint8_t(StatementType::NORMAL_CALL_STATEMENT)))
+                {
+                    return nullptr;
+                }
+                return static_cast<Statement*>(
+                    program.create<CallStatement>(
+                        call, static_cast<StatementType>(node.type)));
+            }
+            case Kind::RET:
+            {
+                auto ret = expr(0);
+                if (ret == nullptr) return nullptr;
+                return static_cast<Statement*>(
+                    program.create<RetStatement>(ret));
+            }
+            case Kind::IF:
+            {
+                auto if_cond = cond(0);
+                std::vector<Statement*> taken, not_taken;
+                if (if_cond == nullptr ||
+                    !block(1, node.a, taken) ||
+                    !block(1 + uint64_t(node.a), node.b, not_taken))
+                {
+                    return nullptr;
+                }
+                return static_cast<Statement*>(
+                    program.create<IfStatement>(if_cond, taken, not_taken));
+            }
+            case Kind::FOR:
+            {
+                auto start = assn(0);
+                auto end = cond(1);
+                auto step = assn(2);
+                std::vector<Statement*> codes;
+                if (start == nullptr || end == nullptr || step == nullptr ||
+                    !block(3, node.a, codes))
+                {
+                    return nullptr;
+                }
+                return static_cast<Statement*>(
+                    program.create<ForStatement>(start, end, step, codes));
+            }
+            case Kind::WHILE:
+            {
+                auto while_cond = cond(0);
+                std::vector<Statement*> codes;
+                if (while_cond == nullptr || !block(1, node.a, codes))
+                {
+                    return nullptr;
+                }
+                return static_cast<Statement*>(
+                    program.create<WhileStatement>(while_cond, codes));
+            }
+            default:
+                return nullptr;
+        }
+    }
+
+    // Pop the children of node, push the node
+    bool add(const Node &node, uint8_t val_type)
+    {
+        auto num_kids = numChildren(node);
+        if (num_kids > stack.size() ||
+            val_type > uint8_t(ValueType::Type::MAX))
+        {
+            return false;
+        }
+
+        kids = stack.data() + (stack.size() - num_kids);
+        auto built = build(node);
+        if (built == nullptr) return false;
+
+        if (isExprKind(node.kind))
+        {
+            static_cast<Expression*>(built)->setValType(
+                static_cast<ValueType::Type>(val_type));
+        }
+
+        stack.resize(stack.size() - num_kids);
+        stack.push_back({built, node.kind, node.type});
+        return true;
+    }
+
+    // Whatever is left are the top-level statements, all of them functions
+    bool finish(uint32_t num_statements, std::vector<Statement*> &statements)
+    {
+        if (stack.size() != num_statements) return false;
+
+        for (auto &entry : stack)
+        {
+            if (entry.kind != Kind::FUNC) return false;
+            statements.push_back(static_cast<Statement*>(entry.node));
+        }
+        return true;
+    }
+};
+
+bool isRegularFile(const char *fn)
+{
+    struct stat st;
+    return stat(fn, &st) == 0 && S_ISREG(st.st_mode);
+}
+}
+
+uint64_t AstCache::hashText(std::string_view text)
+{
+    // Multiply-xorshift over 8-byte words, the tail is zero padded
+    constexpr uint64_t mul = 0x9e3779b97f4a7c15ull;
+    auto mix = [](uint64_t h, uint64_t word)
+    {
+        h = (h ^ word) * mul;
+        return h ^ (h >> 32);
+    };
+
+    uint64_t h = mix(mul, text.size());
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= text.size(); i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, text.data() + i, sizeof(word));
+        h = mix(h, word);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, text.data() + i, text.size() - i);
+    return mix(h, tail);
+}
+
+bool AstCache::load(const char *cache_fn, const char *fn, Parser &parser)
+{
+    // (1) Only regular files, opening a pipe here would consume it
+    if (!isRegularFile(fn) || !isRegularFile(cache_fn)) return false;
+
+    std::unique_ptr<Source> cache(new Source(cache_fn));
+    auto file = cache->getText();
+    if (file.size() < sizeof(Header) ||
+        memcmp(file.data(), MAGIC, sizeof(MAGIC)) != 0)
+    {
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, file.data(), sizeof(header));
+
+    uint64_t nodes_offset = sizeof(Header);
+    uint64_t funcs_offset = nodes_offset +
+                            uint64_t(header.num_nodes) * sizeof(Node);
+    uint64_t syms_offset = funcs_offset +
+                           uint64_t(header.num_funcs) * sizeof(FuncDef);
+    uint64_t arg_types_offset = syms_offset +
+                                uint64_t(header.num_syms) * sizeof(SymName);
+    uint64_t val_types_offset = arg_types_offset + header.num_arg_types;
+    uint32_t flags = parser.fold_constants ? FLAG_FOLD_CONSTANTS : 0;
+    if (header.version != VERSION ||
+        header.flags != flags ||
+        header.text_offset != val_types_offset + header.num_nodes ||
+        header.text_offset + uint64_t(header.text_size) != file.size() ||
+        hashText(file.substr(sizeof(Header))) != header.payload_hash)
+    {
+        return false;
+    }
+
+    // (2) It has to be the Program of this very source
+    std::unique_ptr<Source> source(new Source(fn));
+    auto text = source->getText();
+    if (text.size() != header.source_size ||
+        hashText(text) != header.source_hash)
+    {
+        return false;
+    }
+
+    // Nodes go to a Program of their own until everything checked out,
+    // a cache that fails halfway leaves nothing behind in the Parser
+    Program program;
+    Reader reader(*source, program,
+                  file.substr(header.text_offset, header.text_size));
+
+    // (3) file-local symbols to global ones
+    for (uint32_t i = 0; i < header.num_syms; i++)
+    {
+        SymName sym;
+        memcpy(&sym, file.data() + syms_offset + i * sizeof(SymName),
+               sizeof(sym));
+        if (uint64_t(sym.offset) + sym.length > header.text_size)
+        {
+            return false;
+        }
+        reader.addSym(file.substr(header.text_offset + sym.offset,
+                                  sym.length));
+    }
+
+    // (4) The nodes
+    std::vector<Statement*> statements;
+    for (uint32_t i = 0; i < header.num_nodes; i++)
+    {
+        Node node;
+        memcpy(&node, file.data() + nodes_offset + i * sizeof(Node),
+               sizeof(node));
+        if (!reader.add(node, file[val_types_offset + i])) return false;
+    }
+    if (!reader.finish(header.num_statements, statements)) return false;
+
+    // (5) The function records, built-ins included
+    std::vector<Parser::FuncRecord> func_defs;
+    for (uint32_t i = 0; i < header.num_funcs; i++)
+    {
+        FuncDef def;
+        memcpy(&def, file.data() + funcs_offset + i * sizeof(FuncDef),
+               sizeof(def));
+
+        SymbolId sym;
+        if (!reader.symbol(def.sym, sym) ||
+            def.ret_type >= uint8_t(ValueType::Type::MAX) ||
+            def.def_order >= header.num_funcs ||
+            uint64_t(def.first_arg) + def.num_args > header.num_arg_types)
+        {
+            return false;
+        }
+
+        Parser::FuncRecord record;
+        record.ret_type = static_cast<ValueType::Type>(def.ret_type);
+        record.is_built_in = def.is_built_in;
+        record.is_defined = true;
+        record.def_order = def.def_order;
+        for (uint32_t j = 0; j < def.num_args; j++)
+        {
+            uint8_t arg_type = file[arg_types_offset + def.first_arg + j];
+            if (arg_type >= uint8_t(ValueType::Type::MAX)) return false;
+            record.arg_types.push_back(
+                static_cast<ValueType::Type>(arg_type));
+        }
+
+        if (sym >= func_defs.size()) func_defs.resize(sym + 1);
+        if (func_defs[sym].is_defined) return false;
+        func_defs[sym] = record;
+    }
+
+    parser.func_def_tracker = std::move(func_defs);
+    parser.num_defs = header.num_funcs;
+    for (auto statement : statements)
+    {
+        program.addStatement(statement);
+    }
+    parser.program.swap(program);
+    parser.cached_source = std::move(source);
+    return true;
+}
+
+void AstCache::write(const char *cache_fn, Parser &parser)
+{
+    // A stream is gone by now, and could not be hashed on the next run
+    auto &source = parser.lexer->getSource();
+    if (source.isStream()) return;
+
+    Writer writer(source.getId());
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.flags = parser.fold_constants ? FLAG_FOLD_CONSTANTS : 0;
+
+    auto text = source.getText();
+    header.source_hash = hashText(text);
+    header.source_size = text.size();
+
+    // (1) The nodes, the top-level statements end up on the stack
+    auto &statements = parser.program.getStatements();
+    for (auto statement : statements)
+    {
+        writer.addStatement(statement);
+    }
+    header.num_statements = statements.size();
+
+    // (2) The function records, in SymbolId order
+    std::vector<FuncDef> funcs;
+    auto &func_defs = parser.func_def_tracker;
+    for (SymbolId sym = 0; sym < func_defs.size(); sym++)
+    {
+        auto &record = func_defs[sym];
+        if (!record.is_defined) continue;
+
+        FuncDef def{};
+        def.sym = writer.addSym(sym);
+        def.ret_type = uint8_t(record.ret_type);
+        def.is_built_in = record.is_built_in;
+        def.def_order = record.def_order;
+        def.first_arg = writer.arg_types.size();
+        def.num_args = record.arg_types.size();
+        for (auto arg_type : record.arg_types)
+        {
+            writer.arg_types.push_back(uint8_t(arg_type));
+        }
+        funcs.push_back(def);
+    }
+
+    // (3) Layout
+    uint64_t text_offset = sizeof(Header) +
+                           writer.nodes.size() * sizeof(Node) +
+                           funcs.size() * sizeof(FuncDef) +
+                           writer.syms.size() * sizeof(SymName) +
+                           writer.arg_types.size() +
+                           writer.val_types.size();
+    if (text_offset + writer.text.size() > UINT32_MAX)
+    {
+        std::cerr << "[Error] AstCache: program larger than 4GB\n";
+        exit(0);
+    }
+
+    header.num_nodes = writer.nodes.size();
+    header.num_funcs = funcs.size();
+    header.num_syms = writer.syms.size();
+    header.num_arg_types = writer.arg_types.size();
+    header.text_offset = text_offset;
+    header.text_size = writer.text.size();
+
+    // (4) Everything after the Header, in one piece to be hashed
+    std::string payload;
+    payload.reserve(text_offset - sizeof(Header) + writer.text.size());
+    auto append = [&](const void *data, size_t size)
+    {
+        payload.append(static_cast<const char*>(data), size);
+    };
+    append(writer.nodes.data(), writer.nodes.size() * sizeof(Node));
+    append(funcs.data(), funcs.size() * sizeof(FuncDef));
+    append(writer.syms.data(), writer.syms.size() * sizeof(SymName));
+    append(writer.arg_types.data(), writer.arg_types.size());
+    append(writer.val_types.data(), writer.val_types.size());
+    append(writer.text.data(), writer.text.size());
+    header.payload_hash = hashText(payload);
+
+    // (5) Written aside and renamed over the old cache, which may be
+    // mapped by another run right now
+    std::string tmp_fn = std::string(cache_fn) + ".tmp." +
+                         std::to_string(getpid());
+    FILE *out = fopen(tmp_fn.c_str(), "wb");
+    if (out == nullptr)
+    {
+        std::cerr << "[Error] AstCache: cannot open " << tmp_fn << "\n";
+        exit(0);
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(payload.data(), 1, payload.size(), out);
+    if (fclose(out) != 0 || rename(tmp_fn.c_str(), cache_fn) != 0)
+    {
+        remove(tmp_fn.c_str());
+        std::cerr << "[Error] AstCache: failed to write " << cache_fn << "\n";
+        exit(0);
+    }
+}
+}
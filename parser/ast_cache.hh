@@ -0,0 +1,156 @@
+#ifndef __AST_CACHE_HH__
+#define __AST_CACHE_HH__
+
+#include "parser/parser.hh"
+
+#include <cstdint>
+#include <string_view>
+
+namespace Frontend
+{
+/*
+ * AstCache - the parsed Program of a source file, kept on disk
+ *
+ * A cache file holds every node of a Program plus the function records
+ * of the Parser, keyed by a hash of the source text. Parsing the same
+ * source again just rebuilds the nodes instead of lexing and parsing.
+ * Everything is little-endian and packed, every section is a flat array
+ * of fixed-size records, so the file is mapped and read in place:
+ *
+ *   Header                       (72 bytes)
+ *   Node    x num_nodes          (16 bytes each)
+ *   FuncDef x num_funcs          (20 bytes each)
+ *   SymName x num_syms           ( 8 bytes each)
+ *   uint8   x num_arg_types      (argument types of the FuncDefs)
+ *   uint8   x num_nodes          (ValueType of each expression node)
+ *   text                         (symbol names, packed array values)
+ *
+ * Nodes are stored in post-order, a node comes right after its children
+ * (left to right), so the tree is rebuilt with a stack: every node pops
+ * its children off the stack and pushes itself. A node only records how
+ * many children it has where that varies. What is left on the stack at
+ * the end are the top-level statements. No node refers to another by
+ * index, loading needs no table as large as the tree.
+ *
+ * Identifiers and literals carry their token in the node. Tokens do not
+ * copy their text: the source is the very same text (the hash matches),
+ * so a loaded token points into the Source the Parser maps, or into the
+ * built-in pool. The symbol of an identifier is a file-local index into
+ * the SymName table, which is re-interned on load. The line table of the
+ * source is not rebuilt, diagnostics on a loaded Program show a
+ * placeholder instead of the line. Literals the Parser synthesized are
+ * pinned into the built-in pool again from their value.
+ *
+ * Only regular files are cached, a stream cannot be hashed up front.
+ * Everything after the Header is hashed as well. A cache that does not
+ * match, does not look right or fails its payload hash is a miss and
+ * gets replaced: the new one is written next to it and renamed over it,
+ * so a reader that has the old one mapped never sees a partial file.
+ * */
+class AstCache
+{
+  public:
+    static constexpr char MAGIC[8] = {'F', 'E', 'A', 'S', 'T', 0, 0, 0};
+    static constexpr uint32_t VERSION = 4;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_statements;
+        uint64_t source_hash;
+        uint64_t source_size;
+        uint32_t num_nodes;
+        uint32_t num_funcs;
+        uint32_t num_syms;
+        uint32_t num_arg_types;
+        uint32_t text_offset;
+        uint32_t text_size;
+        // FLAG_* the Program was parsed with, a cache only serves a
+        // Parser with the same ones
+        uint32_t flags;
+        uint32_t reserved;
+        // hashText of everything after the Header
+        uint64_t payload_hash;
+    };
+    static_assert(sizeof(Header) == 72, "Header layout is part of the format");
+
+    static constexpr uint32_t FLAG_FOLD_CONSTANTS = 1;
+
+    struct Node
+    {
+        // Children are listed in the order they are stored
+        enum class Kind : uint8_t
+        {
+            // A token: type is the TokenType, its text is [a, a + length)
+            // of the source, b is the line and c the int/float bits or
+            // the file-local symbol index
+            IDEN,
+            LITERAL,
+            // A literal synthesized by the Parser (a "0" or a folded
+            // constant), its text is printed again from c into the
+            // built-in pool
+            BUILTIN_LITERAL,
+
+            ARITH,     // (left, right), type is the ExpressionType
+            ARRAY,     // (num_ele, a elements)
+            INDEX,     // (iden, idx)
+            CALL,      // (iden, a args)
+            CONST_ARRAY, // (num_ele), a elements of ValueType type, their
+                         // bits are text[b, b + 4 * a)
+            COND,      // (left, right), compared as ValueType type with
+                       // the a-th operator of ==, !=, >, >=, <, <=
+            ARG,       // (iden), an argument of ValueType type
+            ASSN,      // (iden, expr), type is the declared ValueType
+                       // or MAX for a plain assignment
+            FUNC,      // (iden, a ARGs, b statements), returns type
+            CALL_STMT, // (call), type is the StatementType
+            RET,       // (expr)
+            IF,        // (cond, a taken, b not taken statements)
+            FOR,       // (start, cond, step, a statements)
+            WHILE,     // (cond, a statements)
+            MAX
+        };
+
+        Kind kind;
+        uint8_t type;
+        // token length, token kinds only
+        uint16_t length;
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+    };
+    static_assert(sizeof(Node) == 16, "Node layout is part of the format");
+
+    struct FuncDef
+    {
+        // file-local symbol index
+        uint32_t sym;
+        uint8_t ret_type;
+        uint8_t is_built_in;
+        uint16_t reserved;
+        uint32_t def_order;
+        // argument types are arg_types[first_arg, first_arg + num_args)
+        uint32_t first_arg;
+        uint32_t num_args;
+    };
+    static_assert(sizeof(FuncDef) == 20, "FuncDef layout is part of the format");
+
+    struct SymName
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    static uint64_t hashText(std::string_view text);
+
+    // Rebuild the Program of the source fn into the Parser, false if the
+    // cache does not exist or does not belong to the current source
+    static bool load(const char *cache_fn, const char *fn, Parser &parser);
+
+    // Store the Program the Parser just parsed
+    static void write(const char *cache_fn, Parser &parser);
+};
+}
+
+#endif
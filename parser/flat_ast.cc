@@ -0,0 +1,408 @@
+#include "parser/flat_ast.hh"
+
+namespace Frontend
+{
+namespace
+{
+// exprGen evaluates array elements with the element type
+ValueType::Type scalarType(ValueType::Type type)
+{
+    if (type == ValueType::Type::INT_ARRAY)
+        return ValueType::Type::INT;
+    else if (type == ValueType::Type::FLOAT_ARRAY)
+        return ValueType::Type::FLOAT;
+    return type;
+}
+
+uint8_t packType(ValueType::Type type)
+{
+    return static_cast<uint8_t>(type);
+}
+}
+
+void FlatAST::build(Parser &_parser)
+{
+    parser = &_parser;
+
+    for (auto statement : parser->getProgram().getStatements())
+    {
+        assert(statement->isStatementFunc());
+        lowerFunc(static_cast<FuncStatement*>(statement));
+    }
+
+    parser = nullptr;
+}
+
+ValueType::Type FlatAST::lookupVarType(SymbolId var_name)
+{
+    auto type = var_types.lookup(var_name);
+    assert(type != nullptr && "variable has no recorded type");
+    return *type;
+}
+
+uint32_t FlatAST::lowerFunc(FuncStatement *func_statement)
+{
+    var_types.enterScope();
+
+    Func func;
+    func.sym = func_statement->getFuncSym();
+    func.ret_type = packType(func_statement->getRetType());
+
+    func.first_arg = args.size();
+    for (auto &arg : func_statement->getFuncArgs())
+    {
+        args.push_back({arg.getSym(), packType(arg.getArgType())});
+        var_types.bind(arg.getSym(), arg.getArgType());
+    }
+    func.num_args = args.size() - func.first_arg;
+
+    func.block = lowerBlock(func.sym, func_statement->getFuncCodes());
+
+    var_types.exitScope();
+
+    funcs.push_back(func);
+    return funcs.size() - 1;
+}
+
+uint32_t FlatAST::lowerBlock(SymbolId func_name,
+                             const std::vector<Statement*> &codes)
+{
+    // Reserve the slots first so that the block stays contiguous,
+    // nested blocks land behind it.
+    Block block;
+    block.first = stmts.size();
+    block.count = codes.size();
+    stmts.resize(stmts.size() + codes.size());
+
+    for (uint32_t i = 0; i < block.count; i++)
+    {
+        lowerStmt(func_name, codes[i], block.first + i);
+    }
+
+    blocks.push_back(block);
+    return blocks.size() - 1;
+}
+
+void FlatAST::lowerStmt(SymbolId func_name,
+                        Statement *statement,
+                        uint32_t slot)
+{
+    if (statement->isStatementAssn())
+    {
+        lowerAssn(static_cast<AssnStatement*>(statement), slot);
+        return;
+    }
+
+    // stmts may grow while lowering nested blocks, fill the slot last
+    Stmt stmt;
+
+    visit(*statement, Overloaded {
+        [&](CallStatement &call_statement)
+        {
+            auto call = call_statement.getCallExpr();
+            stmt.sym = call->getCallFuncSym();
+
+            if (call_statement.isStatementBuiltinCall())
+            {
+                auto &call_args = call->getArgs();
+                assert(call_args.size() == 1);
+
+                stmt.kind = Stmt::Kind::BUILT_IN_CALL;
+                stmt.type = packType(call_args[0]->getValType());
+                stmt.a = lowerRun(call_args[0]);
+            }
+            else
+            {
+                stmt.kind = Stmt::Kind::CALL;
+                stmt.type = packType(call->getValType());
+                stmt.a = lowerRun(call);
+            }
+        },
+        [&](RetStatement &ret)
+        {
+            stmt.kind = Stmt::Kind::RET;
+            stmt.type = packType(ret.getRetVal()->getValType());
+            stmt.a = lowerRun(ret.getRetVal());
+        },
+        [&](IfStatement &if_s)
+        {
+            stmt.kind = Stmt::Kind::IF;
+            stmt.a = lowerCond(if_s.getCond());
+
+            var_types.enterScope();
+            stmt.b = lowerBlock(func_name, if_s.getTakenBlock());
+            var_types.exitScope();
+
+            if (if_s.getNotTakenBlock().size())
+            {
+                var_types.enterScope();
+                stmt.c = lowerBlock(func_name, if_s.getNotTakenBlock());
+                var_types.exitScope();
+            }
+        },
+        [&](ForStatement &for_s)
+        {
+            var_types.enterScope();
+
+            stmt.kind = Stmt::Kind::FOR;
+
+            stmt.a = stmts.size();
+            stmts.emplace_back();
+            lowerAssn(for_s.getStart(), stmt.a);
+
+            stmt.b = lowerCond(for_s.getEnd());
+            stmt.d = lowerBlock(func_name, for_s.getBlock());
+
+            stmt.c = stmts.size();
+            stmts.emplace_back();
+            lowerAssn(for_s.getStep(), stmt.c);
+
+            var_types.exitScope();
+        },
+        [&](WhileStatement &while_s)
+        {
+            var_types.enterScope();
+
+            stmt.kind = Stmt::Kind::WHILE;
+            stmt.a = lowerCond(while_s.getWhileCond());
+            stmt.b = lowerBlock(func_name, while_s.getWhileBlock());
+
+            var_types.exitScope();
+        },
+        [&](auto &) { assert(false && "unsupported statement"); }
+    });
+
+    stmts[slot] = stmt;
+}
+
+void FlatAST::lowerAssn(AssnStatement *assn_statement, uint32_t slot)
+{
+    auto iden = assn_statement->getIden();
+    auto expr = assn_statement->getExpr();
+
+    Stmt stmt;
+    stmt.sym = visit(*iden, Overloaded {
+        [](LiteralExpression &lit) { return lit.getSym(); },
+        [](IndexExpression &index) { return index.getIdenSym(); },
+        [](auto &) -> SymbolId
+        {
+            assert(false && "not an assignable expression");
+            return 0;
+        }
+    });
+
+    auto var_type = assn_statement->getDeclType();
+    if (assn_statement->isDecl())
+    {
+        var_types.bind(stmt.sym, var_type);
+    }
+    else
+    {
+        var_type = lookupVarType(stmt.sym);
+    }
+    stmt.type = packType(var_type);
+
+    if (expr->isExprArray())
+    {
+        auto array_info = static_cast<ArrayExpression*>(expr);
+
+        auto num_ele = array_info->getNumElements();
+        assert(num_ele->isExprLiteral());
+
+        assert(scalarType(var_type) != var_type);
+
+        std::vector<uint32_t> ele_runs;
+        for (auto ele : array_info->getElements())
+        {
+            ele_runs.push_back(lowerRun(ele));
+        }
+
+        stmt.kind = Stmt::Kind::ASSN_ARRAY;
+        stmt.a = static_cast<LiteralExpression*>(num_ele)->getIntVal();
+        stmt.b = lists.size();
+        stmt.c = ele_runs.size();
+        lists.insert(lists.end(), ele_runs.begin(), ele_runs.end());
+    }
+    else if (expr->isExprConstArray())
+    {
+        auto array_info = static_cast<ConstArrayExpression*>(expr);
+
+        auto num_ele = array_info->getNumElements();
+        assert(num_ele->isExprLiteral());
+
+        stmt.kind = Stmt::Kind::ASSN_CONST_ARRAY;
+        stmt.a = static_cast<LiteralExpression*>(num_ele)->getIntVal();
+        stmt.c = array_info->size();
+        if (array_info->isIntArray())
+        {
+            auto &eles = array_info->getIntElements();
+            stmt.b = int_consts.size();
+            int_consts.insert(int_consts.end(), eles.begin(), eles.end());
+        }
+        else
+        {
+            auto &eles = array_info->getFloatElements();
+            stmt.b = float_consts.size();
+            float_consts.insert(float_consts.end(), eles.begin(), eles.end());
+        }
+    }
+    else
+    {
+        stmt.kind = Stmt::Kind::ASSN;
+
+        // The element address is computed before the value
+        if (iden->isExprIndex())
+        {
+            auto index = static_cast<IndexExpression*>(iden);
+            stmt.a = lowerRun(index->getIndex());
+        }
+        stmt.b = lowerRun(expr);
+    }
+
+    stmts[slot] = stmt;
+}
+
+uint32_t FlatAST::lowerCond(Condition *cond)
+{
+    Cond flat_cond;
+    flat_cond.type = packType(cond->getType());
+
+    auto &opr = cond->getOpr();
+    if (opr == "==")
+        flat_cond.opr = Cond::Opr::EQ;
+    else if (opr == "!=")
+        flat_cond.opr = Cond::Opr::NE;
+    else if (opr == ">")
+        flat_cond.opr = Cond::Opr::GT;
+    else if (opr == ">=")
+        flat_cond.opr = Cond::Opr::GE;
+    else if (opr == "<")
+        flat_cond.opr = Cond::Opr::LT;
+    else if (opr == "<=")
+        flat_cond.opr = Cond::Opr::LE;
+    else
+        assert(false);
+
+    flat_cond.left = lowerRun(cond->getLeft());
+    flat_cond.right = lowerRun(cond->getRight());
+
+    conds.push_back(flat_cond);
+    return conds.size() - 1;
+}
+
+uint32_t FlatAST::lowerRun(Expression *expr)
+{
+    Run run;
+    run.first = exprs.size();
+    run.root = lowerExpr(expr);
+
+    runs.push_back(run);
+    return runs.size() - 1;
+}
+
+uint32_t FlatAST::lowerExpr(Expression *expr)
+{
+    if (expr->isExprArith())
+    {
+        return lowerArith(static_cast<ArithExpression*>(expr));
+    }
+
+    Expr node;
+    node.type = packType(expr->getValType());
+
+    visit(*expr, Overloaded {
+        [&](LiteralExpression &lit)
+        {
+            if (lit.isLiteralIden())
+            {
+                node.kind = Expr::Kind::VAR;
+                node.sym = lit.getSym();
+            }
+            else if (lit.getValType() == ValueType::Type::INT)
+            {
+                assert(lit.isLiteralInt());
+                node.kind = Expr::Kind::INT;
+                node.int_val = lit.getIntVal();
+            }
+            else
+            {
+                assert(lit.isLiteralFloat());
+                assert(lit.getValType() == ValueType::Type::FLOAT);
+                node.kind = Expr::Kind::FLOAT;
+                node.float_val = lit.getFloatVal();
+            }
+        },
+        [&](IndexExpression &index)
+        {
+            node.kind = Expr::Kind::INDEX;
+            node.lhs = lowerExpr(index.getIndex());
+            node.sym = index.getIdenSym();
+        },
+        [&](CallExpression &call)
+        {
+            auto &call_args = call.getArgs();
+
+            // Arguments first, each one is part of this run
+            std::vector<uint32_t> arg_roots;
+            for (auto arg : call_args)
+            {
+                arg_roots.push_back(lowerExpr(arg));
+            }
+
+            node.kind = Expr::Kind::CALL;
+            node.lhs = lists.size();
+            node.rhs = arg_roots.size();
+            node.sym = call.getCallFuncSym();
+            lists.insert(lists.end(), arg_roots.begin(), arg_roots.end());
+        },
+        [&](auto &) { assert(false && "unsupported expression"); }
+    });
+
+    exprs.push_back(node);
+    return exprs.size() - 1;
+}
+
+uint32_t FlatAST::lowerArith(ArithExpression *arith)
+{
+    // Same order as Codegen::arithExprGen: arithmetic operands first,
+    // then literals, indexing and calls.
+    uint32_t left = NONE;
+    uint32_t right = NONE;
+
+    if (arith->getLeft()->isExprArith())
+    {
+        left = lowerArith(static_cast<ArithExpression*>(arith->getLeft()));
+    }
+
+    if (arith->getRight()->isExprArith())
+    {
+        right = lowerArith(static_cast<ArithExpression*>(arith->getRight()));
+    }
+
+    if (left == NONE) left = lowerExpr(arith->getLeft());
+    if (right == NONE) right = lowerExpr(arith->getRight());
+
+    Expr node;
+    switch (arith->getOperator())
+    {
+        case '+':
+            node.kind = Expr::Kind::ADD;
+            break;
+        case '-':
+            node.kind = Expr::Kind::SUB;
+            break;
+        case '*':
+            node.kind = Expr::Kind::MUL;
+            break;
+        case '/':
+            node.kind = Expr::Kind::DIV;
+            break;
+    }
+    node.type = packType(arith->getValType());
+    node.lhs = left;
+    node.rhs = right;
+
+    exprs.push_back(node);
+    return exprs.size() - 1;
+}
+}
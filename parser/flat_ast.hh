@@ -0,0 +1,202 @@
+#ifndef __FLAT_AST_HH__
+#define __FLAT_AST_HH__
+
+#include "parser/parser.hh"
+
+#include <cstdint>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * FlatAST - compact, index-based copy of a parsed Program
+ *
+ * The pointer tree built by the Parser scatters its nodes over the
+ * arena in parse order. For the codegen walk the same program is
+ * lowered into a handful of contiguous typed arrays where children are
+ * 32-bit indices:
+ *
+ *   exprs   - every expression node, 16 bytes each
+ *   runs    - expression trees as [first, root] ranges of exprs
+ *   stmts   - every statement, 24 bytes each
+ *   conds   - if/for/while conditions
+ *   blocks  - statement lists, one per scope
+ *   funcs   - function definitions
+ *   lists   - call arguments (expr indices), array elements (run ids)
+ *   args    - function parameters
+ *   int_consts/float_consts - elements of all-constant array initializers
+ *
+ * An expression tree occupies a contiguous run of exprs with its root
+ * last. The run is in post-order, children before their parent, in the
+ * very order Codegen emits them (an arithmetic node first evaluates its
+ * arithmetic operands, then the others), so Codegen walks a run front
+ * to back and keeps one Value* per node. Index and call operands are
+ * part of the enclosing run. Every node already carries the type it is
+ * evaluated with, no scope lookups are needed while walking.
+ *
+ * The statements of a block are contiguous too, and blocks, runs and
+ * statements are laid out in the order Codegen visits them.
+ * */
+class FlatAST
+{
+  public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Expr
+    {
+        enum class Kind : uint8_t
+        {
+            INT,   // int_val
+            FLOAT, // float_val
+            VAR,   // load of sym
+            INDEX, // load of sym[lhs]
+            CALL,  // sym(lists[lhs, lhs + rhs))
+            ADD,   // lhs + rhs
+            SUB,
+            MUL,
+            DIV
+        };
+
+        Kind kind;
+        // ValueType::Type the node is evaluated with
+        uint8_t type;
+        uint16_t reserved = 0;
+        uint32_t lhs = NONE;
+        uint32_t rhs = NONE;
+        union
+        {
+            int32_t int_val = 0;
+            float float_val;
+            SymbolId sym;
+        };
+
+        auto getType() { return static_cast<ValueType::Type>(type); }
+        bool isArith() { return kind >= Kind::ADD; }
+    };
+    static_assert(sizeof(Expr) == 16, "keep expression nodes compact");
+
+    struct Stmt
+    {
+        enum class Kind : uint8_t
+        {
+            ASSN,          // sym[runs[a]] = runs[b], a is NONE for sym = ..
+            ASSN_ARRAY,    // sym[a] = { runs[lists[b, b + c)] }, a elements
+            ASSN_CONST_ARRAY, // sym[a] = { *_consts[b, b + c) }, a elements
+            BUILT_IN_CALL, // sym(runs[a])
+            CALL,          // runs[a]
+            RET,           // return runs[a]
+            IF,            // if (conds[a]) blocks[b] else blocks[c]
+            FOR,           // for (stmts[a]; conds[b]; stmts[c]) blocks[d]
+            WHILE          // while (conds[a]) blocks[b]
+        };
+
+        Kind kind;
+        uint8_t type;
+        uint16_t reserved = 0;
+        SymbolId sym = 0;
+        uint32_t a = NONE;
+        uint32_t b = NONE;
+        uint32_t c = NONE;
+        uint32_t d = NONE;
+
+        auto getType() { return static_cast<ValueType::Type>(type); }
+    };
+    static_assert(sizeof(Stmt) == 24, "keep statements compact");
+
+    struct Cond
+    {
+        enum class Opr : uint8_t { EQ, NE, GT, GE, LT, LE };
+
+        Opr opr;
+        uint8_t type;
+        uint32_t left;
+        uint32_t right;
+
+        auto getType() { return static_cast<ValueType::Type>(type); }
+    };
+
+    struct Run
+    {
+        uint32_t first;
+        uint32_t root;
+    };
+
+    struct Block
+    {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    struct Arg
+    {
+        SymbolId sym;
+        uint8_t type;
+
+        auto getType() { return static_cast<ValueType::Type>(type); }
+    };
+
+    struct Func
+    {
+        SymbolId sym;
+        uint8_t ret_type;
+        uint32_t first_arg;
+        uint32_t num_args;
+        uint32_t block;
+
+        auto getRetType() { return static_cast<ValueType::Type>(ret_type); }
+    };
+
+  protected:
+    std::vector<Expr> exprs;
+    std::vector<Run> runs;
+    std::vector<Stmt> stmts;
+    std::vector<Cond> conds;
+    std::vector<Block> blocks;
+    std::vector<Func> funcs;
+    std::vector<uint32_t> lists;
+    std::vector<Arg> args;
+    std::vector<int32_t> int_consts;
+    std::vector<float> float_consts;
+
+    /*
+     * Lowering state
+     * */
+    Parser *parser = nullptr;
+
+    // variable types visible at the current point
+    ScopedSymbolTable<ValueType::Type> var_types;
+    ValueType::Type lookupVarType(SymbolId);
+
+    uint32_t lowerFunc(FuncStatement*);
+    uint32_t lowerBlock(SymbolId, const std::vector<Statement*>&);
+    void lowerStmt(SymbolId, Statement*, uint32_t);
+    void lowerAssn(AssnStatement*, uint32_t);
+    uint32_t lowerCond(Condition*);
+    // Expressions keep the type the Parser annotated them with
+    uint32_t lowerRun(Expression*);
+    uint32_t lowerExpr(Expression*);
+    uint32_t lowerArith(ArithExpression*);
+
+  public:
+    FlatAST() {}
+
+    // Lower the whole Program of a Parser
+    void build(Parser &);
+
+    auto &getFuncs() { return funcs; }
+
+    Expr &getExpr(uint32_t idx) { return exprs[idx]; }
+    Run &getRun(uint32_t idx) { return runs[idx]; }
+    Stmt &getStmt(uint32_t idx) { return stmts[idx]; }
+    Cond &getCond(uint32_t idx) { return conds[idx]; }
+    Block &getBlock(uint32_t idx) { return blocks[idx]; }
+    Arg &getArg(uint32_t idx) { return args[idx]; }
+    uint32_t getListItem(uint32_t idx) { return lists[idx]; }
+    const int32_t *getIntConsts(uint32_t idx) { return &int_consts[idx]; }
+    const float *getFloatConsts(uint32_t idx) { return &float_consts[idx]; }
+
+    size_t getNumExprs() { return exprs.size(); }
+};
+}
+
+#endif
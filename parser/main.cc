@@ -1,14 +1,138 @@
 #include "lexer/lexer.hh"
 #include "parser/parser.hh"
 
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 
 using namespace Frontend;
 
+namespace
+{
+std::string readFile(const char *fn)
+{
+    std::ifstream in(fn, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "[Error] Cannot open " << fn << "\n";
+        exit(0);
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// The one edit that turns old_text into new_text: everything between
+// their common prefix and common suffix
+Parser::Edit diffEdit(const std::string &old_text,
+                      const std::string &new_text)
+{
+    size_t prefix = 0;
+    size_t max_prefix = std::min(old_text.size(), new_text.size());
+    while (prefix < max_prefix && old_text[prefix] == new_text[prefix])
+        prefix++;
+
+    size_t suffix = 0;
+    while (suffix < max_prefix - prefix &&
+           old_text[old_text.size() - 1 - suffix] ==
+           new_text[new_text.size() - 1 - suffix])
+        suffix++;
+
+    return {uint32_t(prefix),
+            uint32_t(old_text.size() - prefix - suffix),
+            uint32_t(new_text.size() - prefix - suffix)};
+}
+}
+
 int main(int argc, char* argv[])
 {
+    // parser [--threads N] [--ast-cache <cache>] [--fold] [--stream]
+    //        [--pipeline] [--update <old file>] <file>
+    int arg = 1;
+    unsigned threads = 1;
+    const char *ast_cache = nullptr;
+    bool fold_constants = false;
+    bool stream = false;
+    bool pipeline = false;
+    const char *update_from = nullptr;
+    while (arg + 1 < argc)
+    {
+        std::string_view opt(argv[arg]);
+        if (opt == "--threads" && arg + 2 < argc)
+        {
+            threads = std::max(1, atoi(argv[arg + 1]));
+            arg += 2;
+        }
+        else if (opt == "--ast-cache" && arg + 2 < argc)
+        {
+            ast_cache = argv[arg + 1];
+            arg += 2;
+        }
+        else if (opt == "--fold")
+        {
+            fold_constants = true;
+            arg++;
+        }
+        else if (opt == "--stream")
+        {
+            stream = true;
+            arg++;
+        }
+        else if (opt == "--pipeline")
+        {
+            pipeline = true;
+            arg++;
+        }
+        else if (opt == "--update" && arg + 2 < argc)
+        {
+            update_from = argv[arg + 1];
+            arg += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // One function at a time, the threads and the cache need the whole
+    // Program. Pipelined, the lexing and parsing run ahead of the dump.
+    if ((stream || pipeline) &&
+        (threads > 1 || ast_cache != nullptr || update_from != nullptr))
+    {
+        std::cerr << "[Error] --stream and --pipeline do not go with "
+                  << "--threads, --ast-cache or --update\n";
+        return 1;
+    }
+    if (stream || pipeline)
+    {
+        std::unique_ptr<Parser> parser(pipeline ?
+            new Parser(Parser::Pipeline(), argv[arg], fold_constants) :
+            new Parser(Parser::Stream(), argv[arg], fold_constants));
+        PrintSink out(STDOUT_FILENO);
+        while (auto func = parser->nextFunc())
+        {
+            func->printStatement(out);
+        }
+        return 0;
+    }
+
+    // Incremental: the old file is parsed, then brought up to date with
+    // the edit that turns it into the file. The dump is the same as the
+    // one of a fresh parse.
+    if (update_from != nullptr)
+    {
+        auto edit = diffEdit(readFile(update_from), readFile(argv[arg]));
+        Parser parser(update_from, threads, threads, ast_cache,
+                      fold_constants);
+        parser.update(argv[arg], {edit});
+        parser.printStatements();
+        return 0;
+    }
+
     // Parser
-    Parser parser(argv[1]);
+    Parser parser(argv[arg], threads, threads, ast_cache, fold_constants);
     parser.printStatements();
 }
@@ -1,15 +1,423 @@
 // Student Name: Charles Tran
 
 #include "parser/parser.hh"
+#include "parser/ast_cache.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
 
 namespace Frontend
 {
-Parser::Parser(const char* fn) : lexer(new Lexer(fn))
+namespace
+{
+/*
+ * Binding powers of the infix operators, indexed by token type
+ *
+ * An operator takes its left operand if its left_bp is higher than the
+ * current minimum, its right operand is then parsed with right_bp as
+ * the new minimum (left_bp < right_bp: left-associative). Tokens that
+ * are no infix operator have left_bp 0 and end the expression. Adding
+ * an operator is one more entry here.
+ *
+ * paren_right_bp is used instead of right_bp when the right operand
+ * starts with '('. For '*' and '/' it is looser than their own left_bp:
+ * a parenthesized right operand takes the rest of the multiplicative
+ * chain, i.e., a * (b) / c is a * ((b) / c). Existing programs (and
+ * their printed trees) rely on that grouping, so it is kept.
+ * */
+struct BindingPower
+{
+    uint8_t left_bp = 0;
+    uint8_t right_bp = 0;
+    uint8_t paren_right_bp = 0;
+    Expression::ExpressionType op = Expression::ExpressionType::ILLEGAL;
+};
+
+class BindingPowerTable
+{
+  protected:
+    using TokenType = Token::TokenType;
+    using ExprType = Expression::ExpressionType;
+
+    static constexpr size_t NUM_TOKEN_TYPES =
+        static_cast<size_t>(TokenType::TOKEN_WHILE) + 1;
+
+    BindingPower powers[NUM_TOKEN_TYPES] = {};
+
+    constexpr void set(TokenType tok, uint8_t left_bp, uint8_t right_bp,
+                       uint8_t paren_right_bp, ExprType op)
+    {
+        powers[static_cast<size_t>(tok)] =
+            {left_bp, right_bp, paren_right_bp, op};
+    }
+
+  public:
+    constexpr BindingPowerTable()
+    {
+        set(TokenType::TOKEN_PLUS, 10, 11, 11, ExprType::PLUS);
+        set(TokenType::TOKEN_MINUS, 10, 11, 11, ExprType::MINUS);
+        set(TokenType::TOKEN_ASTERISK, 20, 21, 19, ExprType::ASTERISK);
+        set(TokenType::TOKEN_SLASH, 20, 21, 19, ExprType::SLASH);
+    }
+
+    constexpr const BindingPower& of(TokenType tok) const
+    {
+        return powers[static_cast<size_t>(tok)];
+    }
+};
+constexpr BindingPowerTable binding_powers;
+
+/*
+ * Calls f on every token of a subtree, the identifiers and literals
+ * */
+template<typename F>
+class TokenWalk
+{
+  protected:
+    F &f;
+
+  public:
+    TokenWalk(F &_f) : f(_f) {}
+
+    void walkIden(Identifier *iden) { f(iden->getToken()); }
+
+    void walkExpr(Expression *expr)
+    {
+        visit(*expr, Overloaded {
+            [&](LiteralExpression &lit) { f(lit.getToken()); },
+            [&](ArithExpression &arith)
+            {
+                walkExpr(arith.getLeft());
+                walkExpr(arith.getRight());
+            },
+            [&](ArrayExpression &array)
+            {
+                walkExpr(array.getNumElements());
+                for (auto ele : array.getElements()) walkExpr(ele);
+            },
+            [&](ConstArrayExpression &array)
+            {
+                walkExpr(array.getNumElements());
+            },
+            [&](IndexExpression &index)
+            {
+                walkIden(index.getIdentifier());
+                walkExpr(index.getIndex());
+            },
+            [&](CallExpression &call)
+            {
+                walkIden(call.getIdentifier());
+                for (auto arg : call.getArgs()) walkExpr(arg);
+            }
+        });
+    }
+
+    void walkCond(Condition *cond)
+    {
+        walkExpr(cond->getLeft());
+        walkExpr(cond->getRight());
+    }
+
+    void walkBlock(const std::vector<Statement*> &block)
+    {
+        for (auto statement : block) walkStatement(statement);
+    }
+
+    void walkStatement(Statement *statement)
+    {
+        visit(*statement, Overloaded {
+            [&](AssnStatement &assn)
+            {
+                walkExpr(assn.getIden());
+                walkExpr(assn.getExpr());
+            },
+            [&](FuncStatement &func)
+            {
+                walkIden(func.getIdentifier());
+                for (auto &arg : func.getFuncArgs())
+                {
+                    walkIden(arg.getIdentifier());
+                }
+                walkBlock(func.getFuncCodes());
+            },
+            [&](CallStatement &call) { walkExpr(call.getCallExpr()); },
+            [&](RetStatement &ret) { walkExpr(ret.getRetVal()); },
+            [&](IfStatement &if_s)
+            {
+                walkCond(if_s.getCond());
+                walkBlock(if_s.getTakenBlock());
+                walkBlock(if_s.getNotTakenBlock());
+            },
+            [&](ForStatement &for_s)
+            {
+                walkStatement(for_s.getStart());
+                walkCond(for_s.getEnd());
+                walkStatement(for_s.getStep());
+                walkBlock(for_s.getBlock());
+            },
+            [&](WhileStatement &while_s)
+            {
+                walkCond(while_s.getWhileCond());
+                walkBlock(while_s.getWhileBlock());
+            }
+        });
+    }
+};
+
+template<typename F>
+void forEachToken(Statement *statement, F &&f)
+{
+    TokenWalk<F> walk(f);
+    walk.walkStatement(statement);
+}
+
+/*
+ * Copies a subtree into another Program, annotations included
+ * */
+class NodeCopy
+{
+  protected:
+    Program &to;
+
+  public:
+    NodeCopy(Program &_to) : to(_to) {}
+
+    Identifier* copyIden(Identifier *iden)
+    {
+        return to.create<Identifier>(*iden);
+    }
+
+    Expression* copyExpr(Expression *expr)
+    {
+        Expression *copy = visit(*expr, Overloaded {
+            [&](LiteralExpression &lit) -> Expression*
+            {
+                auto copy = to.create<LiteralExpression>(lit.getToken());
+                if (lit.isImplicitZero()) copy->setImplicitZero();
+                return copy;
+            },
+            [&](ArithExpression &arith) -> Expression*
+            {
+                return to.create<ArithExpression>(copyExpr(arith.getLeft()),
+                                                  copyExpr(arith.getRight()),
+                                                  arith.getType());
+            },
+            [&](ArrayExpression &array) -> Expression*
+            {
+                std::vector<Expression*> eles;
+                for (auto ele : array.getElements())
+                {
+                    eles.push_back(copyExpr(ele));
+                }
+                return to.create<ArrayExpression>(
+                    copyExpr(array.getNumElements()), eles);
+            },
+            [&](ConstArrayExpression &array) -> Expression*
+            {
+                auto num_ele = copyExpr(array.getNumElements());
+                if (array.isIntArray())
+                {
+                    auto eles = array.getIntElements();
+                    return to.create<ConstArrayExpression>(num_ele, eles);
+                }
+                auto eles = array.getFloatElements();
+                return to.create<ConstArrayExpression>(num_ele, eles);
+            },
+            [&](IndexExpression &index) -> Expression*
+            {
+                return to.create<IndexExpression>(
+                    copyIden(index.getIdentifier()),
+                    copyExpr(index.getIndex()));
+            },
+            [&](CallExpression &call) -> Expression*
+            {
+                std::vector<Expression*> args;
+                for (auto arg : call.getArgs())
+                {
+                    args.push_back(copyExpr(arg));
+                }
+                return to.create<CallExpression>(
+                    copyIden(call.getIdentifier()), args);
+            }
+        });
+
+        copy->setValType(expr->getValType());
+        return copy;
+    }
+
+    Condition* copyCond(Condition *cond)
+    {
+        std::string opr = cond->getOpr();
+        return to.create<Condition>(copyExpr(cond->getLeft()),
+                                    copyExpr(cond->getRight()),
+                                    opr,
+                                    cond->getType());
+    }
+
+    std::vector<Statement*> copyBlock(const std::vector<Statement*> &block)
+    {
+        std::vector<Statement*> copy;
+        for (auto statement : block) copy.push_back(copyStatement(statement));
+        return copy;
+    }
+
+    Statement* copyStatement(Statement *statement)
+    {
+        return visit(*statement, Overloaded {
+            [&](AssnStatement &assn) -> Statement*
+            {
+                return to.create<AssnStatement>(copyExpr(assn.getIden()),
+                                                copyExpr(assn.getExpr()),
+                                                assn.getDeclType());
+            },
+            [&](FuncStatement &func) -> Statement*
+            {
+                std::vector<FuncStatement::Argument> args;
+                for (auto &arg : func.getFuncArgs())
+                {
+                    args.emplace_back(arg.getArgType(),
+                                      copyIden(arg.getIdentifier()));
+                }
+                auto codes = copyBlock(func.getFuncCodes());
+                return to.create<FuncStatement>(
+                    func.getRetType(), copyIden(func.getIdentifier()),
+                    args, codes);
+            },
+            [&](CallStatement &call) -> Statement*
+            {
+                return to.create<CallStatement>(
+                    copyExpr(call.getCallExpr()), call.getType());
+            },
+            [&](RetStatement &ret) -> Statement*
+            {
+                return to.create<RetStatement>(copyExpr(ret.getRetVal()));
+            },
+            [&](IfStatement &if_s) -> Statement*
+            {
+                auto cond = copyCond(if_s.getCond());
+                auto taken = copyBlock(if_s.getTakenBlock());
+                auto not_taken = copyBlock(if_s.getNotTakenBlock());
+                return to.create<IfStatement>(cond, taken, not_taken);
+            },
+            [&](ForStatement &for_s) -> Statement*
+            {
+                auto start = static_cast<AssnStatement*>(
+                    copyStatement(for_s.getStart()));
+                auto end = copyCond(for_s.getEnd());
+                auto step = static_cast<AssnStatement*>(
+                    copyStatement(for_s.getStep()));
+                auto block = copyBlock(for_s.getBlock());
+                return to.create<ForStatement>(start, end, step, block);
+            },
+            [&](WhileStatement &while_s) -> Statement*
+            {
+                auto cond = copyCond(while_s.getWhileCond());
+                auto block = copyBlock(while_s.getWhileBlock());
+                return to.create<WhileStatement>(cond, block);
+            }
+        });
+    }
+};
+}
+
+Parser::Parser(const char* fn, 
+               unsigned lex_threads,
+               unsigned parse_threads,
+               const char* ast_cache,
+               bool _fold_constants)
+{
+    fold_constants = _fold_constants;
+
+    recordBuiltins();
+
+    if (ast_cache != nullptr && AstCache::load(ast_cache, fn, *this))
+    {
+        return;
+    }
+
+    lexer.reset(new Lexer(fn, lex_threads));
+    window = &lexer->peek();
+    track_spans = lexer->isRelexable();
+
+    if (parse_threads > 1)
+        parseProgramParallel(parse_threads);
+    else
+        parseProgram();
+
+    if (ast_cache != nullptr)
+    {
+        AstCache::write(ast_cache, *this);
+    }
+}
+
+Parser::Parser(Stream, const char* fn, bool _fold_constants, bool lex_stage)
+    : streaming(true)
+{
+    fold_constants = _fold_constants;
+
+    recordBuiltins();
+
+    lexer.reset(lex_stage ? new Lexer(Lexer::Pipeline(), fn) : new Lexer(fn));
+    window = &lexer->peek();
+}
+
+Parser::Parser(Pipeline, const char* fn, bool _fold_constants)
+    : streaming(true)
+{
+    fold_constants = _fold_constants;
+
+    // before the lexing stage starts, it interns from then on
+    recordBuiltins();
+
+    parse_stage.reset(new Parser(Stream(), fn, fold_constants, true));
+    parsed.reset(new SpscQueue<Program*>(PARSED_QUEUE));
+    parse_thread = std::thread(&Parser::parseStage, this);
+}
+
+Parser::~Parser()
 {
-    // Pre-load all the tokens
-    lexer->getToken(cur_token);
-    lexer->getToken(next_token);
+    if (!parse_thread.joinable()) return;
+
+    // A stage blocked on a full queue gives up once it is closed
+    parsed->close();
+    parse_thread.join();
 
+    Program *nodes;
+    while (parsed->tryPop(nodes)) delete nodes;
+}
+
+void Parser::parseStage()
+{
+    auto &stage = *parse_stage;
+    try
+    {
+        Diagnostic::Deferred deferred;
+        while (!stage.curToken().isTokenEOF())
+        {
+            stage.parseFunc();
+            stage.advanceTokens();
+
+            // hand the nodes over, the stage goes on with an empty Program
+            std::unique_ptr<Program> nodes(new Program);
+            nodes->swap(stage.program);
+            if (!parsed->push(nodes.get())) break;
+            nodes.release();
+        }
+    }
+    catch (Diagnostic &diag)
+    {
+        // nextFunc() reports it once it has handed out the functions
+        // before
+        stage_error.reset(new Diagnostic(std::move(diag)));
+    }
+
+    parsed->close();
+}
+
+void Parser::recordBuiltins()
+{
     // Fill the pre-built 
     std::vector<ValueType::Type> arg_types;
     ValueType::Type ret_type = ValueType::Type::VOID;
@@ -20,7 +428,7 @@ Parser::Parser(const char* fn) : lexer(new Lexer(fn))
     record.ret_type = ret_type;
     record.arg_types = arg_types;
     record.is_built_in = true;
-    func_def_tracker.insert({"printVarInt", record});
+    recordDefs(Interner::global().intern("printVarInt"), record);
 
     // printVarFloat
     arg_types.clear();
@@ -28,346 +436,803 @@ Parser::Parser(const char* fn) : lexer(new Lexer(fn))
     record.ret_type = ret_type;
     record.arg_types = arg_types;
     record.is_built_in = true;
-    func_def_tracker.insert({"printVarFloat", record});
+    recordDefs(Interner::global().intern("printVarFloat"), record);
+}
+
+Parser::Parser(const std::vector<FuncRecord> &func_defs)
+    : walk_in_place(true)
+    , func_def_tracker(func_defs)
+{
 
-    parseProgram();
 }
 
 void Parser::advanceTokens()
 {
-    cur_token = next_token;
-    lexer->getToken(next_token);
+    // In place, stay on the EOF padding like the lexer does
+    if (walk_in_place)
+        window += !curToken().isTokenEOF();
+    else
+        window = &lexer->advance();
 }
 
 void Parser::parseProgram()
 {
     // Should always be functions to start with since
     // we don't support globals or structures...
-    while (!cur_token.isTokenEOF())
+    while (!curToken().isTokenEOF())
+    {
+        parseFunc();
+        advanceTokens();
+    }
+}
+
+FuncStatement* Parser::nextFunc()
+{
+    assert(streaming);
+
+    if (parse_stage != nullptr)
+    {
+        handed_out.reset();
+
+        Program *nodes;
+        if (!parsed->pop(nodes))
+        {
+            // The stage stopped at an error. Both stages are stopped
+            // before it ends the compile on this thread.
+            if (stage_error != nullptr)
+            {
+                parse_thread.join();
+                parse_stage.reset();
+                std::unique_ptr<Diagnostic> diag(std::move(stage_error));
+                Diagnostic::report(std::move(*diag));
+            }
+            return nullptr;
+        }
+        handed_out.reset(nodes);
+
+        auto func = static_cast<FuncStatement*>(nodes->getStatements().back());
+
+        FuncRecord record;
+        record.ret_type = func->getRetType();
+        for (auto &arg : func->getFuncArgs())
+        {
+            record.arg_types.push_back(arg.getArgType());
+        }
+        recordDefs(func->getFuncSym(), record);
+        return func;
+    }
+
+    program.clear();
+
+    if (curToken().isTokenEOF()) return nullptr;
+
+    parseFunc();
+    advanceTokens();
+    return static_cast<FuncStatement*>(program.getStatements().back());
+}
+
+void Parser::parseFunc()
+{
+    // the window moves on, keep a copy
+    auto first = curToken();
+
+    ValueType::Type ret_type;
+    Identifier *iden;
+    std::vector<FuncStatement::Argument> args;
+
+    // Track local variables
+    local_vars.enterScope();
+
+    parseFuncSignature(ret_type, iden, args);
+    auto func_proto = parseFuncBody(ret_type, iden, args);
+
+    local_vars.exitScope();
+
+    program.addStatement(func_proto);
+    recordSpan(first, curToken());
+}
+
+void Parser::parseLines(uint32_t begin, uint32_t end)
+{
+    lexer->lexLines(begin, end);
+    window = &lexer->peek();
+    walk_in_place = true;
+
+    parseProgram();
+}
+
+void Parser::recordSpan(Token first, Token last)
+{
+    if (!track_spans) return;
+
+    auto &source = lexer->getSource();
+    auto text = source.getText();
+    auto eol = text.find('\n', last.offset);
+
+    FuncSpan span;
+    span.begin = source.getLineStart(first.line);
+    span.end = (eol == std::string_view::npos) ? text.size() : eol + 1;
+    span.first_line = first.line;
+    span.last_line = last.line;
+    func_spans.push_back(span);
+}
+
+void Parser::parseProgramParallel(unsigned threads)
+{
+    // (1) tokens are walked in place from here, bodies are addressed
+    // by their first token
+    lexer->lexAll();
+    window = &lexer->peek();
+    walk_in_place = true;
+
+    // (2) signatures in source order, bodies are only brace-matched
+    struct Body
     {
         ValueType::Type ret_type;
-        std::unique_ptr<Identifier> iden;
+        Identifier *iden;
         std::vector<FuncStatement::Argument> args;
-        std::vector<std::shared_ptr<Statement>> codes;
+        uint32_t def_order;
+
+        // the '{' and the matching '}'
+        Token *begin;
+        Token *end;
+
+        FuncStatement *func = nullptr;
+    };
+    std::vector<Body> bodies;
+
+    // An error ends the compile where the sequential parse would stop,
+    // at the first function that has one. It is only reported once the
+    // workers are done, from this thread.
+    struct Failure
+    {
+        size_t body = SIZE_MAX;
+        Diagnostic diag;
+    };
+    Failure sig_failure;
 
-        // determine return type
-        ret_type = ValueType::typeTokenToValueType(cur_token);
-        if (ret_type == ValueType::Type::MAX)
+    try
+    {
+        Diagnostic::Deferred deferred;
+        while (!curToken().isTokenEOF())
         {
-	    std::cerr << "[Error] parseProgram: unsupported return type\n"
-                      << "[Line] " << cur_token.getLine() << "\n";
-	    exit(0);
+            Body body;
+            auto &first = curToken();
+
+            // arguments are recorded again by the body parser
+            local_vars.enterScope();
+            parseFuncSignature(body.ret_type, body.iden, body.args);
+            local_vars.exitScope();
+
+            body.def_order = num_defs - 1;
+
+            body.begin = window;
+            skipBlock();
+            body.end = window;
+            recordSpan(first, *body.end);
+
+            bodies.push_back(std::move(body));
+            advanceTokens();
         }
-                
-        // function name
-        advanceTokens();
-        iden = std::make_unique<Identifier>(cur_token);
-        if (!next_token.isTokenLP())
+    }
+    catch (Diagnostic &diag)
+    {
+        // the bodies before it may still fail first
+        sig_failure = {bodies.size(), std::move(diag)};
+    }
+
+    // (3) bodies, each thread with a parser state of its own
+    threads = std::min<size_t>(threads, std::max<size_t>(bodies.size(), 1));
+    for (unsigned i = 0; i < threads; i++)
+    {
+        body_parsers.emplace_back(new Parser(func_def_tracker));
+        body_parsers.back()->fold_constants = fold_constants;
+    }
+
+    // Bodies are taken in source order, so the first failure of each
+    // worker is all there is to keep. Once one fails, those after it
+    // are not worth parsing.
+    std::atomic<size_t> next_body{0};
+    std::vector<Failure> failures(threads);
+    auto parseBodies = [&](unsigned worker)
+    {
+        Diagnostic::Deferred deferred;
+        auto parser = body_parsers[worker].get();
+
+        size_t i = next_body++;
+        try
         {
-            std::cerr << "[Error] Incorrect function defition.\n "
-                      << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
-	}
+            for (; i < bodies.size(); i = next_body++)
+            {
+                auto &body = bodies[i];
 
-        advanceTokens();
-        assert(cur_token.isTokenLP());
+                parser->window = body.begin;
+                parser->visible_defs = body.def_order;
 
-        // Track local variables
-	    std::unordered_map<std::string,ValueType::Type> local_vars;
-        local_vars_tracker.push_back(&local_vars);
+                parser->local_vars.enterScope();
+                for (auto &arg : body.args)
+                {
+                    parser->recordLocalVars(arg);
+                }
+                body.func = parser->parseFuncBody(body.ret_type,
+                                                  body.iden,
+                                                  body.args);
+                parser->local_vars.exitScope();
 
-        // extract arguments
-        while (!cur_token.isTokenRP())
+                if (parser->window != body.end)
+                {
+                    Diagnostic::fail("[Error] parseProgram: function body ",
+                                     "ends before its closing brace\n",
+                                     "[Line] ", body.begin->getLine(), "\n");
+                }
+            }
+        }
+        catch (Diagnostic &diag)
         {
-            advanceTokens();
-            if (cur_token.isTokenRP()) break; // no args
+            failures[worker] = {i, std::move(diag)};
+            next_body = bodies.size();
+        }
+    };
 
-            std::string arg_type = cur_token.getLiteral();
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++)
+    {
+        workers.emplace_back(parseBodies, i);
+    }
+    parseBodies(0);
+    for (auto &worker : workers) worker.join();
 
-            advanceTokens();
-            std::unique_ptr<Identifier> arg_iden(new Identifier(cur_token));
-            FuncStatement::Argument arg(arg_type, arg_iden);
-            args.push_back(arg);
+    auto first = &sig_failure;
+    for (auto &failure : failures)
+    {
+        if (failure.body < first->body) first = &failure;
+    }
+    if (first->body != SIZE_MAX) Diagnostic::report(std::move(first->diag));
+
+    // (4) the Program keeps the source order
+    for (auto &body : bodies)
+    {
+        program.addStatement(body.func);
+    }
+}
 
-            recordLocalVars(arg);
+std::vector<Parser::FuncRecord> Parser::forgetDefs()
+{
+    std::vector<FuncRecord> old_defs;
+    old_defs.swap(func_def_tracker);
+    num_defs = 0;
 
-            advanceTokens();
+    // the built-ins come first, keep their order
+    std::vector<SymbolId> built_ins;
+    for (SymbolId sym = 0; sym < old_defs.size(); sym++)
+    {
+        if (old_defs[sym].is_defined && old_defs[sym].is_built_in)
+        {
+            built_ins.push_back(sym);
         }
-        assert(cur_token.isTokenRP());
+    }
+    std::sort(built_ins.begin(), built_ins.end(),
+              [&](SymbolId a, SymbolId b)
+              {
+                  return old_defs[a].def_order < old_defs[b].def_order;
+              });
+
+    for (auto sym : built_ins) recordDefs(sym, old_defs[sym]);
+    return old_defs;
+}
 
-        advanceTokens();
-        assert(cur_token.isTokenLBrace());
+void Parser::update(const char *fn, std::vector<Edit> edits)
+{
+    std::unique_ptr<Lexer> relexer(
+        new Lexer(std::unique_ptr<Source>(new Source(fn))));
+    if (!relexer->isRelexable())
+    {
+        Diagnostic::fail("[Error] update: ", fn, " is no source text\n");
+    }
+    auto text = relexer->getSource().getText();
+
+    std::sort(edits.begin(), edits.end(),
+              [](const Edit &a, const Edit &b) { return a.offset < b.offset; });
+
+    // Parsed into a fresh Program, the kept functions are copied over.
+    // The old nodes go away with old_program (and the body parsers), so
+    // updates do not pile them up.
+    Program old_program;
+    old_program.swap(program);
+    auto &old_statements = old_program.getStatements();
+    std::vector<FuncSpan> old_spans;
+    old_spans.swap(func_spans);
+
+    // (1) The old functions no edit touches, where they are now. Edits
+    // in front of a function move it by their size change. A function
+    // that shares a line with another one is lexed again with it, so
+    // everything else is whole lines.
+    struct Kept
+    {
+        size_t idx;
+        uint32_t begin;
+        uint32_t end;
+    };
+    std::vector<Kept> kept;
+
+    // without spans (a Program from an AST cache) nothing is kept
+    bool have_spans = (old_spans.size() == old_statements.size());
+
+    size_t next_edit = 0;
+    int64_t shift = 0;
+    for (size_t i = 0; have_spans && i < old_spans.size(); i++)
+    {
+        auto &span = old_spans[i];
+        while (next_edit < edits.size() &&
+               uint64_t(edits[next_edit].offset) +
+               edits[next_edit].old_length < span.begin)
+        {
+            shift += int64_t(edits[next_edit].new_length) -
+                     edits[next_edit].old_length;
+            next_edit++;
+        }
 
-        // record function def
-        recordDefs(iden->getLiteral(), ret_type, args);
+        // touched, an edit ending right at its start may have joined
+        // its first line to the previous one
+        if (next_edit < edits.size() && edits[next_edit].offset < span.end)
+            continue;
+        if ((i > 0 && old_spans[i - 1].last_line == span.first_line) ||
+            (i + 1 < old_spans.size() &&
+             old_spans[i + 1].first_line == span.last_line))
+        {
+            continue;
+        }
 
-        // parse the codes section
-        while (true)
+        // the end of the source may have moved behind the last line
+        int64_t begin = span.begin + shift;
+        int64_t end = span.end + shift;
+        if (begin < 0 || end > int64_t(text.size()) ||
+            (begin > 0 && text[begin - 1] != '\n') ||
+            (end < int64_t(text.size()) && text[end - 1] != '\n'))
         {
-            advanceTokens();
-            if (cur_token.isTokenRBrace())
-                    break;
+            continue;
+        }
+        kept.push_back({i, uint32_t(begin), uint32_t(end)});
+    }
 
-            parseStatement(iden->getLiteral(), codes);
+    // (2) Everything from the start again, in source order: the kept
+    // functions are re-recorded, the lines in between lexed and parsed.
+    // This registers every line of the new source once, in order.
+    auto old_defs = forgetDefs();
+    lexer = std::move(relexer);
+    cached_source.reset();
+    track_spans = true;
+
+    auto &statements = program.getStatements();
+    auto &source = lexer->getSource();
+
+    // Set once the functions in front of the current point are not the
+    // same ones (names and signatures, in the same order) as before.
+    // Until then the kept functions are fine as they are, after that
+    // whatever a kept function refers to is looked up again.
+    bool defs_changed = false;
+
+    size_t old_next = 0;
+    uint32_t pos = 0;
+    auto parseGap = [&](uint32_t end, size_t old_end)
+    {
+        auto first = statements.size();
+        parseLines(pos, end);
+
+        if (statements.size() - first != old_end - old_next)
+        {
+            defs_changed = true;
         }
+        for (size_t i = 0; !defs_changed && first + i < statements.size(); i++)
+        {
+            auto old_sym = static_cast<FuncStatement*>(
+                old_statements[old_next + i])->getFuncSym();
+            auto new_sym = static_cast<FuncStatement*>(
+                statements[first + i])->getFuncSym();
+            defs_changed = old_sym != new_sym ||
+                !old_defs[old_sym].sameSignature(func_def_tracker[new_sym]);
+        }
+    };
 
-        std::unique_ptr<Statement> func_proto
-            (new FuncStatement(ret_type, 
-                               iden, 
-                               args, 
-                               codes,
-                               local_vars));
-        local_vars_tracker.pop_back();
+    for (auto &k : kept)
+    {
+        parseGap(k.begin, k.idx);
+
+        auto func = static_cast<FuncStatement*>(old_statements[k.idx]);
+        auto &span = old_spans[k.idx];
+        auto self = func->getFuncSym();
+        auto &old_self = old_defs[self];
+
+        // Move the tokens over to the new source. A function it sees has
+        // to be the same one it saw before, and one it did not see must
+        // still be unknown, identifiers are parsed differently otherwise.
+        uint32_t first_line = source.getNumLines();
+        uint32_t offset_shift = k.begin - span.begin;
+        uint32_t line_shift = first_line - span.first_line;
+        uint8_t src = source.getId();
+        bool same_defs = true;
+        forEachToken(func, [&](Token &tok)
+        {
+            if (tok.src == 0) return; // built-in literal
+
+            tok.src = src;
+            tok.offset += offset_shift;
+            tok.line += line_shift;
+
+            if (!defs_changed || !tok.isTokenIden() || tok.sym == self)
+                return;
+
+            auto sym = tok.sym;
+            auto before = (sym < old_defs.size() &&
+                           old_defs[sym].is_defined &&
+                           old_defs[sym].def_order <= old_self.def_order) ?
+                          &old_defs[sym] : nullptr;
+            auto now = findFuncDef(sym);
+            if ((before == nullptr) != (now == nullptr) ||
+                (before != nullptr && !before->sameSignature(*now)))
+            {
+                same_defs = false;
+            }
+        });
 
-        program.addStatement(func_proto);
-        
+        if (same_defs)
+        {
+            lexer->skipLines(k.begin, k.end);
+            recordDefs(self, old_self);
+            program.addStatement(NodeCopy(program).copyStatement(func));
+            func_spans.push_back({k.begin, k.end, first_line,
+                                  span.last_line + line_shift});
+        }
+        else
+        {
+            parseLines(k.begin, k.end);
+        }
+
+        old_next = k.idx + 1;
+        pos = k.end;
+    }
+    parseGap(text.size(), old_statements.size());
+
+    body_parsers.clear();
+}
+
+// Braces are balanced within a function body, whatever it contains
+void Parser::skipBlock()
+{
+    assert(curToken().isTokenLBrace());
+    auto &open = curToken();
+
+    size_t depth = 0;
+    while (true)
+    {
+        if (curToken().isTokenLBrace())
+        {
+            depth++;
+        }
+        else if (curToken().isTokenRBrace())
+        {
+            if (--depth == 0) return;
+        }
+        else if (curToken().isTokenEOF())
+        {
+            Diagnostic::fail("[Error] skipBlock: missing closing brace\n",
+                             "[Line] ", open.getLine(), "\n");
+        }
         advanceTokens();
     }
 }
 
-void Parser::parseStatement(std::string &cur_func_name, 
-                            std::vector<std::shared_ptr<Statement>> &codes)
+void Parser::parseFuncSignature(ValueType::Type &ret_type,
+                                Identifier *&iden,
+                                std::vector<FuncStatement::Argument> &args)
 {
-    cur_expr_type = ValueType::Type::MAX;
+    // determine return type
+    ret_type = ValueType::typeTokenToValueType(curToken());
+    if (ret_type == ValueType::Type::MAX)
+    {
+        Diagnostic::fail("[Error] parseProgram: unsupported return type\n",
+                         "[Line] ", curToken().getLine(), "\n");
+    }
+            
+    // function name
+    advanceTokens();
+    iden = program.create<Identifier>(curToken());
+    if (!nextToken().isTokenLP())
+    {
+        Diagnostic::fail("[Error] Incorrect function defition.\n ",
+                         "[Line] ", curToken().getLine(), "\n");
+    }
 
+    advanceTokens();
+    assert(curToken().isTokenLP());
+
+    // extract arguments
+    while (!curToken().isTokenRP())
+    {
+        advanceTokens();
+        if (curToken().isTokenRP()) break; // no args
+
+        std::string arg_type(curToken().getLiteral());
+
+        advanceTokens();
+        auto arg_iden = program.create<Identifier>(curToken());
+        FuncStatement::Argument arg(arg_type, arg_iden);
+        args.push_back(arg);
+
+        recordLocalVars(arg);
+
+        advanceTokens();
+    }
+    assert(curToken().isTokenRP());
+
+    advanceTokens();
+    assert(curToken().isTokenLBrace());
+
+    // record function def
+    recordDefs(iden->getSym(), ret_type, args);
+}
+
+FuncStatement* Parser::parseFuncBody(ValueType::Type ret_type,
+                                     Identifier *iden,
+                                     std::vector<FuncStatement::Argument> &args)
+{
+    std::vector<Statement*> codes;
+
+    // parse the codes section
+    while (true)
+    {
+        advanceTokens();
+        if (curToken().isTokenRBrace())
+                break;
+
+        parseStatement(iden->getSym(), codes);
+    }
+
+    return program.create<FuncStatement>(ret_type, 
+                                         iden, 
+                                         args, 
+                                         codes);
+}
+
+void Parser::parseStatement(SymbolId cur_func_name, 
+                            std::vector<Statement*> &codes)
+{
     // is it an if statement?
-    if (cur_token.isTokenIf())
+    if (curToken().isTokenIf())
     {
         auto code = parseIfStatement(cur_func_name);
-        codes.push_back(std::move(code));
+        codes.push_back(code);
         return;
     }
 
     // is it a for statement?
-    if (cur_token.isTokenFor())
+    if (curToken().isTokenFor())
     {
         // assert(false && "For statements are not supported yet!");
         auto code = parseForStatement(cur_func_name);
-        codes.push_back(std::move(code));
+        codes.push_back(code);
         return;
     }
 
     // is it a while statement?
-    if (cur_token.isTokenWhile())
+    if (curToken().isTokenWhile())
     {
         auto code = parseWhileStatement(cur_func_name);
-        codes.push_back(std::move(code));
+        codes.push_back(code);
         return;
     }
 
     // is it a function call?
     if (auto [is_def, is_built_in] = 
-            isFuncDef(cur_token.getLiteral());
+            isFuncDef(curToken());
         is_def)
     {
         Statement::StatementType call_type = is_built_in ?
             Statement::StatementType::BUILT_IN_CALL_STATEMENT :
             Statement::StatementType::NORMAL_CALL_STATEMENT;
 
-        auto code = parseCall();
-        std::unique_ptr<CallStatement> call = 
-            std::make_unique<CallStatement>(code, call_type); 
+        auto code = typeExpr(parseCall());
+        auto call = program.create<CallStatement>(code, call_type); 
 
-        codes.push_back(std::move(call));
+        codes.push_back(call);
 
         return;
     }
 
     // it it a return statement?
-    if (cur_token.isTokenReturn())
+    if (curToken().isTokenReturn())
     {
 	    advanceTokens();
 
-        cur_expr_type = getFuncRetType(cur_func_name);
-        auto ret = parseExpression();
+        auto ret = typeExpr(parseExpression(),
+                            getFuncRetType(cur_func_name));
 
-        std::unique_ptr<RetStatement> ret_statement = 
-            std::make_unique<RetStatement>(ret);
+        auto ret_statement = program.create<RetStatement>(ret);
 
-        codes.push_back(std::move(ret_statement));
+        codes.push_back(ret_statement);
 
         return;
     }
 
     // is it a variable-assignment?
-    if (isTokenTypeKeyword(cur_token) ||
-        cur_token.isTokenIden())
+    if (isTokenTypeKeyword(curToken()) ||
+        curToken().isTokenIden())
     {
         auto code = parseAssnStatement();
 
-        codes.push_back(std::move(code));
+        codes.push_back(code);
 
         return;
     }
 }
 
-std::unique_ptr<Statement> Parser::parseAssnStatement()
+AssnStatement* Parser::parseAssnStatement()
 {
     // Allocating new variables
-    if (isTokenTypeKeyword(cur_token))
+    if (isTokenTypeKeyword(curToken()))
     {
-        Token type_token = cur_token;
-
-        advanceTokens();
-        if (auto [already_defined, type] = isVarAlreadyDefined(cur_token);
+        // type, name and an optional '[' are all in the window, record
+        // the variable before moving past the type
+        auto &type_token = curToken();
+        auto &name_token = nextToken();
+        if (auto [already_defined, type] = isVarAlreadyDefined(name_token);
             already_defined)
         {
-            std::cerr << "[Error] Re-definition of "
-                      << cur_token.getLiteral() << "\n";
-            std::cerr << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
+            Diagnostic::fail("[Error] Re-definition of ",
+                             name_token.getLiteral(), "\n",
+                             "[Line] ", name_token.getLine(), "\n");
         }
 
-        bool is_array = (next_token.isTokenLBracket()) ? 
-                        true : false;
+        bool is_array = window[2].isTokenLBracket();
 
-        recordLocalVars(cur_token, type_token, is_array);
+        auto var_type = recordLocalVars(name_token, type_token, is_array);
+        auto ele_type = ValueType::elementType(var_type);
 
-        std::unique_ptr<Expression> iden =
-            std::make_unique<LiteralExpression>(cur_token);
+        advanceTokens();
+        Expression *iden = program.create<LiteralExpression>(curToken());
 
-	    std::unique_ptr<Expression> expr;
+	    Expression *expr = nullptr;
         if (!is_array)
         {
             advanceTokens();
-            if (cur_token.isTokenSemicolon())
+            if (curToken().isTokenSemicolon())
             {
                 Token newToken;
-                if (cur_expr_type == ValueType::Type::INT)
+                if (ele_type == ValueType::Type::INT)
                 {
-                    std::string literal = "0";
+                    std::string_view literal = "0";
                     Token::TokenType type = Token::TokenType::TOKEN_INT;
-                    Token _tok(type, literal);
+                    Token _tok = Token::builtin(type, literal);
                     newToken = _tok;
                 }
                 else 
                 {
-                    std::string literal = "0.0";
+                    std::string_view literal = "0.0";
                     Token::TokenType type = Token::TokenType::TOKEN_FLOAT;
-                    Token _tok(type, literal);
+                    Token _tok = Token::builtin(type, literal);
                     newToken = _tok;
                 }
-                expr = std::make_unique<LiteralExpression>(newToken);
+                expr = program.create<LiteralExpression>(newToken);
+                expr->setValType(newToken.isTokenInt() ?
+                    ValueType::Type::INT : ValueType::Type::FLOAT);
             }
-            else if (cur_token.isTokenEqual())
+            else if (curToken().isTokenEqual())
             {
                 advanceTokens();
-                expr = parseExpression();
+                expr = typeExpr(parseExpression(), ele_type);
             }
         }
         else
         {
-            expr = parseArrayExpr();
+            expr = parseArrayExpr(ele_type);
         }
 	
-        std::unique_ptr<Statement> statement = 
-            std::make_unique<AssnStatement>(iden, expr);
+        AssnStatement *statement = 
+            program.create<AssnStatement>(iden, expr, var_type);
 
         return statement;
     }
     else
     {
-        auto [already_defined, type] = isVarAlreadyDefined(cur_token);
+        auto [already_defined, type] = isVarAlreadyDefined(curToken());
         if (!already_defined)
         {
-            std::cerr << "[Error] Undefined variable of "
-                      << cur_token.getLiteral() << "\n";
-            std::cerr << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
+            Diagnostic::fail("[Error] Undefined variable of ",
+                             curToken().getLiteral(), "\n",
+                             "[Line] ", curToken().getLine(), "\n");
         }
 
-        cur_expr_type = ValueType::Type::MAX;
-        auto iden = parseExpression();
+        auto iden = typeExpr(parseExpression());
 	
-        assert(cur_token.isTokenEqual());
+        assert(curToken().isTokenEqual());
         advanceTokens();
 
-	    std::unique_ptr<Expression> expr;
-        if (type == ValueType::Type::INT_ARRAY || 
-            type == ValueType::Type::FLOAT_ARRAY)
-        {
-            cur_expr_type = (type == ValueType::Type::INT_ARRAY)
-                            ? type = ValueType::Type::INT
-                            : type = ValueType::Type::FLOAT;
-            
-	    }
-        else
-        {
-            cur_expr_type = type;
-        }
-
-        expr = parseExpression();
+        auto expr = typeExpr(parseExpression(), ValueType::elementType(type));
         
-        std::unique_ptr<Statement> statement = 
-            std::make_unique<AssnStatement>(iden, expr);
+        AssnStatement *statement = 
+            program.create<AssnStatement>(iden, expr);
 
         return statement;
     }
 }
 
-std::unique_ptr<Expression> Parser::parseArrayExpr()
+Expression* Parser::parseArrayExpr(ValueType::Type ele_type)
 {
     advanceTokens();
-    assert(cur_token.isTokenLBracket());
+    assert(curToken().isTokenLBracket());
 
     advanceTokens();
     // num_ele must be an integer
-    auto swap = cur_expr_type;
-    cur_expr_type = ValueType::Type::INT;
-    auto num_ele = parseExpression();
-    cur_expr_type = swap;
+    auto num_ele = typeExpr(parseExpression(), ValueType::Type::INT);
     if (!(num_ele->isExprLiteral()))
     {
-        std::cerr << "[Error] Number of array elements "
-                  << "must be a single integer. \n"
-                  << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
+        Diagnostic::fail("[Error] Number of array elements ",
+                         "must be a single integer. \n",
+                         "[Line] ", curToken().getLine(), "\n");
     }
-    auto num_ele_lit = static_cast<LiteralExpression*>(num_ele.get());
+    auto num_ele_lit = static_cast<LiteralExpression*>(num_ele);
     if (!(num_ele_lit->isLiteralInt()))
     {
-        std::cerr << "[Error] Number of array elements "
-                  << "must be a single integer. \n"
-                  << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
+        Diagnostic::fail("[Error] Number of array elements ",
+                         "must be a single integer. \n",
+                         "[Line] ", curToken().getLine(), "\n");
     }
-    int num_eles_int = stoi(num_ele_lit->getLiteral());
+    int num_eles_int = num_ele_lit->getIntVal();
     if (num_eles_int <= 1)
     {
-        std::cerr << "[Error] Number of array elements "
-                  << "must be larger than 1. \n"
-                  << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
+        Diagnostic::fail("[Error] Number of array elements ",
+                         "must be larger than 1. \n",
+                         "[Line] ", curToken().getLine(), "\n");
     }
 
-    assert(cur_token.isTokenRBracket());
+    assert(curToken().isTokenRBracket());
 
     advanceTokens();
-    assert(cur_token.isTokenEqual());
+    assert(curToken().isTokenEqual());
 
     advanceTokens();
-    assert(cur_token.isTokenLBrace());
-
-    std::vector<std::shared_ptr<Expression>> eles;
-    if (!next_token.isTokenRBrace())
+    assert(curToken().isTokenLBrace());
+
+    // Literals are packed as long as every element is one, the first
+    // element that is not turns the packed ones into nodes again
+    std::vector<Expression*> eles;
+    std::vector<int32_t> int_eles;
+    std::vector<float> float_eles;
+    std::vector<Token> packed_toks;
+    bool packed = true;
+    if (!nextToken().isTokenRBrace())
     {
         advanceTokens();
-        while (!cur_token.isTokenRBrace())
+        while (!curToken().isTokenRBrace())
         {
-            eles.push_back(parseExpression());
-            if (cur_token.isTokenComma())
+            if (packed &&
+                packLiteral(int_eles, float_eles, packed_toks, ele_type))
+            {
+                advanceTokens();
+            }
+            else
+            {
+                if (packed)
+                {
+                    unpackLiterals(eles, int_eles, float_eles, packed_toks);
+                    packed = false;
+                }
+                eles.push_back(typeExpr(parseExpression(), ele_type));
+            }
+            if (curToken().isTokenComma())
                 advanceTokens();
         }
 
         // We make sure consistent number of elements
-        if (num_eles_int != eles.size())
+        auto num_inits = packed ? int_eles.size() + float_eles.size()
+                                : eles.size();
+        if (size_t(num_eles_int) != num_inits)
         {
-            std::cerr << "[Error] Accpeted format: "
-                      << "(1) pre-allocation style - array<int> x[10] = {} "
-                      << "(2) #initials == #elements - "
-                      << "array<int> x[2] = {1, 2} \n"
-                      << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
+            Diagnostic::fail("[Error] Accpeted format: ",
+                             "(1) pre-allocation style - array<int> x[10] = {} ",
+                             "(2) #initials == #elements - ",
+                             "array<int> x[2] = {1, 2} \n",
+                             "[Line] ", curToken().getLine(), "\n");
         }
     }
     else
@@ -377,114 +1242,157 @@ std::unique_ptr<Expression> Parser::parseArrayExpr()
 
     advanceTokens();
 
-    std::unique_ptr<Expression> ret = 
-        std::make_unique<ArrayExpression>(num_ele, eles);
+    Expression *ret;
+    if (!int_eles.empty())
+        ret = program.create<ConstArrayExpression>(num_ele, int_eles);
+    else if (!float_eles.empty())
+        ret = program.create<ConstArrayExpression>(num_ele, float_eles);
+    else
+        ret = program.create<ArrayExpression>(num_ele, eles);
+    ret->setValType(ele_type);
 
     return ret;
 }
 
-std::unique_ptr<Expression> Parser::parseIndex()
+bool Parser::packLiteral(std::vector<int32_t> &int_eles,
+                         std::vector<float> &float_eles,
+                         std::vector<Token> &toks,
+                         ValueType::Type ele_type)
+{
+    auto &tok = curToken();
+    if (!(tok.isTokenInt() || tok.isTokenFloat()) ||
+        !(nextToken().isTokenComma() || nextToken().isTokenRBrace()))
+    {
+        return false;
+    }
+
+    // The packed value is printed again, it must come out the same
+    char buf[Token::CONSTANT_TEXT_SIZE];
+    auto text = tok.isTokenInt() ? Token::formatConstant(tok.int_val, buf)
+                                 : Token::formatConstant(tok.float_val, buf);
+    char literal[Token::CONSTANT_TEXT_SIZE];
+    if (text != tok.getLiteral(literal))
+    {
+        return false;
+    }
+
+    auto type = tok.isTokenInt() ? ValueType::Type::INT
+                                 : ValueType::Type::FLOAT;
+    checkOperand(tok, type, ele_type);
+    if (tok.isTokenInt())
+        int_eles.push_back(tok.int_val);
+    else
+        float_eles.push_back(tok.float_val);
+    toks.push_back(tok);
+    return true;
+}
+
+void Parser::unpackLiterals(std::vector<Expression*> &eles,
+                            std::vector<int32_t> &int_eles,
+                            std::vector<float> &float_eles,
+                            std::vector<Token> &toks)
 {
-    std::unique_ptr<Identifier> iden(new Identifier(cur_token));
+    for (auto &tok : toks)
+    {
+        eles.push_back(program.create<LiteralExpression>(tok));
+        eles.back()->setValType(tok.isTokenInt() ? ValueType::Type::INT
+                                                 : ValueType::Type::FLOAT);
+    }
+    int_eles.clear();
+    float_eles.clear();
+    toks.clear();
+}
+
+Expression* Parser::parseIndex()
+{
+    auto iden = program.create<Identifier>(curToken());
 
     advanceTokens();
-    assert(cur_token.isTokenLBracket());
+    assert(curToken().isTokenLBracket());
 
     advanceTokens();
 
-    // Index must be an integer
-    auto swap = cur_expr_type;
-    cur_expr_type = ValueType::Type::INT;
+    // typed as an integer with the rest of the expression
     auto idx = parseExpression();
-    cur_expr_type = swap;
 
-    std::unique_ptr<Expression> ret = 
-        std::make_unique<IndexExpression>(iden, idx);
+    Expression *ret = program.create<IndexExpression>(iden, idx);
 
-    assert(cur_token.isTokenRBracket());
+    assert(curToken().isTokenRBracket());
 
     return ret;
 }
 
-std::unique_ptr<Expression> Parser::parseCall()
+Expression* Parser::parseCall()
 {
-    std::unique_ptr<Identifier> def(new Identifier(cur_token));
+    auto def = program.create<Identifier>(curToken());
 
     advanceTokens();
-    assert(cur_token.isTokenLP());
+    assert(curToken().isTokenLP());
 
     advanceTokens();
-    std::vector<std::shared_ptr<Expression>> args;
+    std::vector<Expression*> args;
 
-    auto &arg_types = getFuncArgTypes(def->getLiteral());
-    unsigned idx = 0;
-    while (!cur_token.isTokenRP())
+    // each one is typed as its argument with the rest of the expression
+    while (!curToken().isTokenRP())
     {
-        if (cur_token.isTokenRP())
+        if (curToken().isTokenRP())
             break;
 
-        auto swap = cur_expr_type;
-        cur_expr_type = arg_types[idx++];
         args.push_back(parseExpression());
-        cur_expr_type = swap;
 
-        if (cur_token.isTokenRP())
+        if (curToken().isTokenRP())
             break;
         advanceTokens();
     }
 
-    std::unique_ptr<Expression> ret = 
-        std::make_unique<CallExpression>(def, args);
+    Expression *ret = program.create<CallExpression>(def, args);
 
     return ret;
 }
 
-std::unique_ptr<Condition> Parser::parseCondition()
+Condition* Parser::parseCondition(ValueType::Type expect)
 {
     // Left condition
-    auto cond_left = parseExpression();
+    auto cond_left = typeNode(parseExpression(), expect);
 
     // Comp operator
-    std::string comp_opr_str = cur_token.getLiteral();
-    if (next_token.isTokenEqual())
+    std::string comp_opr_str(curToken().getLiteral());
+    if (nextToken().isTokenEqual())
     {
-        comp_opr_str += next_token.getLiteral();
+        comp_opr_str += nextToken().getLiteral();
         advanceTokens();
     }
 
     // Right condition
     advanceTokens();
-    auto cond_right = parseExpression();
+    auto cond_right = typeNode(parseExpression(), expect);
 
     // Build up the condition object
-    std::unique_ptr<Condition> cond = 
-        std::make_unique<Condition>(cond_left,
-                                    cond_right,
-                                    comp_opr_str,
-                                    cur_expr_type);
+    auto cond = program.create<Condition>(cond_left,
+                                          cond_right,
+                                          comp_opr_str,
+                                          expect);
     return cond;
 }
 
-std::unique_ptr<Statement> Parser::parseIfStatement(std::string& 
-                                                    parent_func_name)
+Statement* Parser::parseIfStatement(SymbolId parent_func_name)
 {
     advanceTokens();
-    assert(cur_token.isTokenLP());
+    assert(curToken().isTokenLP());
 
     advanceTokens();
     auto cond = parseCondition();
 
     // Parse taken block
     advanceTokens();
-    assert(cur_token.isTokenLBrace());
+    assert(curToken().isTokenLBrace());
 
-    std::vector<std::shared_ptr<Statement>> taken_block_codes;
-    std::unordered_map<std::string,ValueType::Type> taken_block_local_vars;
-    local_vars_tracker.push_back(&taken_block_local_vars);
+    std::vector<Statement*> taken_block_codes;
+    local_vars.enterScope();
     while (true)
     {
         advanceTokens();
-        if (cur_token.isTokenRBrace())
+        if (curToken().isTokenRBrace())
             break;
 
         parseStatement(parent_func_name, taken_block_codes);
@@ -495,31 +1403,29 @@ std::unique_ptr<Statement> Parser::parseIfStatement(std::string&
         {
             // This RBrace is from the statement,
             // should not terminate.
-            assert(cur_token.isTokenRBrace());
+            assert(curToken().isTokenRBrace());
         }
         else
         {
-            if (cur_token.isTokenRBrace())
+            if (curToken().isTokenRBrace())
                 break;
         }
     }
-    assert(cur_token.isTokenRBrace());
-    local_vars_tracker.pop_back();
+    assert(curToken().isTokenRBrace());
+    local_vars.exitScope();
 
     // Parse else block
-    std::vector<std::shared_ptr<Statement>> not_taken_block_codes;
-    std::unordered_map<std::string,
-                       ValueType::Type> not_taken_block_local_vars;
+    std::vector<Statement*> not_taken_block_codes;
 
-    if (next_token.isTokenElse())
+    if (nextToken().isTokenElse())
     {
         advanceTokens();
-        local_vars_tracker.push_back(&not_taken_block_local_vars);
+        local_vars.enterScope();
         advanceTokens();
         while (true)
         {
             advanceTokens();
-            if (cur_token.isTokenRBrace())
+            if (curToken().isTokenRBrace())
                 break;
 
             parseStatement(parent_func_name, not_taken_block_codes);
@@ -530,60 +1436,58 @@ std::unique_ptr<Statement> Parser::parseIfStatement(std::string&
             {
                 // This RBrace is from the statement,
                 // should not terminate.
-                assert(cur_token.isTokenRBrace());
+                assert(curToken().isTokenRBrace());
             }
             else
             {
-                if (cur_token.isTokenRBrace())
+                if (curToken().isTokenRBrace())
                     break;
             }
         }
-        assert(cur_token.isTokenRBrace());
-        local_vars_tracker.pop_back();
+        assert(curToken().isTokenRBrace());
+        local_vars.exitScope();
     }
 
-    std::unique_ptr<Statement> if_statement = 
-        std::make_unique<IfStatement>(cond, 
-                                      taken_block_codes,
-                                      not_taken_block_codes,
-                                      taken_block_local_vars,
-                                      not_taken_block_local_vars);
+    Statement *if_statement = 
+        program.create<IfStatement>(cond, 
+                                    taken_block_codes,
+                                    not_taken_block_codes);
     
-    assert(cur_token.isTokenRBrace());
+    assert(curToken().isTokenRBrace());
     return if_statement;
 }
 
-std::unique_ptr<Statement> Parser::parseForStatement(std::string& 
-                                                     parent_func_name)
+Statement* Parser::parseForStatement(SymbolId parent_func_name)
 {
-    std::vector<std::shared_ptr<Statement>> block;
-    std::unordered_map<std::string,ValueType::Type> block_local_vars;
-    local_vars_tracker.push_back(&block_local_vars);
+    std::vector<Statement*> block;
+    local_vars.enterScope();
 
     advanceTokens();
-    assert(cur_token.isTokenLP());
+    assert(curToken().isTokenLP());
 
     advanceTokens();
     auto start = parseAssnStatement();
 
-    assert(cur_token.isTokenSemicolon());
+    assert(curToken().isTokenSemicolon());
     
+    // The condition starts from the type of the start value, as the
+    // header is one run of expressions
     advanceTokens();
-    auto end = parseCondition();
-    assert(cur_token.isTokenSemicolon());
+    auto end = parseCondition(start->getExpr()->getValType());
+    assert(curToken().isTokenSemicolon());
     
     advanceTokens();
     auto step = parseAssnStatement();
 
-    assert(cur_token.isTokenRP());
+    assert(curToken().isTokenRP());
 
     advanceTokens();
-    assert(cur_token.isTokenLBrace());
+    assert(curToken().isTokenLBrace());
 
     while (true)
     {
         advanceTokens();
-        if ((cur_token.isTokenRBrace()))
+        if ((curToken().isTokenRBrace()))
             break;
         
         parseStatement(parent_func_name, block);
@@ -594,47 +1498,44 @@ std::unique_ptr<Statement> Parser::parseForStatement(std::string&
         {
             // This RBrace is from the statement,
             // should not terminate.
-            assert(cur_token.isTokenRBrace());
+            assert(curToken().isTokenRBrace());
         }
         else
         {
-            if (cur_token.isTokenRBrace())
+            if (curToken().isTokenRBrace())
                 break;
         }
 
     }
-    assert(cur_token.isTokenRBrace());
-    local_vars_tracker.pop_back();
-
-    std::unique_ptr<Statement> for_statement = 
-        std::make_unique<ForStatement>(start, 
-                                       end, 
-                                       step, 
-                                       block, 
-                                       block_local_vars);
+    assert(curToken().isTokenRBrace());
+    local_vars.exitScope();
+
+    Statement *for_statement = 
+        program.create<ForStatement>(start, 
+                                     end, 
+                                     step, 
+                                     block);
     return for_statement;
 }
 
-std::unique_ptr<Statement> Parser::parseWhileStatement(std::string& 
-                                                     parent_func_name)
+Statement* Parser::parseWhileStatement(SymbolId parent_func_name)
 {
-    std::vector<std::shared_ptr<Statement>> block;
-    std::unordered_map<std::string,ValueType::Type> block_local_vars;
-    local_vars_tracker.push_back(&block_local_vars);
+    std::vector<Statement*> block;
+    local_vars.enterScope();
 
     advanceTokens();
-    assert(cur_token.isTokenLP());
+    assert(curToken().isTokenLP());
 
     advanceTokens();
     auto cond = parseCondition();
 
     advanceTokens();
-    assert(cur_token.isTokenLBrace());
+    assert(curToken().isTokenLBrace());
 
     while (true)
     {
         advanceTokens();
-        if (cur_token.isTokenRBrace())
+        if (curToken().isTokenRBrace())
             break;
         
         parseStatement(parent_func_name, block);
@@ -645,272 +1546,103 @@ std::unique_ptr<Statement> Parser::parseWhileStatement(std::string&
         {
             // This RBrace is from the statement,
             // should not terminate.
-            assert(cur_token.isTokenRBrace());
+            assert(curToken().isTokenRBrace());
         }
         else
         {
-            if (cur_token.isTokenRBrace())
+            if (curToken().isTokenRBrace())
                 break;
         }
     }
 
-    assert(cur_token.isTokenRBrace());
-    local_vars_tracker.pop_back();
-    std::unique_ptr<Statement> while_statement = 
-        std::make_unique<WhileStatement>(cond, 
-                                       block, 
-                                       block_local_vars);
+    assert(curToken().isTokenRBrace());
+    local_vars.exitScope();
+    Statement *while_statement = 
+        program.create<WhileStatement>(cond, 
+                                       block);
     return while_statement;
 }
 
-std::unique_ptr<Expression> Parser::parseExpression()
+// Pratt parser: a primary, then every infix operator that binds tighter
+// than min_bp. Operators of equal strength are folded in the loop, so
+// long left-associative chains are parsed iteratively.
+Expression* Parser::parseExpression(unsigned min_bp)
 {
-    std::unique_ptr<Expression> left = parseTerm();
+    Expression *left = parsePrimary();
 
     while (true)
     {
-        if (cur_token.isTokenPlus() || 
-            cur_token.isTokenMinus())
-        {
-            Expression::ExpressionType expr_type;
-            if (cur_token.isTokenPlus())
-            {
-                expr_type = Expression::ExpressionType::PLUS;
-            }
-            else
-            {
-                expr_type = Expression::ExpressionType::MINUS;
-            }
-
-            advanceTokens();
-
-            std::unique_ptr<Expression> right;
-
-            // Priority one. ()
-            if (cur_token.isTokenLP())
-            {
-                right = parseTerm();
-                left = std::make_unique<ArithExpression>(left, 
-                       right, 
-                       expr_type);
-                continue;
-            }
-            
-            // Priority two. *, /
-            // check if the next token is a function call
-    	    std::unique_ptr<Expression> pending_expr = nullptr;
-            if (auto [is_def, is_built_in] = 
-                    isFuncDef(cur_token.getLiteral());
-                    is_def)
-            {
-                strictTypeCheck(cur_token);
-                pending_expr = parseCall();
-            }
-
-            // check if the next token is an array index
-            // TODO - add deref in the future
-            if (bool is_index = (next_token.isTokenLBracket()) ?
-                                true : false;
-                is_index)
-            {
-                assert(pending_expr == nullptr);
-                strictTypeCheck(cur_token, is_index);
-                pending_expr = parseIndex();
-            }
-
-            if (next_token.isTokenAsterisk() ||
-                next_token.isTokenSlash())
-            {
-                if (pending_expr != nullptr)
-                {
-                    advanceTokens();
-                    right = parseTerm(std::move(pending_expr));
-                }
-                else
-                {
-                    right = parseTerm();
-                }
-            }
-            else
-            {
-                if (pending_expr != nullptr)
-                {
-                    right = std::move(pending_expr);
-                    advanceTokens();
-                }
-                else
-                {
-                    // Could be a literal or unary expression
-                    right = parseFactor();
-                }
-            }
-
-            left = std::make_unique<ArithExpression>(left, 
-                       right, 
-                       expr_type);
-        }
-        else
+        auto &power = binding_powers.of(curToken().getTokenType());
+        if (power.left_bp <= min_bp)
         {
             return left;
         }
-    }
-}
-
-// For Div/Mul
-std::unique_ptr<Expression> Parser::parseTerm(
-    std::unique_ptr<Expression> pending_left)
-{   
-    std::unique_ptr<Expression> left = 
-        (pending_left != nullptr) ? std::move(pending_left) : parseFactor();
-
-    while (true)
-    {
-        if (cur_token.isTokenAsterisk() || 
-            cur_token.isTokenSlash())
-        {
-            Expression::ExpressionType expr_type;
-            if (cur_token.isTokenAsterisk())
-            {
-                expr_type = Expression::ExpressionType::ASTERISK;
-            }
-            else
-            {
-                expr_type = Expression::ExpressionType::SLASH;
-            }
-
-            advanceTokens();
-
-            std::unique_ptr<Expression> right;
 
-            // We are trying to mul/div something with higher priority
-            if (cur_token.isTokenLP()) 
-            {
-                right = parseTerm();
-            }
-            else
-            {
-                // TODO - add deref in the future
-                bool is_index = (next_token.isTokenLBracket()) ?
-                                true : false;
+        advanceTokens();
 
-                if (is_index)
-                {
-                    // Make sure the array type is consistent
-                    strictTypeCheck(cur_token, is_index);
-                    right = parseIndex();
-                    advanceTokens();
-                }
-                else if (auto [is_def, is_built_in] = 
-                            isFuncDef(cur_token.getLiteral());
-                            is_def)
-                {
-                    // Make sure the function return type is consistent
-                    strictTypeCheck(cur_token, is_index);
-                    right = parseCall();
-                    advanceTokens();
-                }
-                else
-                {
-                    // Could be a literal or unary expression
-                    right = parseFactor();
-                }
-            }
-
-            left = std::make_unique<ArithExpression>(left, 
-                       right, 
-                       expr_type);
-        }
-        else
-        {
-            break;
-        }
+        auto right_bp = curToken().isTokenLP() ? power.paren_right_bp
+                                              : power.right_bp;
+        Expression *right = parseExpression(right_bp);
 
+        left = program.create<ArithExpression>(left, right, power.op);
     }
-
-    return left;
 }
 
-// Deal with () here
-std::unique_ptr<Expression> Parser::parseFactor()
+// (), unary (-,+), indexing, calls and literals
+Expression* Parser::parsePrimary()
 {
-    std::unique_ptr<Expression> left;
+    Expression *left;
 
-    if (cur_token.isTokenLP())
+    if (curToken().isTokenLP())
     {
         advanceTokens();
         left = parseExpression();
-        assert(cur_token.isTokenRP()); // Error checking
+        assert(curToken().isTokenRP()); // Error checking
         advanceTokens();
         return left;
     }
-    // Handle Unary (-,+) operator
-    if (cur_token.isTokenPlus() || 
-            cur_token.isTokenMinus())
-    {
-        Expression::ExpressionType expr_type;
-        Token newToken;
-        // Scenario 1: Unary is minus
-        if (cur_token.isTokenMinus())
-        {
-            expr_type = Expression::ExpressionType::MINUS;
-        }
-        
-        // Otherwise: Unary is plus
-        else
-        {
-            expr_type = Expression::ExpressionType::PLUS;
-        }
 
-        if (cur_expr_type == ValueType::Type::INT)
-        {
-            std::string literal = "0";
-            Token::TokenType type = Token::TokenType::TOKEN_INT;
-            Token _tok(type, literal);
-            newToken = _tok;
-        }
+    // Handle Unary (-,+) operator, i.e., 0 - x and 0 + x
+    if (curToken().isTokenPlus() || 
+            curToken().isTokenMinus())
+    {
+        auto expr_type = binding_powers.of(curToken().getTokenType()).op;
 
-        else
-        {
-            std::string literal = "0.0";
-            Token::TokenType type = Token::TokenType::TOKEN_FLOAT;
-            Token _tok(type, literal);
-            newToken = _tok;
-        }
+        // "0" or "0.0", settled by the typing pass
+        std::string_view literal = "0";
+        Token::TokenType type = Token::TokenType::TOKEN_INT;
+        Token newToken = Token::builtin(type, literal);
 
-        left = std::make_unique<LiteralExpression>(newToken);
+        auto zero = program.create<LiteralExpression>(newToken);
+        zero->setImplicitZero();
+        left = zero;
         advanceTokens();
 
-        std::unique_ptr<Expression> right;
-        if (cur_token.isTokenInt() || cur_token.isTokenFloat())
+        Expression *right;
+        if (curToken().isTokenInt() || curToken().isTokenFloat())
         {
-            right = std::make_unique<LiteralExpression>(cur_token);
+            right = program.create<LiteralExpression>(curToken());
             advanceTokens();
         }
-
         else
         {
-            right = parseFactor();
+            right = parsePrimary();
         }
 
-        left = std::make_unique<ArithExpression>(left, right, expr_type);
-
-        return left;
+        return program.create<ArithExpression>(left, right, expr_type);
     }
     
     // TODO - add deref in the future
-    bool is_index = (next_token.isTokenLBracket()) ?
-                    true : false;
+    bool is_index = nextToken().isTokenLBracket();
 
-    strictTypeCheck(cur_token, is_index);
-    
     if (is_index)
         left = parseIndex();
     else if (auto [is_def, is_built_in] = 
-                 isFuncDef(cur_token.getLiteral());
+                 isFuncDef(curToken());
                  is_def)
         left = parseCall();
     else
-        left = std::make_unique<LiteralExpression>(cur_token);
+        left = program.create<LiteralExpression>(curToken());
 
     advanceTokens();
 
@@ -918,163 +1650,168 @@ std::unique_ptr<Expression> Parser::parseFactor()
 }
 
 
-void RetStatement::printStatement()
+void RetStatement::printStatement(PrintSink &out)
 {
-    std::cout << "    {\n";
-    std::cout << "      [Return]\n";
+    out << "    {\n";
+    out << "      [Return]\n";
     if (ret->getType() == Expression::ExpressionType::LITERAL)
     {
-        std::cout << "      " << ret->print(4);
+        out << "      ";
+        ret->print(out, 4);
     }
     else
     {
-        std::cout << ret->print(4);
+        ret->print(out, 4);
     }
-    std::cout << "    }\n";
+    out << "    }\n";
 }
 
-void AssnStatement::printStatement()
+void AssnStatement::printStatement(PrintSink &out)
 {
-    std::cout << "    {\n";
+    out << "    {\n";
     if (iden->getType() == Expression::ExpressionType::LITERAL)
     {
-        std::cout << "      " << iden->print(4);
+        out << "      ";
+        iden->print(out, 4);
     }
     else
     {
-        std::cout << iden->print(4);
+        iden->print(out, 4);
     }
 
-    std::cout << "      =\n";
+    out << "      =\n";
     if (expr->getType() == Expression::ExpressionType::LITERAL)
     {
-        std::cout << "      " << expr->print(4);
+        out << "      ";
+        expr->print(out, 4);
     }
     else
     {
-        std::cout << expr->print(4);
+        expr->print(out, 4);
     }
 
-    std::cout << "    }\n";
+    out << "    }\n";
 }
 
-void FuncStatement::printStatement()
+void FuncStatement::printStatement(PrintSink &out)
 {
-    std::cout << "{\n";
-    std::cout << "  Function Name: " << iden->print() << "\n";
-    std::cout << "  Return Type: ";
+    out << "{\n";
+    out << "  Function Name: " << iden->getLiteral() << "\n";
+    out << "  Return Type: ";
     if (func_type == ValueType::Type::VOID)
     {
-        std::cout << "void\n";
+        out << "void\n";
     }
     else if (func_type == ValueType::Type::INT)
     {
-        std::cout << "int\n";
+        out << "int\n";
     }
     else if (func_type == ValueType::Type::FLOAT)
     {
-        std::cout << "float\n";
+        out << "float\n";
     }
 
-    std::cout << "  Arguments\n";
+    out << "  Arguments\n";
     for (auto &arg : args)
     {
-        std::cout << "    " << arg.print() << "\n";
+        out << "    ";
+        arg.print(out);
+        out << "\n";
     }
-    if (!args.size()) std::cout << "    NONE\n";
+    if (!args.size()) out << "    NONE\n";
 
-    std::cout << "  Codes\n";
-    std::cout << "  {\n";
+    out << "  Codes\n";
+    out << "  {\n";
     for (auto &code : codes)
     {
-        code->printStatement();
+        code->printStatement(out);
     }
-    std::cout << "  }\n";
-    std::cout << "}\n";
+    out << "  }\n";
+    out << "}\n";
 }
 
-void IfStatement::printStatement()
+void IfStatement::printStatement(PrintSink &out)
 {
-    std::cout << "  {\n";
-    std::cout << "  [IF Statement] \n";
-    std::cout << "  [Condition]\n";
-    cond->printStatement();
-    std::cout << "  [Taken Block]\n";
-    std::cout << "  {\n";
+    out << "  {\n";
+    out << "  [IF Statement] \n";
+    out << "  [Condition]\n";
+    cond->printStatement(out);
+    out << "  [Taken Block]\n";
+    out << "  {\n";
     for (auto &code : taken_block)
     {
-        code->printStatement();
+        code->printStatement(out);
     }
-    std::cout << "  }\n";
+    out << "  }\n";
     if (not_taken_block.size() == 0)
     {
-        std::cout << "  }\n";
+        out << "  }\n";
         return;
     }
-    std::cout << "  [Not Taken Block]\n";
-    std::cout << "  {\n";
+    out << "  [Not Taken Block]\n";
+    out << "  {\n";
     for (auto &code : not_taken_block)
     {
-        code->printStatement();
+        code->printStatement(out);
     }
-    std::cout << "  }\n";
-    std::cout << "  }\n";
+    out << "  }\n";
+    out << "  }\n";
 
 }
 
-void ForStatement::printStatement()
+void ForStatement::printStatement(PrintSink &out)
 {
-    std::cout << "  {\n";
-    std::cout << "  [For Statement] \n";
-    std::cout << "  [Start]\n";
-    start->printStatement();
-    std::cout << "  [End]\n";
-    end->printStatement();
-    std::cout << "  [Step]\n";
-    step->printStatement();
-
-    std::cout << "  [Block]\n";
-    std::cout << "  {\n";
+    out << "  {\n";
+    out << "  [For Statement] \n";
+    out << "  [Start]\n";
+    start->printStatement(out);
+    out << "  [End]\n";
+    end->printStatement(out);
+    out << "  [Step]\n";
+    step->printStatement(out);
+
+    out << "  [Block]\n";
+    out << "  {\n";
     for (auto &code : block)
     {
-        code->printStatement();
+        code->printStatement(out);
     }
-    std::cout << "  }\n";
-    std::cout << "  }\n";
+    out << "  }\n";
+    out << "  }\n";
 
 }
 
-void WhileStatement::printStatement()
+void WhileStatement::printStatement(PrintSink &out)
 {
-    std::cout << "  {\n";
-    std::cout << "  [While Statement] \n";
-    std::cout<<  "  [Condition]\n";
-    whileCond->printStatement();
-    std::cout << "  [Block]\n";
-    std::cout << "  {\n";
+    out << "  {\n";
+    out << "  [While Statement] \n";
+    out << "  [Condition]\n";
+    whileCond->printStatement(out);
+    out << "  [Block]\n";
+    out << "  {\n";
     for (auto &code : whileBlock)
     {
-        code->printStatement();
+        code->printStatement(out);
     }
-    std::cout << "  }\n";
-    std::cout << "  }\n";
+    out << "  }\n";
+    out << "  }\n";
 
 }
 
-void Condition::printStatement()
+void Condition::printStatement(PrintSink &out)
 {
-    std::cout << "  {\n";
-    std::cout << "    [Left]\n";
+    out << "  {\n";
+    out << "    [Left]\n";
     if (left->getType() == Expression::ExpressionType::LITERAL)
-        std::cout << "      " << left->print(3) << "\n";
-    else
-        std::cout << left->print(3) << "\n";
-    std::cout << "    [COMP] " << opr_type_str << "\n\n";
-    std::cout << "    [Right]\n";
+        out << "      ";
+    left->print(out, 3);
+    out << "\n";
+    out << "    [COMP] " << opr_type_str << "\n\n";
+    out << "    [Right]\n";
     if (right->getType() == Expression::ExpressionType::LITERAL) 
-        std::cout << "      " << right->print(3) << "\n";
-    else
-        std::cout << right->print(3) << "\n";
-    std::cout << "  }\n";
+        out << "      ";
+    right->print(out, 3);
+    out << "\n";
+    out << "  }\n";
 }
 }
@@ -1,11 +1,16 @@
 #ifndef __PARSER_HH__
 #define __PARSER_HH__
 
+#include "lexer/diagnostic.hh"
 #include "lexer/lexer.hh"
+#include "parser/arena.hh"
+#include "parser/print_sink.hh"
+#include "parser/symbol_table.hh"
 
 #include <cassert>
 #include <iostream>
 #include <memory>
+#include <thread>
 #include <variant>
 
 namespace Frontend
@@ -66,6 +71,17 @@ class ValueType
         }
     }
 
+    // What indexing a variable of the type gives, arrays are indexed
+    // down to their elements, anything else stays the same
+    static Type elementType(Type _type)
+    {
+        if (_type == Type::INT_ARRAY)
+            return Type::INT;
+        else if (_type == Type::FLOAT_ARRAY)
+            return Type::FLOAT;
+        return _type;
+    }
+
     static Type strToValueType(std::string _type)
     {
         if (_type == "void")
@@ -90,13 +106,10 @@ class Identifier
 
     Identifier(Token &_tok) : tok(_tok) {}
 
-    virtual std::string print()
-    {
-        return tok.getLiteral();
-    }
-
-    auto &getLiteral() { return tok.getLiteral(); }
+    auto getLiteral() { return tok.getLiteral(); }
+    auto getSym() { return tok.getSym(); }
     auto getType() { return tok.prinTokenType(); }
+    auto &getToken() { return tok; }
 };
 
 /* Expression definition */
@@ -116,23 +129,34 @@ class Expression
 
         CALL,
 
+        CONST_ARRAY, // i.e., {1, 2, 3}, packed
+
         ILLEGAL
     };
 
   protected:
     ExpressionType type = ExpressionType::ILLEGAL;
+
+    // What the expression evaluates to, annotated once by the typing
+    // pass (see Parser::typeExpr), MAX until then
+    ValueType::Type val_type = ValueType::Type::MAX;
     
   public:
     Expression() {}
 
     auto getType() { return type; }
 
-    virtual std::string print(unsigned level) { return "[Error] No implementation"; }
+    auto getValType() { return val_type; }
+    void setValType(ValueType::Type _val_type) { val_type = _val_type; }
+
+    // Dispatches to the node's own print, see visit() below
+    void print(PrintSink &out, unsigned level);
 
     bool isExprLiteral() { return type == ExpressionType::LITERAL; }
     bool isExprArray() { return type == ExpressionType::ARRAY; }
     bool isExprIndex() { return type == ExpressionType::INDEX; }
     bool isExprCall() { return type == ExpressionType::CALL; }
+    bool isExprConstArray() { return type == ExpressionType::CONST_ARRAY; }
     bool isExprArith()
     {
         return (type == ExpressionType::PLUS || 
@@ -146,6 +170,10 @@ class LiteralExpression : public Expression
 {
   protected:
     Token tok;
+
+    // The 0 the Parser puts in front of a unary +/-, its type is only
+    // known once the expression is typed
+    bool implicit_zero = false;
     
   public:
     LiteralExpression(const LiteralExpression &_expr) 
@@ -159,47 +187,57 @@ class LiteralExpression : public Expression
         type = ExpressionType::LITERAL;
     }
 
-    std::string& getLiteral() { return tok.getLiteral(); }
+    std::string_view getLiteral() { return tok.getLiteral(); }
+
+    // values converted by the Lexer
+    int32_t getIntVal() { return tok.getIntVal(); }
+    float getFloatVal() { return tok.getFloatVal(); }
 
+    // symbol of a variable
+    SymbolId getSym() { return tok.getSym(); }
+
+    bool isLiteralIden() { return tok.isTokenIden(); }
     bool isLiteralInt() { return tok.isTokenInt(); }
     bool isLiteralFloat() { return tok.isTokenFloat(); }
 
+    bool isImplicitZero() { return implicit_zero; }
+    void setImplicitZero() { implicit_zero = true; }
+
+    auto &getToken() { return tok; }
+
     // Debug print associated with the print in ArithExp
-    std::string print(unsigned level) override
+    void print(PrintSink &out, unsigned)
     {
-        return (tok.getLiteral() + "\n");
+        char buf[Token::CONSTANT_TEXT_SIZE];
+        out << tok.getLiteral(buf) << '\n';
     }
 };
 
 class ArithExpression : public Expression
 {
   protected:
-    // Unique is also good but it will incur errors when
-    // invoking copy constructors
-    std::shared_ptr<Expression> left;
-    std::shared_ptr<Expression> right;
+    Expression *left;
+    Expression *right;
 
   public:
-    // unique can be easily converted to shared
-    ArithExpression(std::unique_ptr<Expression> &_left,
-                    std::unique_ptr<Expression> &_right,
+    ArithExpression(Expression *_left,
+                    Expression *_right,
                     ExpressionType _type)
+        : left(_left)
+        , right(_right)
     {
-        left = std::move(_left);
-        right = std::move(_right);
         type = _type;
     }
 
-    ArithExpression(const ArithExpression &_expr)
+    auto getLeft() { return left; }
+    auto getRight() { return right; }
+
+    void setOperands(Expression *_left, Expression *_right)
     {
-        left = std::move(_expr.left);
-        right = std::move(_expr.right);
-        type = _expr.type;
+        left = _left;
+        right = _right;
     }
 
-    auto getLeft() { return left.get(); }
-    auto getRight() { return right.get(); }
-
     char getOperator()
     {
         switch(type)
@@ -218,157 +256,196 @@ class ArithExpression : public Expression
     }
 
     // Debug print
-    std::string print(unsigned level) override
+    void print(PrintSink &out, unsigned level)
     {
-        std::string prefix(level * 2, ' ');
-
-        std::string ret = "";
         if (left != nullptr)
         {
             if (left->getType() == ExpressionType::LITERAL)
             {
-                ret += prefix;
+                out.indent(level * 2);
             }
 
             if (left->getType() == ExpressionType::CALL)
-                ret += left->print(level);
+                left->print(out, level);
             else
-                ret += left->print(level + 1);
+                left->print(out, level + 1);
         }
         
         if (right != nullptr)
         {
-            ret += prefix;
-            if (type == ExpressionType::PLUS)
-            {
-                ret += "+";
-            }
-            else if (type == ExpressionType::MINUS)
-            {
-                ret += "-";
-            }
-            else if (type == ExpressionType::ASTERISK)
-            {
-                ret += "*";
-            }
-            else if (type == ExpressionType::SLASH)
-            {
-                ret += "/";
-            }
-            ret += "\n";
+            out.indent(level * 2);
+            out << getOperator() << '\n';
             
             if (right->getType() == ExpressionType::LITERAL) 
             {
-                ret += prefix;
+                out.indent(level * 2);
             }
 
             if (right->getType() == ExpressionType::CALL)
-                ret += right->print(level);
+                right->print(out, level);
             else
-                ret += right->print(level + 1);
+                right->print(out, level + 1);
         }
-         
-        return ret;
     }
 };
 
 class ArrayExpression : public Expression
 {
   protected:
-    std::shared_ptr<Expression> num_ele;
-    std::vector<std::shared_ptr<Expression>> eles;
+    Expression *num_ele;
+    std::vector<Expression*> eles;
 
   public:
-    ArrayExpression(std::unique_ptr<Expression> &_num_ele,
-                    std::vector<std::shared_ptr<Expression>> &_eles)
+    ArrayExpression(Expression *_num_ele,
+                    std::vector<Expression*> &_eles)
+        : num_ele(_num_ele)
+        , eles(std::move(_eles))
     {
-        num_ele = std::move(_num_ele);
-        eles = std::move(_eles);
         type = ExpressionType::ARRAY;
     }
-
-    ArrayExpression(const ArrayExpression &_expr)
-    {
-        num_ele = std::move(_expr.num_ele);
-        eles = std::move(_expr.eles);
-        type = _expr.type;
-    }
    
-    auto getNumElements() { return num_ele.get(); }
-    auto &getElements() { return eles; }
+    auto getNumElements() { return num_ele; }
+    const auto &getElements() const { return eles; }
 
-    std::string print(unsigned level) override
+    void print(PrintSink &out, unsigned level)
     {
-        std::string prefix(level * 2, ' ');
+        auto prefix = level * 2;
 
-        std::string ret = prefix + "{\n";
-        ret += (prefix + "  [ARRAY] \n");
-        ret += (prefix + "  [NUM ELEMENTS]\n");
-        ret += (prefix + "  {\n");
+        out.indent(prefix); out << "{\n";
+        out.indent(prefix); out << "  [ARRAY] \n";
+        out.indent(prefix); out << "  [NUM ELEMENTS]\n";
+        out.indent(prefix); out << "  {\n";
         if (num_ele->isExprLiteral())
-            ret += (prefix + "    ");
-        ret += num_ele->print(level + 2);
-        ret += (prefix + "  }\n");
+            out.indent(prefix + 4);
+        num_ele->print(out, level + 2);
+        out.indent(prefix); out << "  }\n";
 
-        ret += (prefix + "  [ELEMENTS]\n");
-        ret += (prefix + "  {\n");
+        out.indent(prefix); out << "  [ELEMENTS]\n";
+        out.indent(prefix); out << "  {\n";
         for (auto &ele : eles)
         {
-            ret += (prefix + "    {\n");
+            out.indent(prefix); out << "    {\n";
             if (ele->isExprLiteral())
-                ret += (prefix + "      ");
-            ret += ele->print(level + 3);
-            ret += (prefix + "    }\n");
+                out.indent(prefix + 6);
+            ele->print(out, level + 3);
+            out.indent(prefix); out << "    }\n";
         }
-        ret += (prefix + "  }\n");
-	ret += (prefix + "}\n");
-        return ret;
+        out.indent(prefix); out << "  }\n";
+        out.indent(prefix); out << "}\n";
     }
 
 };
 
-class IndexExpression : public Expression
+/*
+ * An array initializer of int or float literals only
+ *
+ * The values are packed into one vector instead of a LiteralExpression
+ * per element, a lookup table costs 4 bytes per entry. The Parser only
+ * builds it when every literal is spelled the way Token::formatConstant
+ * prints its value, so the dump shows the same text as the source.
+ * */
+class ConstArrayExpression : public Expression
 {
   protected:
-    std::shared_ptr<Identifier> iden;
-    std::shared_ptr<Expression> idx;
+    Expression *num_ele;
+    // INT or FLOAT
+    ValueType::Type ele_type;
+    std::vector<int32_t> int_eles;
+    std::vector<float> float_eles;
 
   public:
-    IndexExpression(std::unique_ptr<Identifier> &_iden,
-                    std::unique_ptr<Expression> &_idx)
+    ConstArrayExpression(Expression *_num_ele,
+                         std::vector<int32_t> &_int_eles)
+        : num_ele(_num_ele)
+        , ele_type(ValueType::Type::INT)
+        , int_eles(std::move(_int_eles))
     {
-        type = ExpressionType::INDEX;
+        type = ExpressionType::CONST_ARRAY;
+    }
 
-        iden = std::move(_iden);
-        idx = std::move(_idx);
+    ConstArrayExpression(Expression *_num_ele,
+                         std::vector<float> &_float_eles)
+        : num_ele(_num_ele)
+        , ele_type(ValueType::Type::FLOAT)
+        , float_eles(std::move(_float_eles))
+    {
+        type = ExpressionType::CONST_ARRAY;
     }
 
-    auto &getIden() { return iden->getLiteral(); }
-    auto getIndex() { return idx.get(); }
+    auto getNumElements() { return num_ele; }
+    auto getEleType() { return ele_type; }
+    bool isIntArray() { return ele_type == ValueType::Type::INT; }
+    size_t size()
+    {
+        return isIntArray() ? int_eles.size() : float_eles.size();
+    }
+    const auto &getIntElements() const { return int_eles; }
+    const auto &getFloatElements() const { return float_eles; }
 
-    IndexExpression(const IndexExpression& _expr)
+    // Same layout as ArrayExpression::print
+    void print(PrintSink &out, unsigned level)
     {
-        type = ExpressionType::INDEX;
+        auto prefix = level * 2;
+
+        out.indent(prefix); out << "{\n";
+        out.indent(prefix); out << "  [ARRAY] \n";
+        out.indent(prefix); out << "  [NUM ELEMENTS]\n";
+        out.indent(prefix); out << "  {\n";
+        if (num_ele->isExprLiteral())
+            out.indent(prefix + 4);
+        num_ele->print(out, level + 2);
+        out.indent(prefix); out << "  }\n";
+
+        out.indent(prefix); out << "  [ELEMENTS]\n";
+        out.indent(prefix); out << "  {\n";
+        char buf[Token::CONSTANT_TEXT_SIZE];
+        for (size_t i = 0; i < size(); i++)
+        {
+            out.indent(prefix); out << "    {\n";
+            out.indent(prefix + 6);
+            out << (isIntArray() ? Token::formatConstant(int_eles[i], buf)
+                                 : Token::formatConstant(float_eles[i], buf))
+                << '\n';
+            out.indent(prefix); out << "    }\n";
+        }
+        out.indent(prefix); out << "  }\n";
+        out.indent(prefix); out << "}\n";
+    }
+};
+
+class IndexExpression : public Expression
+{
+  protected:
+    Identifier *iden;
+    Expression *idx;
 
-        iden = std::move(_expr.iden);
-        idx = std::move(_expr.idx);
+  public:
+    IndexExpression(Identifier *_iden, Expression *_idx)
+        : iden(_iden)
+        , idx(_idx)
+    {
+        type = ExpressionType::INDEX;
     }
+
+    auto getIden() { return iden->getLiteral(); }
+    auto getIdenSym() { return iden->getSym(); }
+    auto getIdentifier() { return iden; }
+    auto getIndex() { return idx; }
+    void setIndex(Expression *_idx) { idx = _idx; }
     
-    std::string print(unsigned level) override
+    void print(PrintSink &out, unsigned level)
     {
-        std::string prefix(level * 2, ' ');
+        auto prefix = level * 2;
 
-        std::string ret = prefix + "{\n";
-        ret += (prefix + "  [ARRAY] " + iden->getLiteral() + "\n");
-        ret += (prefix + "  [INDEX]\n");
-        ret += (prefix + "  {\n");
+        out.indent(prefix); out << "{\n";
+        out.indent(prefix); out << "  [ARRAY] " << iden->getLiteral() << '\n';
+        out.indent(prefix); out << "  [INDEX]\n";
+        out.indent(prefix); out << "  {\n";
         if (idx->isExprLiteral())
-            ret += (prefix + "      ");
-        ret += idx->print(level + 3);
-        ret += (prefix + "  }\n");
-	ret += (prefix + "}\n");
-        return ret;
-
+            out.indent(prefix + 6);
+        idx->print(out, level + 3);
+        out.indent(prefix); out << "  }\n";
+        out.indent(prefix); out << "}\n";
     }
     
 };
@@ -376,49 +453,43 @@ class IndexExpression : public Expression
 class CallExpression : public Expression
 {
   protected:
-    std::shared_ptr<Identifier> def;
-    std::vector<std::shared_ptr<Expression>> args;
+    Identifier *def;
+    std::vector<Expression*> args;
 
   public:
-    CallExpression(const CallExpression &_expr) 
-    {
-        def = std::move(_expr.def);
-        args = std::move(_expr.args);
-        type = ExpressionType::CALL;
-    }
-
-    CallExpression(std::unique_ptr<Identifier> &_tok, 
-        std::vector<std::shared_ptr<Expression>>_args) 
-        : def(std::move(_tok))
+    CallExpression(Identifier *_def, std::vector<Expression*> &_args) 
+        : def(_def)
         , args(std::move(_args))
     {
         type = ExpressionType::CALL;
     }
 
     // Debug print associated with the print in ArithExp
-    std::string print(unsigned level) override
+    void print(PrintSink &out, unsigned level)
     {
-        std::string prefix(level * 2, ' ');
+        auto prefix = level * 2;
 
-        std::string ret = prefix + "{\n";
-        ret += (prefix + "  [CALL] " + def->getLiteral() + "\n");
+        out.indent(prefix); out << "{\n";
+        out.indent(prefix); out << "  [CALL] " << def->getLiteral() << '\n';
         unsigned idx = 0;
         for (auto &arg : args)
         {
-            ret += (prefix + "  [ARG " + std::to_string(idx++) + "]\n");
-            ret += (prefix + "  {\n");
+            out.indent(prefix); out << "  [ARG " << idx++ << "]\n";
+            out.indent(prefix); out << "  {\n";
             if (arg->getType() == Expression::ExpressionType::LITERAL)
-                ret += (prefix + "    ");
-            ret += arg->print(level + 2);
-            ret += (prefix + "  }\n");
+                out.indent(prefix + 4);
+            arg->print(out, level + 2);
+            out.indent(prefix); out << "  }\n";
         }
 
-	ret += (prefix + "}\n");
-        return ret;
+        out.indent(prefix); out << "}\n";
     }
 
-    auto &getCallFunc() { return def->getLiteral(); }
-    auto &getArgs() { return args; }
+    auto getCallFunc() { return def->getLiteral(); }
+    auto getCallFuncSym() { return def->getSym(); }
+    auto getIdentifier() { return def; }
+    const auto &getArgs() const { return args; }
+    void setArg(size_t i, Expression *arg) { args[i] = arg; }
 };
 
 /* Statement definition*/
@@ -444,7 +515,10 @@ class Statement
   public:
     Statement() {}
 
-    virtual void printStatement() {}
+    auto getType() { return type; }
+
+    // Dispatches to the statement's own printStatement
+    void printStatement(PrintSink &out);
 
     bool isStatementFunc() { return type == StatementType::FUNC_STATEMENT; }
     bool isStatementAssn() { return type == StatementType::ASSN_STATEMENT; }
@@ -465,31 +539,31 @@ class Statement
 class AssnStatement : public Statement
 {
   protected:
-    // using shared due to copy constructors
-    std::shared_ptr<Expression> iden;
-    std::shared_ptr<Expression> expr;
+    Expression *iden;
+    Expression *expr;
+
+    // Type of the variable a declaration introduces, MAX for a plain
+    // assignment
+    ValueType::Type decl_type;
 
   public:
-    AssnStatement(std::unique_ptr<Expression> &_iden,
-                 std::unique_ptr<Expression> &_expr)
+    AssnStatement(Expression *_iden, 
+                  Expression *_expr,
+                  ValueType::Type _decl_type = ValueType::Type::MAX)
+        : iden(_iden)
+        , expr(_expr)
+        , decl_type(_decl_type)
     {
         type = StatementType::ASSN_STATEMENT;
-
-        iden = std::move(_iden);
-        expr = std::move(_expr);
-    }
-    
-    AssnStatement(const AssnStatement &_statement)
-    {
-        iden = std::move(_statement.iden);
-        expr = std::move(_statement.expr);
-        type = _statement.type;
     }
 
-    auto getIden() { return iden.get(); }
-    auto getExpr() { return expr.get(); }
+    auto getIden() { return iden; }
+    auto getExpr() { return expr; }
 
-    void printStatement() override;
+    bool isDecl() { return decl_type != ValueType::Type::MAX; }
+    auto getDeclType() { return decl_type; }
+
+    void printStatement(PrintSink &out);
 };
 
 class FuncStatement : public Statement
@@ -499,116 +573,89 @@ class FuncStatement : public Statement
     {
       protected:
         ValueType::Type type = ValueType::Type::MAX;
-        std::shared_ptr<Identifier> iden;
+        Identifier *iden;
 
       public:
-        Argument(std::string &_type, std::unique_ptr<Identifier> &_iden)
+        Argument(std::string &_type, Identifier *_iden)
+            : iden(_iden)
         {
             type = ValueType::strToValueType(_type);
 
             assert(type != ValueType::Type::MAX);
-
-            iden = std::move(_iden);
         }
 
-        Argument(const Argument &arg)
+        Argument(ValueType::Type _type, Identifier *_iden)
+            : type(_type)
+            , iden(_iden)
         {
-            type = arg.type;
-            iden = std::move(arg.iden);
+            assert(type != ValueType::Type::MAX);
         }
 
-        std::string print()
+        void print(PrintSink &out) const
         {
-            std::string ret = "";
-            if (type == ValueType::Type::INT) ret += "int : ";
-            else if (type == ValueType::Type::FLOAT) ret += "float : ";
+            if (type == ValueType::Type::INT) out << "int : ";
+            else if (type == ValueType::Type::FLOAT) out << "float : ";
 
-            ret += iden->getLiteral();
-
-            return ret;
+            out << iden->getLiteral();
         }
 
-        std::string &getLiteral() { return iden->getLiteral(); }
-        auto getArgType() { return type; }
+        std::string_view getLiteral() const { return iden->getLiteral(); }
+        auto getSym() const { return iden->getSym(); }
+        auto getArgType() const { return type; }
+        auto getIdentifier() const { return iden; }
     };
 
   protected:
-    // using shared due to copy constructors
     ValueType::Type func_type;
-    std::shared_ptr<Identifier> iden;
+    Identifier *iden;
     std::vector<Argument> args;
-    std::vector<std::shared_ptr<Statement>> codes;
-
-    std::unordered_map<std::string, ValueType::Type> local_vars;
+    std::vector<Statement*> codes;
 
   public:
     FuncStatement(ValueType::Type _type,
-                  std::unique_ptr<Identifier> &_iden,
+                  Identifier *_iden,
                   std::vector<Argument> &_args,
-                  std::vector<std::shared_ptr<Statement>> &_codes,
-                  std::unordered_map<std::string,ValueType::Type> &_local_vars)
+                  std::vector<Statement*> &_codes)
+        : func_type(_type)
+        , iden(_iden)
+        , args(std::move(_args))
+        , codes(std::move(_codes))
     {
         type = StatementType::FUNC_STATEMENT;
-
-        func_type = _type;
-        iden = std::move(_iden);
-        args = _args;
-        codes = std::move(_codes);
-        local_vars = _local_vars;
-    }
-    
-    FuncStatement(const FuncStatement &_statement)
-    {
-        type = _statement.type;
-
-        func_type = _statement.func_type;
-        iden = std::move(_statement.iden);
-        args = _statement.args;
-        codes = std::move(_statement.codes);
-        local_vars = _statement.local_vars;
     }
-  
-    auto getLocalVars() {return &local_vars; }
 
     auto getRetType() { return func_type; }
 
-    auto &getFuncName() { return iden->getLiteral(); }
-    auto &getFuncArgs() { return args; }
-    auto &getFuncCodes() { return codes; }
+    auto getFuncName() { return iden->getLiteral(); }
+    auto getFuncSym() { return iden->getSym(); }
+    auto getIdentifier() { return iden; }
+    const auto &getFuncArgs() const { return args; }
+    const auto &getFuncCodes() const { return codes; }
 
-    void printStatement() override;
+    void printStatement(PrintSink &out);
 };
 
 class CallStatement : public Statement
 {
   protected:
-    std::shared_ptr<Expression> expr;
+    Expression *expr;
 
   public:
-    CallStatement(std::unique_ptr<Expression> &_expr,
-                  StatementType _type)
+    CallStatement(Expression *_expr, StatementType _type)
+        : expr(_expr)
     {
         type = _type;
-
-        expr = std::move(_expr);
-    }
-    
-    CallStatement(const CallStatement &_statement)
-    {
-        type = _statement.type;
-
-        expr = std::move(_statement.expr);
     }
     
-    void printStatement() override
+    void printStatement(PrintSink &out)
     {
-        std::cout << expr->print(2);
+        expr->print(out, 2);
     }
 
     CallExpression* getCallExpr()
     {
         CallExpression *call = 
-            static_cast<CallExpression*>(expr.get());
+            static_cast<CallExpression*>(expr);
         return call;
     }
 };
@@ -616,23 +663,17 @@ class CallStatement : public Statement
 class RetStatement : public Statement
 {
   protected:
-    std::shared_ptr<Expression> ret;
+    Expression *ret;
 
   public:
-    RetStatement(std::unique_ptr<Expression> &_ret) : ret(std::move(_ret))
+    RetStatement(Expression *_ret) : ret(_ret)
     {
         type = StatementType::RET_STATEMENT;
     }
 
-    RetStatement(const RetStatement &_statement)
-    {
-        type = _statement.type;
-        ret = std::move(_statement.ret);
-    }
-
-    auto getRetVal() { return ret.get(); }
+    auto getRetVal() { return ret; }
 
-    void printStatement() override;
+    void printStatement(PrintSink &out);
 };
 
 // For if-else and for loop
@@ -650,17 +691,17 @@ class Condition
     OperatorType opr_type = OperatorType::MAX;
     std::string opr_type_str;
 
-    std::shared_ptr<Expression> left;
-    std::shared_ptr<Expression> right;
+    Expression *left;
+    Expression *right;
 
   public:
-    Condition(std::unique_ptr<Expression> &_left,
-              std::unique_ptr<Expression> &_right,
+    Condition(Expression *_left,
+              Expression *_right,
               std::string &_opr_type_str,
               ValueType::Type _comp_type)
     {
-        left = std::move(_left);
-        right = std::move(_right);
+        left = _left;
+        right = _right;
 
         if (_opr_type_str == "==")
             opr_type = OperatorType::EQ;
@@ -682,163 +723,226 @@ class Condition
         comp_type = _comp_type; 
     }
 
-    Condition(const Condition& _cond)
-        : left(std::move(_cond.left))
-        , right(std::move(_cond.right))
-        , opr_type_str(_cond.opr_type_str)
-        , comp_type(_cond.comp_type)
-    {}
-
     auto getType() { return comp_type; }
     auto &getOpr() { return opr_type_str; }
-    auto getLeft() { return left.get(); }
-    auto getRight() { return right.get(); }
+    auto getLeft() { return left; }
+    auto getRight() { return right; }
 
-    void printStatement();
+    void printStatement(PrintSink &out);
 };
 
 class IfStatement : public Statement
 {    
   protected:
-    std::shared_ptr<Condition> cond;
-    std::vector<std::shared_ptr<Statement>> taken_block;
-    std::vector<std::shared_ptr<Statement>> not_taken_block;
-
-    std::unordered_map<std::string, ValueType::Type> taken_local_vars;
-    std::unordered_map<std::string, ValueType::Type> not_taken_local_vars;
+    Condition *cond;
+    std::vector<Statement*> taken_block;
+    std::vector<Statement*> not_taken_block;
 
   public:
 
-    IfStatement(std::unique_ptr<Condition> &_cond,
-                std::vector<std::shared_ptr<Statement>> &_taken_block,
-                std::vector<std::shared_ptr<Statement>> &_not_taken_block,
-                std::unordered_map<std::string, 
-                                   ValueType::Type> &_taken_local_vars,
-                std::unordered_map<std::string, 
-                                   ValueType::Type> &_not_taken_local_vars)
+    IfStatement(Condition *_cond,
+                std::vector<Statement*> &_taken_block,
+                std::vector<Statement*> &_not_taken_block)
+        : cond(_cond)
+        , taken_block(std::move(_taken_block))
+        , not_taken_block(std::move(_not_taken_block))
     {
         type = StatementType::IF_STATEMENT;
-
-        cond = std::move(_cond);
-        taken_block = std::move(_taken_block);
-        not_taken_block = std::move(_not_taken_block);
-
-        taken_local_vars = _taken_local_vars;
-        not_taken_local_vars = _not_taken_local_vars;
     }
 
-    IfStatement(const IfStatement &_if)
-        : cond(std::move(_if.cond))
-        , taken_block(std::move(_if.taken_block))
-        , not_taken_block(std::move(_if.not_taken_block))
-        , taken_local_vars(_if.taken_local_vars)
-        , not_taken_local_vars(_if.not_taken_local_vars)
-    {}
-
-    auto getCond() { return cond.get(); }
-    auto &getTakenBlock() { return taken_block; }
-    auto &getNotTakenBlock() { return not_taken_block; }
-    auto getTakenBlockVars() { return &taken_local_vars; }
-    auto getNotTakenBlockVars() { return &not_taken_local_vars; }
-
-    void printStatement() override;
+    auto getCond() { return cond; }
+    const auto &getTakenBlock() const { return taken_block; }
+    const auto &getNotTakenBlock() const { return not_taken_block; }
+
+    void printStatement(PrintSink &out);
 };
 
 class ForStatement : public Statement
 {    
   protected:
-    std::shared_ptr<Statement> start;
-    std::shared_ptr<Condition> end;
-    std::shared_ptr<Statement> step;
-    std::vector<std::shared_ptr<Statement>> block;
-
-    std::unordered_map<std::string, ValueType::Type> block_local_vars;
+    AssnStatement *start;
+    Condition *end;
+    AssnStatement *step;
+    std::vector<Statement*> block;
 
   public:
 
-    ForStatement(std::unique_ptr<Statement> &_start,
-                 std::unique_ptr<Condition> &_end,
-                 std::unique_ptr<Statement> &_step,
-                 std::vector<std::shared_ptr<Statement>> &_block,
-                 std::unordered_map<std::string, 
-                                    ValueType::Type> &_block_local_vars)
+    ForStatement(AssnStatement *_start,
+                 Condition *_end,
+                 AssnStatement *_step,
+                 std::vector<Statement*> &_block)
+        : start(_start)
+        , end(_end)
+        , step(_step)
+        , block(std::move(_block))
     {
         type = StatementType::FOR_STATEMENT;
-        
-        start = std::move(_start);
-        end = std::move(_end);
-        step = std::move(_step);
-        block = std::move(_block);
-
-        block_local_vars = _block_local_vars;
     }
 
-    ForStatement(const ForStatement &_for)
-        : start(std::move(_for.start))
-        , end(std::move(_for.end))
-        , step(std::move(_for.step))
-        , block(std::move(_for.block))
-        , block_local_vars(_for.block_local_vars)
-    {}
-
-    auto getStart() { return start.get(); }
-    auto getEnd() { return end.get(); }
-    auto getStep() { return step.get(); }
-    auto &getBlock() { return block; }
-    auto getBlockVars() { return &block_local_vars; }
-
-    void printStatement() override;
+    auto getStart() { return start; }
+    auto getEnd() { return end; }
+    auto getStep() { return step; }
+    const auto &getBlock() const { return block; }
+
+    void printStatement(PrintSink &out);
 };
 
 class WhileStatement : public Statement
 {
   protected:
-    std::shared_ptr<Condition> whileCond;
-    std::vector<std::shared_ptr<Statement>> whileBlock;
-    std::unordered_map<std::string, ValueType::Type> while_block_local_vars;
+    Condition *whileCond;
+    std::vector<Statement*> whileBlock;
     
   public:
-    WhileStatement(std::unique_ptr<Condition> &_cond,
-                   std::vector<std::shared_ptr<Statement>> &_block,
-                   std::unordered_map<std::string, 
-                                      ValueType::Type> &_block_local_vars)
+    WhileStatement(Condition *_cond,
+                   std::vector<Statement*> &_block)
+        : whileCond(_cond)
+        , whileBlock(std::move(_block))
     {
         type = StatementType::WHILE_STATEMENT;
-        whileCond = std::move(_cond);
-        whileBlock = std::move(_block);
-        while_block_local_vars = _block_local_vars;
     }
-
-    WhileStatement(const WhileStatement &_while)
-            : whileCond(std::move(_while.whileCond))
-            , whileBlock(std::move(_while.whileBlock))
-            , while_block_local_vars(_while.while_block_local_vars)
-    {}
      
-    auto getWhileCond() { return whileCond.get(); }
-    auto &getWhileBlock() { return whileBlock; }
-    auto getWhileBlockVars() { return &while_block_local_vars; }
+    auto getWhileCond() { return whileCond; }
+    const auto &getWhileBlock() const { return whileBlock; }
 
-    void printStatement() override;
+    void printStatement(PrintSink &out);
 };
 
-/* Program definition */
+/*
+ * Static dispatch over the node kinds
+ *
+ * visit() switches on the node's type tag, a dense enum, so the switch
+ * compiles to a jump table, and hands the node to the visitor as its
+ * concrete class, by reference:
+ *
+ *   visit(*expr, Overloaded {
+ *       [&](LiteralExpression &lit) { ... },
+ *       [&](ArithExpression &arith) { ... },
+ *       ...
+ *   });
+ *
+ * Every overload must return the same type. This replaces the
+ * isExpr*()/static_cast chains and the virtual print methods: there are
+ * no vtables on the nodes, and child lists are only ever handed out as
+ * const references.
+ * */
+template<typename... Ts> struct Overloaded : Ts... { using Ts::operator()...; };
+template<typename... Ts> Overloaded(Ts...) -> Overloaded<Ts...>;
+
+template<typename Visitor>
+decltype(auto) visit(Expression &expr, Visitor &&visitor)
+{
+    using Type = Expression::ExpressionType;
+    switch (expr.getType())
+    {
+        case Type::LITERAL:
+            return visitor(static_cast<LiteralExpression&>(expr));
+        case Type::ARRAY:
+            return visitor(static_cast<ArrayExpression&>(expr));
+        case Type::INDEX:
+            return visitor(static_cast<IndexExpression&>(expr));
+        case Type::PLUS:
+        case Type::MINUS:
+        case Type::ASTERISK:
+        case Type::SLASH:
+            return visitor(static_cast<ArithExpression&>(expr));
+        case Type::CALL:
+            return visitor(static_cast<CallExpression&>(expr));
+        case Type::CONST_ARRAY:
+            return visitor(static_cast<ConstArrayExpression&>(expr));
+        default:
+            assert(false && "illegal expression");
+            __builtin_unreachable();
+    }
+}
+
+template<typename Visitor>
+decltype(auto) visit(Statement &statement, Visitor &&visitor)
+{
+    using Type = Statement::StatementType;
+    switch (statement.getType())
+    {
+        case Type::ASSN_STATEMENT:
+            return visitor(static_cast<AssnStatement&>(statement));
+        case Type::FUNC_STATEMENT:
+            return visitor(static_cast<FuncStatement&>(statement));
+        case Type::RET_STATEMENT:
+            return visitor(static_cast<RetStatement&>(statement));
+        case Type::BUILT_IN_CALL_STATEMENT:
+        case Type::NORMAL_CALL_STATEMENT:
+            return visitor(static_cast<CallStatement&>(statement));
+        case Type::IF_STATEMENT:
+            return visitor(static_cast<IfStatement&>(statement));
+        case Type::FOR_STATEMENT:
+            return visitor(static_cast<ForStatement&>(statement));
+        case Type::WHILE_STATEMENT:
+            return visitor(static_cast<WhileStatement&>(statement));
+        default:
+            assert(false && "illegal statement");
+            __builtin_unreachable();
+    }
+}
+
+inline void Expression::print(PrintSink &out, unsigned level)
+{
+    visit(*this, [&](auto &expr) { expr.print(out, level); });
+}
+
+inline void Statement::printStatement(PrintSink &out)
+{
+    visit(*this, [&](auto &statement) { statement.printStatement(out); });
+}
+
+/* Program definition
+ *
+ * Every node of the tree (identifiers, expressions, conditions and
+ * statements) lives in the Program's arena and is referenced through
+ * plain pointers. The whole tree is released at once when the Program
+ * goes away.
+ * */
 class Program
 {
   protected:
-    std::vector<std::unique_ptr<Statement>> statements;
+    Arena arena;
+    std::vector<Statement*> statements;
 
   public:
     Program() {}
 
-    void addStatement(std::unique_ptr<Statement> &_statement)
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    template<typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        return arena.create<T>(std::forward<Args>(args)...);
+    }
+
+    void addStatement(Statement *_statement)
     {
-        statements.push_back(std::move(_statement));
+        statements.push_back(_statement);
     }
 
-    void printStatements()
+    // Drop every statement and release all the nodes
+    void clear()
     {
-        for (auto &statement : statements) { statement->printStatement(); }
+        statements.clear();
+        arena.reset();
+    }
+
+    // Trade every statement and node with another Program
+    void swap(Program &other)
+    {
+        statements.swap(other.statements);
+        arena.swap(other.arena);
+    }
+
+    // AST dump, buffered straight into the descriptor
+    void printStatements(int fd = STDOUT_FILENO)
+    {
+        std::cout.flush();
+        PrintSink out(fd);
+        for (auto statement : statements) { statement->printStatement(out); }
     }
 
     auto& getStatements() { return statements; }
@@ -847,12 +951,22 @@ class Program
 /* Parser definition */
 class Parser
 {
+    // Saves and restores program and func_def_tracker
+    friend class AstCache;
+
   protected:
     Program program;
 
   protected:
-    Token cur_token;
-    Token next_token;    
+    // The current token and the ones after it, valid until the next
+    // advanceTokens(). Either the lexer's lookahead window, or, once the
+    // whole input is lexed (see parseProgramParallel), the token stream
+    // walked in place.
+    Token *window = nullptr;
+    bool walk_in_place = false;
+
+    Token& curToken() { return window[0]; }
+    Token& nextToken() { return window[1]; }
     
   /************* Section one - record local variable types ***************/
   protected:
@@ -862,74 +976,56 @@ class Parser
                ValueType::Type::MAX;
     }
 
-    // Track each local variable's type
-    // vector is needed because we need a way to distinguish vars inside
-    // if/else, for.
-    int entering_sub_block = 0;
-    std::vector<std::unordered_map<std::string,
-                                   ValueType::Type>*> local_vars_tracker;
+    // Track each local variable's type. A function body and every
+    // if/else, for and while block is a scope.
+    ScopedSymbolTable<ValueType::Type> local_vars;
     // recordLocalVars v1 - record the arguments
     void recordLocalVars(FuncStatement::Argument &arg,
                          bool is_array = false,
                          bool is_ptr = false)
     {
-        auto arg_name = arg.getLiteral();
+        auto arg_name = arg.getSym();
         auto arg_type = arg.getArgType();
         assert(arg_type != ValueType::Type::MAX);
 
-        auto &tracker = local_vars_tracker.back();
-
-        if (auto iter = tracker->find(arg_name);
-                iter != tracker->end())
+        if (local_vars.isBoundInScope(arg_name))
         {
-            std::cerr << "[Error] recordLocalVars: "
-                      << "duplicated variable definition."
-                      << std::endl;
-            exit(0);
+            Diagnostic::fail("[Error] recordLocalVars: ",
+                             "duplicated variable definition.\n");
         }
         else
         {
-            tracker->insert({arg_name, arg_type});
+            local_vars.bind(arg_name, arg_type);
         }
     }
-    // recordLocalVars v2 - record local variables
-    void recordLocalVars(Token &_tok, Token &_type_tok,
-                         bool is_array = false,
-                         bool is_ptr = false)
+    // recordLocalVars v2 - record local variables, returns their type
+    ValueType::Type recordLocalVars(Token &_tok, Token &_type_tok,
+                                    bool is_array = false,
+                                    bool is_ptr = false)
     {
         // determine the token type
         auto var_type = 
             ValueType::typeTokenToValueType(_type_tok, is_array, is_ptr);
         assert(var_type != ValueType::Type::MAX);
-        cur_expr_type = var_type;
 
-        if (cur_expr_type == ValueType::Type::INT_ARRAY ||
-            cur_expr_type == ValueType::Type::INT_PTR)
-        {
-            cur_expr_type = ValueType::Type::INT;
-        }
-        else if (cur_expr_type == ValueType::Type::FLOAT_ARRAY ||
-                 cur_expr_type == ValueType::Type::FLOAT_PTR)
+        if (!_tok.isTokenIden())
         {
-            cur_expr_type = ValueType::Type::FLOAT;
+            Diagnostic::fail("[Error] Invalid variable name ",
+                             _tok.getLiteral(), "\n",
+                             "[Line] ", _tok.getLine(), "\n");
         }
-        
+
         // We should always allocate new variables to the most inner block
-        auto &tracker = local_vars_tracker.back();
-        tracker->insert({_tok.getLiteral(), var_type});
+        local_vars.bind(_tok.getSym(), var_type);
+        return var_type;
     }
     std::pair<bool,ValueType::Type> isVarAlreadyDefined(Token &_tok)
     {
-        for (int i = local_vars_tracker.size() - 1;
-                 i >= 0;
-                 i--)
+        if (auto type = _tok.isTokenIden() ? local_vars.lookup(_tok.getSym())
+                                           : nullptr;
+                type != nullptr)
         {
-            auto &tracker = local_vars_tracker[i];
-            if (auto iter = tracker->find(_tok.getLiteral());
-                    iter != tracker->end())
-            {
-                return std::make_pair(true, iter->second);
-            }
+            return std::make_pair(true, *type);
         }
 
         return std::make_pair(false, ValueType::Type::MAX);
@@ -942,6 +1038,10 @@ class Parser
         std::vector<ValueType::Type> arg_types;
 
         bool is_built_in = false;
+        bool is_defined = false;
+
+        // position among all the definitions, built-ins first
+        uint32_t def_order = 0;
 
         FuncRecord() {}
 
@@ -949,16 +1049,52 @@ class Parser
             : ret_type(_record.ret_type)
             , arg_types(_record.arg_types)
             , is_built_in(_record.is_built_in)
+            , is_defined(_record.is_defined)
+            , def_order(_record.def_order)
         {}
+
+        FuncRecord& operator=(const FuncRecord&) = default;
+
+        bool sameSignature(const FuncRecord &other) const
+        {
+            return ret_type == other.ret_type &&
+                   arg_types == other.arg_types &&
+                   is_built_in == other.is_built_in;
+        }
     };
-    std::unordered_map<std::string,FuncRecord> func_def_tracker;
-    void recordDefs(std::string &_def,
+    // Indexed by SymbolId, grown on demand
+    std::vector<FuncRecord> func_def_tracker;
+    uint32_t num_defs = 0;
+    // A function body only sees the functions defined up to itself. The
+    // sequential parse has no others yet, a body parsed in parallel
+    // knows all of them and is limited here.
+    uint32_t visible_defs = UINT32_MAX;
+    FuncRecord* findFuncDef(SymbolId _def)
+    {
+        if (_def >= func_def_tracker.size() ||
+            !func_def_tracker[_def].is_defined ||
+            func_def_tracker[_def].def_order > visible_defs)
+        {
+            return nullptr;
+        }
+        return &func_def_tracker[_def];
+    }
+    void recordDefs(SymbolId _def, FuncRecord &_record)
+    {
+        assert(findFuncDef(_def) == nullptr && "duplicated def");
+
+        if (_def >= func_def_tracker.size())
+        {
+            func_def_tracker.resize(_def + 1);
+        }
+        func_def_tracker[_def] = _record;
+        func_def_tracker[_def].is_defined = true;
+        func_def_tracker[_def].def_order = num_defs++;
+    }
+    void recordDefs(SymbolId _def,
                     ValueType::Type _type,
                     std::vector<FuncStatement::Argument> &_args)
     {
-        auto iter = func_def_tracker.find(_def);
-        assert(iter == func_def_tracker.end() && "duplicated def");
-
         FuncRecord record;
         record.ret_type = _type;
 
@@ -968,15 +1104,16 @@ class Parser
             arg_types.push_back(arg.getArgType());
         }
         
-        func_def_tracker[_def] = record;
+        recordDefs(_def, record);
     }
     
-    std::pair<bool,bool> isFuncDef(std::string &_def)
+    std::pair<bool,bool> isFuncDef(Token &_tok)
     {
-        if (auto iter = func_def_tracker.find(_def);
-                iter != func_def_tracker.end())
+        if (!_tok.isTokenIden()) return std::make_pair(false,false);
+
+        if (auto record = findFuncDef(_tok.getSym()); record != nullptr)
         {
-            return std::make_pair(true, iter->second.is_built_in);
+            return std::make_pair(true, record->is_built_in);
         }
         else
         {
@@ -985,104 +1122,185 @@ class Parser
     }
 
   public:
-    auto& getFuncArgTypes(std::string &func_name)
+    auto& getFuncArgTypes(SymbolId func_name)
     {
-        auto iter = func_def_tracker.find(func_name);
-        assert(iter != func_def_tracker.end());
-        return iter->second.arg_types;
+        auto record = findFuncDef(func_name);
+        assert(record != nullptr);
+        return record->arg_types;
     }
 
-    auto &getFuncRetType(std::string &_def)
+    auto &getFuncRetType(SymbolId _def)
     {
-        auto iter = func_def_tracker.find(_def);
-        assert(iter != func_def_tracker.end());
+        auto record = findFuncDef(_def);
+        assert(record != nullptr);
 
-        return iter->second.ret_type;
+        return record->ret_type;
     }
 
   protected:
-    /***************** Section two - strict type checking ******************/
-
-    // We force all the elements inside an EXPRESSION with the
-    // same type.
-    ValueType::Type cur_expr_type = ValueType::Type::MAX;
-    // strictTypeCheck v1 - check the token has the same type as the
-    // cur_expr_type.
-    void strictTypeCheck(Token &_tok, bool is_index_or_deref = false)
-    {
-	ValueType::Type tok_type = getTokenType(_tok, is_index_or_deref);
-
-        if (cur_expr_type == ValueType::Type::MAX)
-        {
-            cur_expr_type = tok_type;
-            return;
-        }
-
-        if (tok_type == cur_expr_type)
-        {
-            return;
-        }
-
-        std::cerr << "[Error] Token type of \"" << _tok.getLiteral()
-                  << "\" inconsistent within expression" << std::endl;
-        std::cerr << "[Line] " << cur_token.getLine() << "\n";
-        exit(0);
-    }
-
-    ValueType::Type getTokenType(Token &_tok, bool is_index_or_deref = false)
+    /********************* Section two - typing pass ***********************/
+
+    /*
+     * Typing pass
+     *
+     * Runs over each expression tree once the parser has built all of
+     * it (a value assigned or returned, a condition, a call statement,
+     * ...). It checks that all the operands of an expression have one
+     * type, annotates every node with its type (see
+     * Expression::getValType) and looks each variable or function up
+     * exactly once. Codegen only reads the annotations.
+     *
+     * The expected type comes from the context: the variable assigned,
+     * the return type, an argument, INT for an index. Without one it is
+     * MAX and the first operand sets it.
+     * */
+    // Fold arithmetic on constants while typing, with int (wrapping,
+    // truncating) or float semantics as codegen would evaluate it
+    bool fold_constants = false;
+
+    // Type a whole expression, returns it or the literal it folds to
+    Expression* typeExpr(Expression *expr,
+                         ValueType::Type expect = ValueType::Type::MAX)
     {
-        ValueType::Type tok_type;
-        if (_tok.isTokenInt()) tok_type = ValueType::Type::INT;
-        else if (_tok.isTokenFloat()) tok_type = ValueType::Type::FLOAT;
-        else tok_type = ValueType::Type::MAX;
-
-        // If the token is a variable, we need extract its recorded type
-        for (int i = local_vars_tracker.size() - 1;
-                 i >= 0;
-                 i--)
-        {
-            auto &tracker = local_vars_tracker[i];
-            if (auto iter = tracker->find(_tok.getLiteral());
-                    iter != tracker->end())
-            {
-                tok_type = iter->second;
-                break;
-            }
-        }
-        
-        // If the token is function name, we need to extract its
-        // recorded type.
-        if (auto iter = func_def_tracker.find(_tok.getLiteral());
-                iter != func_def_tracker.end())
-        {
-            tok_type = iter->second.ret_type;
-        }
-        
-        if (is_index_or_deref)
-        {
-            if (tok_type == ValueType::Type::INT_ARRAY)
-                tok_type = ValueType::Type::INT;
-            else if (tok_type == ValueType::Type::FLOAT_ARRAY)
-                tok_type = ValueType::Type::FLOAT;
-        }
-       
-       	if (tok_type == ValueType::Type::MAX)
-        {
-            std::cerr << "[Error] Token \"" << _tok.getLiteral() << "\" not defined!" << std::endl;
-            std::cerr << "[Line] " << cur_token.getLine() << "\n";
-            exit(0);
-        }
-
-        return tok_type;
+        return typeNode(expr, expect);
     }
+    // Operands share expect, it is set by the first one if it is MAX
+    Expression* typeNode(Expression *expr, ValueType::Type &expect);
+    void checkOperand(Token &tok,
+                      ValueType::Type type,
+                      ValueType::Type &expect);
+    Expression* foldArith(ArithExpression *arith, ValueType::Type expect);
 
   protected:
     std::unique_ptr<Lexer> lexer;
 
+    // The source a Program loaded from an AST cache points into, there
+    // is no lexer then
+    std::unique_ptr<Source> cached_source;
+
+    // Parsers of the function bodies in parallel mode, one per thread.
+    // They own the nodes of those bodies.
+    std::vector<std::unique_ptr<Parser>> body_parsers;
+
+    // Body parser, sees the functions recorded in func_defs
+    Parser(const std::vector<FuncRecord> &func_defs);
+
+    /*
+     * Function spans
+     *
+     * The lines each top-level function occupies, in source order, for
+     * update(). Only recorded for mapped source text (see
+     * Lexer::isRelexable), and not for a Program loaded from an AST
+     * cache: update() then parses the whole source again.
+     * */
+    struct FuncSpan
+    {
+        // bytes [begin, end) of the source, from the start of the first
+        // line past the end of the last one
+        uint32_t begin;
+        uint32_t end;
+        uint32_t first_line;
+        uint32_t last_line;
+    };
+    std::vector<FuncSpan> func_spans;
+    bool track_spans = false;
+
+    // see nextFunc()
+    bool streaming = false;
+
+    /*
+     * Parsing stage (see Pipeline)
+     *
+     * parse_stage is a streaming Parser run by parse_thread. Each function
+     * it parses goes out in a Program of its own, at most PARSED_QUEUE
+     * of them ahead of nextFunc(). This Parser only records the
+     * signatures of the functions nextFunc() hands out, so the records
+     * codegen asks for are never the ones the stage is writing. An
+     * error stops the stage, nextFunc() reports it in place of the
+     * function it is in.
+     * */
+    static constexpr size_t PARSED_QUEUE = 64;
+    std::unique_ptr<Parser> parse_stage;
+    std::unique_ptr<SpscQueue<Program*>> parsed;
+    std::thread parse_thread;
+    // nodes of the function nextFunc() returned last
+    std::unique_ptr<Program> handed_out;
+    std::unique_ptr<Diagnostic> stage_error;
+
+    void parseStage();
+    void recordSpan(Token first, Token last);
+
+    // printVarInt and printVarFloat
+    void recordBuiltins();
+
+    // Forget every function record but the built-ins, returns the old
+    // records
+    std::vector<FuncRecord> forgetDefs();
+
   public:
-    Parser(const char* fn); 
+    // With parse_threads > 1 the function bodies are parsed in parallel,
+    // the resulting Program is the same. With an ast_cache file the
+    // Program is loaded from there if it was saved for the same source,
+    // otherwise it is parsed and saved there (see AstCache). With
+    // fold_constants, constant subexpressions become single literals.
+    Parser(const char* fn,
+           unsigned lex_threads = 1,
+           unsigned parse_threads = 1,
+           const char* ast_cache = nullptr,
+           bool fold_constants = false); 
+
+    void printStatements(int fd = STDOUT_FILENO)
+    {
+        program.printStatements(fd);
+    }
 
-    void printStatements() { program.printStatements(); }
+    /*
+     * Streaming mode
+     *
+     * The constructor only opens the input. Each nextFunc() parses one
+     * more function into an otherwise empty Program and returns it,
+     * nullptr at the end of the input. The nodes of a function are
+     * released by the next call, so the AST never holds more than one
+     * function. The function records are kept, later functions are
+     * checked against them as usual.
+     * */
+    struct Stream {};
+    Parser(Stream, const char* fn, bool fold_constants = false,
+           bool lex_stage = false);
+
+    /*
+     * Pipelined mode
+     *
+     * Streaming with the stages on threads of their own: the input is
+     * lexed on one (with lex_stage above, see Lexer::Pipeline), parsed
+     * one function at a time on another, and nextFunc() takes the
+     * parsed functions in order from a bounded queue. Whoever calls
+     * nextFunc() (codegen) thus works on one function while the next
+     * ones are lexed and parsed.
+     * */
+    struct Pipeline {};
+    Parser(Pipeline, const char* fn, bool fold_constants = false);
+
+    ~Parser();
+
+    bool isStreaming() { return streaming; }
+    FuncStatement* nextFunc();
+
+    // A change to the source since it was parsed: the old bytes
+    // [offset, offset + old_length) are now new_length other bytes
+    struct Edit
+    {
+        uint32_t offset;
+        uint32_t old_length;
+        uint32_t new_length;
+    };
+
+    // Bring the Program up to date with the edited source fn, given all
+    // the edits since the last parse or update, non-overlapping, in old
+    // source offsets. Functions whose lines no edit touches keep their
+    // nodes, the remaining lines are lexed and parsed again. The result
+    // is the Program a fresh parse of fn gives.
+    void update(const char *fn, std::vector<Edit> edits);
 
     auto &getProgram() { return program; }
 
@@ -1090,23 +1308,52 @@ class Parser
     void parseProgram();
     void advanceTokens();
 
-    void parseStatement(std::string&,
-                        std::vector<std::shared_ptr<Statement>>&);
-    std::unique_ptr<Statement> parseAssnStatement();
-
-    std::unique_ptr<Condition> parseCondition();
-    std::unique_ptr<Statement> parseIfStatement(std::string&);
-    std::unique_ptr<Statement> parseForStatement(std::string&);
-    std::unique_ptr<Statement> parseWhileStatement(std::string&);
-
-    std::unique_ptr<Expression> parseExpression();
-    std::unique_ptr<Expression> parseTerm(
-        std::unique_ptr<Expression> pending_left = nullptr);
-    std::unique_ptr<Expression> parseFactor();
-
-    std::unique_ptr<Expression> parseArrayExpr();
-    std::unique_ptr<Expression> parseIndex();
-    std::unique_ptr<Expression> parseCall();
+    // One function, from its return type to its closing brace
+    void parseFunc();
+    // Lex the lines [begin, end) of the source and parse the functions
+    // in them
+    void parseLines(uint32_t begin, uint32_t end);
+
+    // Pre-scan the signatures in order, skipping each body by brace
+    // matching, then parse the bodies on the given number of threads
+    void parseProgramParallel(unsigned threads);
+    void skipBlock();
+
+    // From the return type to the '{' of the body, the arguments are
+    // recorded in the current scope and the function in func_def_tracker
+    void parseFuncSignature(ValueType::Type&,
+                            Identifier*&,
+                            std::vector<FuncStatement::Argument>&);
+    // From the '{' of the body to the matching '}'
+    FuncStatement* parseFuncBody(ValueType::Type,
+                                 Identifier*,
+                                 std::vector<FuncStatement::Argument>&);
+
+    void parseStatement(SymbolId, std::vector<Statement*>&);
+    AssnStatement* parseAssnStatement();
+
+    // Both sides are typed together, starting from expect
+    Condition* parseCondition(ValueType::Type expect = ValueType::Type::MAX);
+    Statement* parseIfStatement(SymbolId);
+    Statement* parseForStatement(SymbolId);
+    Statement* parseWhileStatement(SymbolId);
+
+    Expression* parseExpression(unsigned min_bp = 0);
+    Expression* parsePrimary();
+
+    // The initializer of an array of the given element type
+    Expression* parseArrayExpr(ValueType::Type);
+    // Append the current token to the packed initializer if it is a
+    // literal element on its own, checked against the element type. The
+    // token is kept as well until the initializer ends.
+    bool packLiteral(std::vector<int32_t>&, std::vector<float>&,
+                     std::vector<Token>&, ValueType::Type);
+    // Turn the packed initializer into literal nodes of its tokens
+    void unpackLiterals(std::vector<Expression*>&,
+                        std::vector<int32_t>&, std::vector<float>&,
+                        std::vector<Token>&);
+    Expression* parseIndex();
+    Expression* parseCall();
 };
 }
 #endif
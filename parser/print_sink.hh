@@ -0,0 +1,113 @@
+#ifndef __PRINT_SINK_HH__
+#define __PRINT_SINK_HH__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string_view>
+
+#include <unistd.h>
+
+namespace Frontend
+{
+/*
+ * PrintSink - buffered output for the AST dump
+ *
+ * The print methods of the nodes append to one large buffer instead of
+ * building and returning strings, so a node is written exactly once no
+ * matter how deep it sits. The buffer goes to the descriptor whenever
+ * it fills up, and what is left when the sink goes away.
+ * */
+class PrintSink
+{
+  public:
+    static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
+  protected:
+    int fd;
+    std::unique_ptr<char[]> buf;
+    size_t used = 0;
+
+    void flush()
+    {
+        size_t done = 0;
+        while (done < used)
+        {
+            auto n = write(fd, buf.get() + done, used - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0)
+            {
+                std::cerr << "[Error] PrintSink: write failed: "
+                          << strerror(errno) << "\n";
+                exit(0);
+            }
+            done += n;
+        }
+        used = 0;
+    }
+
+  public:
+    PrintSink(int _fd)
+        : fd(_fd)
+        , buf(new char[BUFFER_SIZE])
+    {}
+
+    ~PrintSink() { flush(); }
+
+    PrintSink(const PrintSink&) = delete;
+    PrintSink& operator=(const PrintSink&) = delete;
+
+    PrintSink& operator<<(std::string_view text)
+    {
+        while (used + text.size() > BUFFER_SIZE)
+        {
+            auto part = BUFFER_SIZE - used;
+            memcpy(buf.get() + used, text.data(), part);
+            used += part;
+            text.remove_prefix(part);
+            flush();
+        }
+        memcpy(buf.get() + used, text.data(), text.size());
+        used += text.size();
+        return *this;
+    }
+
+    PrintSink& operator<<(char c)
+    {
+        if (used == BUFFER_SIZE) flush();
+        buf[used++] = c;
+        return *this;
+    }
+
+    PrintSink& operator<<(unsigned val)
+    {
+        char digits[16];
+        auto end = digits + sizeof(digits);
+        auto pos = end;
+        do
+        {
+            *--pos = '0' + val % 10;
+            val /= 10;
+        } while (val != 0);
+        return *this << std::string_view(pos, end - pos);
+    }
+
+    // n spaces
+    void indent(unsigned n)
+    {
+        while (n > 0)
+        {
+            if (used == BUFFER_SIZE) flush();
+            auto part = std::min<size_t>(n, BUFFER_SIZE - used);
+            memset(buf.get() + used, ' ', part);
+            used += part;
+            n -= part;
+        }
+    }
+};
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __SYMBOL_TABLE_HH__
+#define __SYMBOL_TABLE_HH__
+
+#include "lexer/intern.hh"
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace Frontend
+{
+/*
+ * ScopedSymbolTable - what a symbol means at the current point
+ *
+ * Symbols are dense interned ids, so the table is a plain array indexed
+ * by SymbolId holding the innermost binding of every symbol. A binding
+ * remembers the one it shadows, which makes each symbol's chain a
+ * shadow stack threaded through the bindings array.
+ *
+ * The bindings array doubles as the undo log: a scope is a suffix of it,
+ * and leaving the scope pops that suffix, restoring every shadowed
+ * binding. Lookups are O(1) however deep the nesting, entering a scope
+ * is O(1) and leaving it is linear in what the scope bound.
+ *
+ * The Parser binds variable types, Codegen binds types and registers.
+ * */
+template <typename T>
+class ScopedSymbolTable
+{
+  protected:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Binding
+    {
+        SymbolId sym;
+        // binding of sym this one shadows, NONE if there is none
+        uint32_t shadowed;
+        T val;
+    };
+
+    // innermost binding of each symbol, indexed by SymbolId
+    std::vector<uint32_t> heads;
+    // live bindings, oldest first
+    std::vector<Binding> bindings;
+    // bindings.size() when each open scope was entered
+    std::vector<uint32_t> scope_marks;
+
+  public:
+    ScopedSymbolTable() {}
+
+    void enterScope() { scope_marks.push_back(bindings.size()); }
+
+    void exitScope()
+    {
+        assert(!scope_marks.empty());
+        auto mark = scope_marks.back();
+        scope_marks.pop_back();
+
+        while (bindings.size() > mark)
+        {
+            auto &binding = bindings.back();
+            heads[binding.sym] = binding.shadowed;
+            bindings.pop_back();
+        }
+    }
+
+    // Bind sym in the innermost scope
+    void bind(SymbolId sym, const T &val)
+    {
+        assert(!scope_marks.empty());
+        if (sym >= heads.size())
+        {
+            heads.resize(sym + 1, NONE);
+        }
+
+        bindings.push_back({sym, heads[sym], val});
+        heads[sym] = bindings.size() - 1;
+    }
+
+    // Innermost binding of sym, nullptr if sym is not bound. The
+    // pointer is valid until the next bind() or exitScope().
+    T* lookup(SymbolId sym)
+    {
+        if (sym >= heads.size() || heads[sym] == NONE) return nullptr;
+        return &bindings[heads[sym]].val;
+    }
+
+    // Whether the innermost scope itself binds sym
+    bool isBoundInScope(SymbolId sym)
+    {
+        assert(!scope_marks.empty());
+        return sym < heads.size() &&
+               heads[sym] != NONE &&
+               heads[sym] >= scope_marks.back();
+    }
+};
+}
+
+#endif
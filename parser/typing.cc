@@ -0,0 +1,201 @@
+#include "parser/parser.hh"
+
+namespace Frontend
+{
+Expression* Parser::typeNode(Expression *expr, ValueType::Type &expect)
+{
+    using Type = ValueType::Type;
+
+    visit(*expr, Overloaded {
+        [&](LiteralExpression &lit)
+        {
+            auto &tok = lit.getToken();
+
+            // The 0 of a unary +/- is no operand of its own, it is
+            // settled by the expression around it (see below)
+            if (lit.isImplicitZero())
+            {
+                return;
+            }
+
+            Type type = Type::MAX;
+            if (tok.isTokenInt())
+            {
+                type = Type::INT;
+            }
+            else if (tok.isTokenFloat())
+            {
+                type = Type::FLOAT;
+            }
+            else if (auto var = tok.isTokenIden() ?
+                         local_vars.lookup(tok.getSym()) : nullptr;
+                     var != nullptr)
+            {
+                type = *var;
+            }
+
+            checkOperand(tok, type, expect);
+            lit.setValType(type);
+        },
+        [&](IndexExpression &index)
+        {
+            auto &tok = index.getIdentifier()->getToken();
+            auto var = local_vars.lookup(tok.getSym());
+            auto type = (var != nullptr) ? ValueType::elementType(*var)
+                                         : Type::MAX;
+
+            checkOperand(tok, type, expect);
+            index.setValType(type);
+
+            // Index must be an integer
+            auto idx_expect = Type::INT;
+            index.setIndex(typeNode(index.getIndex(), idx_expect));
+        },
+        [&](CallExpression &call)
+        {
+            // Only a defined function is parsed as a call
+            auto &tok = call.getIdentifier()->getToken();
+            auto record = findFuncDef(tok.getSym());
+            assert(record != nullptr);
+
+            checkOperand(tok, record->ret_type, expect);
+            call.setValType(record->ret_type);
+
+            auto &args = call.getArgs();
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                auto arg_expect = (i < record->arg_types.size()) ?
+                    record->arg_types[i] : Type::MAX;
+                call.setArg(i, typeNode(args[i], arg_expect));
+            }
+        },
+        [&](ArithExpression &arith)
+        {
+            auto left = typeNode(arith.getLeft(), expect);
+            auto right = typeNode(arith.getRight(), expect);
+            arith.setOperands(left, right);
+            arith.setValType(expect);
+
+            // The operand fixed the type, the 0 in front of it follows
+            if (left->isExprLiteral() &&
+                static_cast<LiteralExpression*>(left)->isImplicitZero())
+            {
+                auto zero = static_cast<LiteralExpression*>(left);
+                if (expect == Type::FLOAT)
+                {
+                    zero->getToken() =
+                        Token::builtin(Token::TokenType::TOKEN_FLOAT, "0.0");
+                }
+                zero->setValType(expect);
+            }
+        },
+        // typed where they are built, see parseArrayExpr
+        [&](ArrayExpression &) {},
+        [&](ConstArrayExpression &) {}
+    });
+
+    if (fold_constants && expr->isExprArith())
+    {
+        return foldArith(static_cast<ArithExpression*>(expr), expect);
+    }
+    return expr;
+}
+
+void Parser::checkOperand(Token &tok,
+                          ValueType::Type type,
+                          ValueType::Type &expect)
+{
+    if (type == ValueType::Type::MAX)
+    {
+        Diagnostic::fail("[Error] Token \"", tok.getLiteral(),
+                         "\" not defined!\n",
+                         "[Line] ", tok.getLine(), "\n");
+    }
+
+    if (expect == ValueType::Type::MAX)
+    {
+        expect = type;
+        return;
+    }
+
+    if (type == expect)
+    {
+        return;
+    }
+
+    Diagnostic::fail("[Error] Token type of \"", tok.getLiteral(),
+                     "\" inconsistent within expression\n",
+                     "[Line] ", tok.getLine(), "\n");
+}
+
+Expression* Parser::foldArith(ArithExpression *arith, ValueType::Type expect)
+{
+    using ExprType = Expression::ExpressionType;
+
+    auto constant = [](Expression *expr) -> Token*
+    {
+        if (!expr->isExprLiteral()) return nullptr;
+        auto &tok = static_cast<LiteralExpression*>(expr)->getToken();
+        return (tok.isTokenInt() || tok.isTokenFloat()) ? &tok : nullptr;
+    };
+
+    auto l = constant(arith->getLeft());
+    auto r = constant(arith->getRight());
+    if (l == nullptr || r == nullptr || l->type != r->type)
+    {
+        return arith;
+    }
+
+    // Codegen picks the operation by the expression type, leave what it
+    // would not evaluate on these constants alone
+    auto type = l->isTokenInt() ? ValueType::Type::INT
+                                : ValueType::Type::FLOAT;
+    if (expect != ValueType::Type::MAX && expect != type)
+    {
+        return arith;
+    }
+
+    auto op = arith->getType();
+    Token folded;
+    if (type == ValueType::Type::INT)
+    {
+        // i32 add/sub/mul wrap, sdiv truncates. x / 0 and INT32_MIN / -1
+        // are undefined, they are left to run time
+        uint32_t a = l->getIntVal();
+        uint32_t b = r->getIntVal();
+        uint32_t val;
+        switch (op)
+        {
+            case ExprType::PLUS: val = a + b; break;
+            case ExprType::MINUS: val = a - b; break;
+            case ExprType::ASTERISK: val = a * b; break;
+            default:
+                if (b == 0 || (a == uint32_t(INT32_MIN) && b == uint32_t(-1)))
+                {
+                    return arith;
+                }
+                val = int32_t(a) / int32_t(b);
+                break;
+        }
+        folded = Token::constant(int32_t(val));
+    }
+    else
+    {
+        float a = l->getFloatVal();
+        float b = r->getFloatVal();
+        float val;
+        switch (op)
+        {
+            case ExprType::PLUS: val = a + b; break;
+            case ExprType::MINUS: val = a - b; break;
+            case ExprType::ASTERISK: val = a * b; break;
+            default: val = a / b; break;
+        }
+        folded = Token::constant(val);
+    }
+
+    auto lit = program.create<LiteralExpression>(folded);
+    lit->setValType(type);
+    return lit;
+}
+}